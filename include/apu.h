@@ -0,0 +1,71 @@
+#pragma once
+
+#include "common.h"
+#include "state.h"
+
+#define APU_FIRST_ADDR    0xFF10
+#define APU_NR50_ADDR     0xFF24
+#define APU_NR51_ADDR     0xFF25
+#define APU_NR52_ADDR     0xFF26
+#define APU_WAVE_ADDR     0xFF30
+#define APU_REG_COUNT     0x30   // 0xFF10-0xFF3F, wave RAM last
+
+// The frame sequencer is clocked by the falling edge of DIV bit 4 (bit 12 of
+// the internal counter), 512 Hz
+#define APU_FS_PERIOD 8192
+
+typedef struct {
+    uint8_t  enabled;        // NR52 status bit
+    uint8_t  dac;
+    uint8_t  length_enable;
+    uint16_t length;         // clocks left before the channel turns off
+    uint8_t  volume;         // envelope output, unused by the wave channel
+    uint8_t  env_timer;
+} apu_channel;
+
+// Waveform position, only advanced while audio is being produced. Not part
+// of save states: no register exposes it on the DMG except wave RAM while
+// playing, which isn't emulated.
+typedef struct {
+    uint64_t next;           // T-cycle of the next waveform step
+    uint8_t  pos;            // duty or wave RAM position
+    uint16_t lfsr;
+    int32_t  level;          // DAC input last reported to the mix, 0-15
+} apu_voice;
+
+typedef struct {
+    uint8_t     regs[APU_REG_COUNT];
+    apu_channel ch[4];
+    uint8_t     power;
+    uint8_t     sweep_enabled;
+    uint8_t     sweep_timer;
+    uint16_t    sweep_shadow;
+    uint8_t     fs_step;
+    uint64_t    fs_next;     // T-cycle of the next frame sequencer clock
+
+    // Host setting, not saved. Only the instance feeding audio output
+    // synthesises, the rest keep their registers and timing alone.
+    uint8_t     output;
+
+    // Synthesis only, reset on load
+    uint8_t     voicing;     // voices are running and reporting to audio
+    uint64_t    voiced;      // T-cycle voices have been run up to
+    uint64_t    flushed;     // T-cycle of the last audio_flush()
+    apu_voice   voice[4];
+} apu_context;
+
+// Nothing ticks per cycle. Register accesses, DIV writes, saves and frame
+// ends catch the APU up to the current cycle; waveforms are only stepped
+// while audio_active().
+void apu_init(void);
+
+void apu_output(uint8_t enable);
+
+// DIV is about to be reset, which can clock the frame sequencer early
+void apu_div_write(void);
+
+// End of a frame with audio active: catch up and queue the samples
+void apu_frame_end(void);
+
+void apu_save(state_buffer *s);
+void apu_load(state_buffer *s);
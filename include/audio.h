@@ -0,0 +1,67 @@
+#pragma once
+
+#include "common.h"
+
+// Host audio output. The APU reports each change of its left and right mix
+// as a step at a T-cycle; steps are drawn into the sample buffer through a
+// band-limited kernel, so synthesis costs per waveform edge rather than per
+// cycle or per sample. The kernel is a polyphase filter evaluated straight
+// at the output rate, so there is no separate resampling pass. Finished
+// samples go to a ring that one consumer thread, normally the SDL audio
+// callback, drains, and to the capture file if one is open (audio_file.h).
+//
+// Output is per process and follows whichever instance is being run.
+
+// Sub-sample positions and taps of the band-limited step kernel
+#define AUDIO_PHASES 64
+#define AUDIO_TAPS   16
+
+// Samples of headroom for steps between flushes
+#define AUDIO_BUFFER_SIZE 4096
+
+// Stereo frames in the ring, must be a power of two. Kept about half full,
+// 43 ms at 48 kHz.
+#define AUDIO_RING_SIZE 4096
+
+// Most the output rate is bent to steer the ring towards half full
+#define AUDIO_MAX_RATE_DELTA 0.005
+
+typedef struct {
+    uint32_t sample_rate;
+    uint32_t buffered;      // frames in the ring
+    double   rate_ratio;    // current output rate over the nominal one
+    uint64_t produced;      // frames written to the ring
+    uint64_t dropped;       // frames lost to a full ring
+    uint64_t underruns;     // frames the consumer asked for that weren't there
+} audio_stats;
+
+// Produce `sample_rate` Hz stereo, or nothing for 0. Not safe while a
+// consumer is reading.
+void audio_init(uint32_t sample_rate);
+// Feed the ring, and steer the rate by its fill, for a consumer
+void audio_set_playback(uint8_t playback);
+uint8_t audio_playback(void);
+// Playing and not muted, or capturing. The APU synthesises nothing otherwise.
+uint8_t audio_active(void);
+// Stop feeding the ring while above real time; it drains to silence. Capture
+// carries on, it isn't real time.
+void audio_set_muted(uint8_t muted);
+
+// Start a fresh stream of steps at T-cycle `now`, from a silent mix, and top
+// the ring up to half full with silence. Called by the APU whenever it
+// starts synthesising.
+void audio_resume(uint64_t now);
+
+// Add a step of `left`/`right` to the mix at T-cycle `at`, which never goes
+// back before the last flush
+void audio_step(uint64_t at, int32_t left, int32_t right);
+
+// Turn everything before `now` into samples and queue them
+void audio_flush(uint64_t now);
+
+// Consumer side, safe from one thread other than the emulation thread. Fills
+// `frames` interleaved stereo frames, padding with silence when the ring runs
+// short. Returns the frames that were real samples.
+uint32_t audio_read(int16_t *out, uint32_t frames);
+
+audio_stats audio_get_stats(void);
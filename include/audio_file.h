@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+
+// Samples per batch handed to the writer thread, 64 KiB
+#define AUDIO_FILE_BATCH_FRAMES 16384
+
+// Batches allocated before the emulation thread waits for the writer, about
+// 87 s of audio at 48 kHz
+#define AUDIO_FILE_MAX_BATCHES 256
+
+// Capture of the synthesised samples to a file descriptor, as a 16-bit
+// stereo WAV file or headerless little-endian PCM. The emulation thread only
+// copies samples into batches; a writer thread does the I/O, so a slow disk
+// or pipe costs memory rather than emulation time.
+//
+// WAV sizes are filled in on close when `fd` is seekable, and left as
+// 0xFFFFFFFF (unknown length) for pipes. `fd` stays open and owned by the
+// caller.
+uint8_t audio_file_open(int fd, uint32_t sample_rate, gb_audio_format format);
+uint8_t audio_file_recording(void);
+
+// Producer side, from audio_flush()
+void audio_file_write(const int16_t *frames, uint32_t count);
+
+// Write out everything queued and stop. Returns 0 if any write failed.
+uint8_t audio_file_close(void);
+
+// Forget the capture without writing or stopping it, for a forked child: the
+// writer thread and the queued batches belong to the parent.
+void audio_file_detach(void);
+
+typedef struct {
+    uint64_t frames;   // frames queued for writing
+    uint64_t stalls;   // times the emulation thread waited for the writer
+} audio_file_stats;
+
+audio_file_stats audio_file_get_stats(void);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+
+// Run `count` branches of the current machine, each in a forked child that
+// calls `fn` and exits. Children share the ROM and every page neither side
+// writes through the kernel's copy-on-write, so a branch costs the pages it
+// dirties rather than a full state copy. Each child gets `result_size`
+// bytes of a shared mapping, copied to `results` (count * result_size) once
+// all have exited. At most one child per online CPU runs at a time, see
+// host_fork.h.
+//
+// Returns 0 if a child could not be started or did not exit cleanly; its
+// result is left zeroed and the results of the others are still copied.
+uint8_t branch_run(gb_instance *gb, uint32_t count, uint32_t result_size,
+    gb_branch_fn fn, void *user, void *results);
@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "state.h"
+
 // Memory map
 #define BUS_ROM_BANK_0_ADDR 0x0000
 #define BUS_ROM_BANK_N_ADDR 0x4000
@@ -23,8 +25,21 @@
 #define BUS_IO_REG_SIZE   BUS_HRAM_ADDR - BUS_IO_REG_ADDR
 #define BUS_HRAM_SIZE     BUS_IE_REG_ADDR - BUS_HRAM_ADDR
 
+// Address watched by GB_UNTIL_WRITE
+extern uint16_t bus_watch_addr;
+
+// Clear all bus-owned memory, so every reset starts from the same state
+void bus_init(void);
+
 uint8_t bus_read(uint16_t addr);
 void bus_write(uint16_t addr, uint8_t value);
 
 uint16_t bus_read_16(uint16_t addr);
-void bus_write_16(uint16_t addr, uint16_t value);
\ No newline at end of file
+void bus_write_16(uint16_t addr, uint16_t value);
+
+// Pointer to plain memory backing `addr`, or NULL when reads have side effects
+// or depend on banking state that may change (external RAM, IO).
+uint8_t *bus_direct_ptr(uint16_t addr);
+
+void bus_save(state_buffer *s);
+void bus_load(state_buffer *s);
\ No newline at end of file
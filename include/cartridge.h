@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "state.h"
 
 #define MAX_NUM_BANKS 128
 
@@ -8,8 +9,11 @@
 #define CARTRIDGE_TITLE_SIZE 0x10
 #define CARTRIDGE_TYPE_ADDR  0x147
 #define CARTRIDGE_BANK_ADDR  0x148
+#define CARTRIDGE_CHECKSUM_ADDR 0x14E
 
+#define CARTRIDGE_ROM_BANK_SIZE 0x4000
 #define CARTRIDGE_RAM_BANK_SIZE 0x2000
+#define CARTRIDGE_RAM_MAX       (CARTRIDGE_RAM_BANK_SIZE * 4)
 
 typedef enum {
     ROM_ONLY,
@@ -17,22 +21,29 @@ typedef enum {
 } cart_type;
 
 typedef struct {
-    uint8_t  *rom;
+    uint8_t  *rom;  // read only, kept outside the machine arena and shared by clones
     uint8_t   rom_bank_count;
     // uint8_t   selected_bank;
     uint8_t   rom_bank;
     cart_type cartridge_type;
     uint32_t  rom_size;
-    uint8_t  *ram;
+    uint32_t  ram_size;
     uint8_t   ram_enable;
     uint8_t   ram_bank;
     uint8_t   mode;
 } cartridge_context;
 
 uint8_t cartridge_rom_load(const char *rom_path);
+uint8_t cartridge_rom_load_from_memory(const uint8_t *data, uint32_t size);
 uint8_t cartridge_rom_read(uint16_t addr);
+uint8_t *cartridge_rom_ptr(uint16_t addr);
 void cartridge_bank_operation(uint16_t addr, uint8_t value);
 uint8_t cartridge_ram_read(uint16_t addr);
 void cartridge_ram_write(uint16_t addr, uint8_t value);
 void cartridge_print_info(void);
 void cartridge_cleanup(void);
+uint8_t *cartridge_ram_ptr(void);
+uint32_t cartridge_ram_size(void);
+uint16_t cartridge_checksum(void);
+void cartridge_save(state_buffer *s);
+void cartridge_load(state_buffer *s);
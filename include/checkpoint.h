@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+
+// Checkpoint log: a header of u32 magic, u16 version, u16 cart checksum and
+// u32 frame interval, then fixed-size records in run order, little-endian:
+//
+//   u32 frame   frames completed since logging started
+//   u32 step    instruction within the frame, CHECKPOINT_FRAME_END for the
+//               record written as the frame completes
+//   u16 pc
+//   u64 cycles  T-cycles since reset
+//   u64 hash    state_hash()
+//
+// Frame records are written every `interval` frames. Step records, one per
+// instruction, are only written for a single chosen frame, so a comparison
+// can go from a frame range down to one instruction by rerunning both sides.
+#define CHECKPOINT_MAGIC   0x4B434247  // "GBCK"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_HEADER_SIZE 12
+#define CHECKPOINT_RECORD_SIZE 26
+
+#define CHECKPOINT_FRAME_END 0xFFFFFFFF
+#define CHECKPOINT_NO_STEPS  0xFFFFFFFF
+
+typedef struct {
+    uint32_t frame;
+    uint32_t step;
+    uint16_t pc;
+    uint64_t cycles;
+    uint64_t hash;
+} checkpoint_record;
+
+typedef struct {
+    uint8_t diverged;
+    uint8_t length_differs;      // one log ends first, everything shared matches
+    checkpoint_record last_match;
+    checkpoint_record first_a;   // first differing record of each log
+    checkpoint_record first_b;
+} checkpoint_divergence;
+
+// Log every `interval` frames, and every instruction of frame `step_frame`
+// unless it is CHECKPOINT_NO_STEPS. Returns 0 on failure.
+uint8_t checkpoint_open(const char *path, uint32_t interval, uint32_t step_frame);
+
+// Whether step records are wanted for the frame about to run
+uint8_t checkpoint_stepping(void);
+void checkpoint_step(uint16_t pc);
+void checkpoint_frame_done(uint16_t pc);
+
+uint8_t checkpoint_close(void);
+
+// Find where two logs first disagree. Both must use the same interval.
+// Returns 0 if either can't be read.
+uint8_t checkpoint_compare(const char *path_a, const char *path_b, checkpoint_divergence *result);
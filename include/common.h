@@ -8,3 +8,10 @@
 #define GB_SCREEN_RES_Y 144
 
 extern uint8_t emu_run;
+
+// Stop conditions armed for the current run (GB_UNTIL_* bits from gb.h)
+extern uint32_t emu_until;
+
+// End the current run, recording why (GB_STOP_*). Only the first call in a
+// run is kept.
+void emu_stop(uint8_t reason);
@@ -1,9 +1,20 @@
 #pragma once
 
 #include "common.h"
+#include "state.h"
 
 #include <stdint.h>
 
+#define INT_IF_ADDR 0xFF0F
+
+// Interrupt flags, in priority order. Shared by IF (0xFF0F) and IE (0xFFFF)
+#define INT_VBLANK 0x01
+#define INT_STAT   0x02
+#define INT_TIMER  0x04
+#define INT_SERIAL 0x08
+#define INT_JOYPAD 0x10
+#define INT_MASK   0x1F
+
 typedef struct {
     uint8_t zero        : 1;  // z
     uint8_t subtraction : 1;  // n
@@ -19,8 +30,20 @@ typedef struct {
     uint16_t pc;
     uint16_t sp;
     uint8_t  t_cycles;
+    uint8_t  ime;          // interrupt master enable
+    uint8_t  ime_pending;  // EI takes effect after the following instruction
+    uint8_t  halted;
+    uint8_t  interrupt_flag;  // IF, 0xFF0F
 } cpu_context;
 
+// Targets of GB_UNTIL_PC and GB_UNTIL_INTERRUPT
+extern uint16_t cpu_watch_pc;
+extern uint8_t  cpu_watch_interrupts;
+
 void cpu_init(void);
 void cpu_step(void);
-void cpu_execute(uint8_t op);
\ No newline at end of file
+void cpu_execute(uint8_t op);
+void cpu_request_interrupt(uint8_t flag);
+uint16_t cpu_pc(void);
+void cpu_save(state_buffer *s);
+void cpu_load(state_buffer *s);
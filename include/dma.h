@@ -0,0 +1,24 @@
+#pragma once
+
+#include "common.h"
+#include "state.h"
+
+#define DMA_ADDR 0xFF46
+
+#define DMA_LENGTH 0xA0
+// T-cycles the CPU is locked out of the buses while a transfer runs
+#define DMA_CYCLES 640
+
+typedef struct {
+    uint8_t active;           // a transfer holds the buses, checked on every bus access
+    uint8_t vram_source;      // the running transfer reads over the VRAM bus
+    uint8_t source_register;  // last value written to 0xFF46, reads back unchanged
+} dma_context;
+
+void dma_init(void);
+void dma_start(uint8_t source_page);
+uint8_t dma_read(uint16_t addr);
+void dma_write(uint16_t addr, uint8_t value);
+uint8_t dma_blocks(uint16_t addr);
+void dma_save(state_buffer *s);
+void dma_load(state_buffer *s);
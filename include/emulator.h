@@ -1,3 +1,9 @@
 #pragma once
 
-int emulator_run(int argc, char *argv[]);
\ No newline at end of file
+// Process exit status
+#define EMU_EXIT_OK      0  // ran to completion, or a pass pattern matched
+#define EMU_EXIT_ERROR   1  // bad arguments or the ROM failed to load
+#define EMU_EXIT_FAILED  2  // the test ROM reported "Failed"
+#define EMU_EXIT_TIMEOUT 3  // frame limit hit while waiting for a pattern
+
+int emulator_run(int argc, char *argv[]);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+#include "recorder.h"
+
+// Every `every`th frame saved as a palette PNG (see png.h) in `dir`, named
+// after the frame's number since the dump started: frame_000060.png for the
+// 60th. Encoding and file writes happen on the recorder's writer thread,
+// which always waits rather than drop frames, since each file stands alone.
+// Per process.
+uint8_t frame_dump_open(const char *dir, uint32_t every);
+uint8_t frame_dump_recording(void);
+
+// Emulation thread, after each completed frame
+void frame_dump_push(const uint8_t *framebuffer);
+
+// Returns 0 if a write failed
+uint8_t frame_dump_close(void);
+
+// Forget the dump without stopping it, for a forked child: the writer thread
+// and its ring belong to the parent.
+void frame_dump_detach(void);
+
+typedef struct {
+    recorder_stats frames;   // only frames picked by `every` are pushed
+    uint64_t       bytes;
+} frame_dump_stats;
+
+frame_dump_stats frame_dump_get_stats(void);
+
+// Encode one frame and write it to `path` on the calling thread
+uint8_t frame_dump_save(const char *path, const uint8_t *framebuffer);
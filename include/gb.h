@@ -0,0 +1,386 @@
+#pragma once
+
+// libgb - embeddable emulator core.
+//
+// Each instance owns its machine state. Serial capture settings, movies,
+// checkpoint logs, rewind history and audio output are per process and
+// follow whichever instance is being run. None of these functions are thread
+// safe except where noted.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define GB_API __attribute__((visibility("default")))
+
+#define GB_FRAMEBUFFER_WIDTH  160
+#define GB_FRAMEBUFFER_HEIGHT 144
+
+// Master clock and frame length, a frame every 70224 / 4194304 s (59.73 Hz)
+#define GB_CLOCK_HZ         4194304
+#define GB_CYCLES_PER_FRAME 70224
+
+// Button bits for gb_set_buttons(), set while held
+#define GB_BUTTON_RIGHT  0x01
+#define GB_BUTTON_LEFT   0x02
+#define GB_BUTTON_UP     0x04
+#define GB_BUTTON_DOWN   0x08
+#define GB_BUTTON_A      0x10
+#define GB_BUTTON_B      0x20
+#define GB_BUTTON_SELECT 0x40
+#define GB_BUTTON_START  0x80
+
+typedef struct gb_instance gb_instance;
+
+// Conditions for gb_run_until(), combined as a bit mask
+#define GB_UNTIL_CYCLES    0x01  // `cycles` T-cycles have run
+#define GB_UNTIL_FRAME     0x02  // the PPU completed a frame
+#define GB_UNTIL_PC        0x04  // PC became `pc`, before that instruction runs
+#define GB_UNTIL_WRITE     0x08  // the CPU or DMA wrote to `write_addr`
+#define GB_UNTIL_INTERRUPT 0x10  // an interrupt in `interrupts` was taken
+#define GB_UNTIL_STEP      0x20  // an instruction or interrupt dispatch ran
+
+typedef struct {
+    uint32_t conditions;  // GB_UNTIL_* bits
+    uint64_t cycles;
+    uint16_t pc;
+    uint16_t write_addr;
+    uint8_t  interrupts;  // GB_INT_* bits
+} gb_until;
+
+// Interrupt bits for gb_until.interrupts
+#define GB_INT_VBLANK 0x01
+#define GB_INT_STAT   0x02
+#define GB_INT_TIMER  0x04
+#define GB_INT_SERIAL 0x08
+#define GB_INT_JOYPAD 0x10
+
+typedef enum {
+    GB_STOP_NONE,       // nothing stopped the run, e.g. no ROM is loaded
+    GB_STOP_CYCLES,
+    GB_STOP_FRAME,
+    GB_STOP_PC,
+    GB_STOP_WRITE,
+    GB_STOP_INTERRUPT,
+    GB_STOP_SERIAL,     // a serial stop pattern matched
+    GB_STOP_STEP,
+} gb_stop_reason;
+
+// Each instance is one allocation holding all of its machine state. Any
+// number can exist, run one at a time from a single thread. Returns NULL if
+// out of memory.
+GB_API gb_instance *gb_create(void);
+GB_API void gb_destroy(gb_instance *gb);
+
+// Copy of `gb` in its current state, sharing its ROM. Clones must be
+// destroyed before the instance they came from, unless they loaded their
+// own ROM.
+GB_API gb_instance *gb_clone(gb_instance *gb);
+
+// Bytes allocated per instance
+GB_API size_t gb_instance_size(void);
+
+// Both loaders reset the machine. Return 1 on success, 0 on failure. The
+// memory variant copies `rom`, so the caller keeps ownership of its buffer.
+GB_API uint8_t gb_load_rom(gb_instance *gb, const char *path);
+GB_API uint8_t gb_load_rom_from_memory(gb_instance *gb, const uint8_t *rom, uint32_t size);
+GB_API void gb_reset(gb_instance *gb);
+
+// Run until any of the conditions in `until` is met. Conditions are checked
+// where they can occur (scheduler deadlines, instruction boundaries, bus
+// writes) rather than every cycle, so stepping a frame at a time costs the
+// same as running freely.
+GB_API gb_stop_reason gb_run_until(gb_instance *gb, const gb_until *until);
+
+// Run until the PPU completes a frame. Returns 0 if emulation was stopped
+// first, for example by a serial stop pattern, or a playing movie has ended.
+GB_API uint8_t gb_run_frame(gb_instance *gb);
+
+// Run `cycles` T-cycles, returning the number actually run.
+GB_API uint64_t gb_run_cycles(gb_instance *gb, uint64_t cycles);
+
+// T-cycles since the last reset
+GB_API uint64_t gb_cycles(gb_instance *gb);
+
+// Applied immediately, so inputs set between gb_run_frame() calls land on an
+// exact frame. Uses the GB_BUTTON_* bits.
+GB_API void gb_set_buttons(gb_instance *gb, uint8_t buttons);
+
+// Last completed frame, GB_FRAMEBUFFER_WIDTH * GB_FRAMEBUFFER_HEIGHT colour
+// indices (0-3), row major. Not a copy: the PPU draws into a second buffer
+// and swaps the two at VBlank, so the frame stays intact while the next one
+// is drawn and is overwritten once the frame after that starts. Fetch the
+// pointer again after each frame. Safe to call from another thread.
+GB_API const uint8_t *gb_framebuffer(gb_instance *gb);
+
+// hash_bytes() of the colour indices of gb_framebuffer(), the same on every
+// host, for checking output against golden values
+GB_API uint64_t gb_framebuffer_hash(gb_instance *gb);
+
+// Software upscalers from the colour indices of gb_framebuffer() to ARGB8888,
+// vectorised where the CPU allows (see scale.h)
+typedef enum {
+    GB_SCALE_NEAREST,  // integer factor 1-4, 1 is a plain palette lookup
+    GB_SCALE_EPX,      // Scale2x / EPX, 2x
+    GB_SCALE_3X,       // Scale3x, 3x
+    GB_SCALE_HQ2X,     // EPX with its edge pixels blended into the source, 2x
+    GB_SCALE_FILTER_COUNT
+} gb_scale_filter;
+
+// Output pixels per source pixel, `factor` only matters for GB_SCALE_NEAREST.
+// Returns 0 for a bad filter or factor.
+GB_API uint32_t gb_scale_factor(gb_scale_filter filter, uint32_t factor);
+
+// Write the scaled frame as rows of ARGB8888 `pitch` bytes apart, using
+// `palette` for colour indices 0-3 (NULL for greyscale). Thread safe.
+GB_API void gb_scale(const uint8_t *framebuffer, gb_scale_filter filter, uint32_t factor,
+    const uint32_t *palette, uint32_t *dst, uint32_t pitch);
+
+// Memory access through the CPU's view of the bus, including IO registers.
+GB_API uint8_t gb_peek(gb_instance *gb, uint16_t addr);
+GB_API void gb_poke(gb_instance *gb, uint16_t addr, uint8_t value);
+
+// Save states capture the whole machine in a fixed, versioned little-endian
+// layout (see state.h). gb_state_size() depends only on the loaded cartridge.
+// Saving returns the bytes written, or 0 if `size` is too small. Loading
+// returns 0 and leaves the machine untouched if the state is for another ROM
+// or version. The completed frame and the one being drawn are both saved, so
+// a state taken mid-frame finishes that frame intact.
+GB_API uint32_t gb_state_size(gb_instance *gb);
+GB_API uint32_t gb_state_save(gb_instance *gb, uint8_t *buf, uint32_t size);
+GB_API uint8_t gb_state_load(gb_instance *gb, const uint8_t *buf, uint32_t size);
+
+// Dirty page tracking, for snapshots proportional to what changed. While on,
+// writes to VRAM, WRAM and cartridge RAM mark their 256-byte page. Each full
+// save or load through these functions becomes the base the marks are
+// relative to. Rewind and movies never move it; stepping back or seeking
+// marks every page, as the machine may then differ anywhere. The PPU's output
+// buffers are redrawn every frame and not tracked, so restores and deltas
+// leave the framebuffer as it is until the next frame is drawn.
+GB_API void gb_dirty_tracking(gb_instance *gb, uint8_t enable);
+
+// Return to `base`, the state last saved or loaded, copying only the pages
+// written since. Falls back to a full load while tracking is off.
+GB_API uint8_t gb_state_restore(gb_instance *gb, const uint8_t *base, uint32_t size);
+
+// Incremental snapshot of the pages written since the base, plus the small
+// per-subsystem state. Returns bytes written, 0 if tracking is off or `size`
+// is below gb_state_delta_size(). Loading requires the same base.
+GB_API uint32_t gb_state_delta_size(gb_instance *gb);
+GB_API uint32_t gb_state_save_delta(gb_instance *gb, uint8_t *buf, uint32_t size);
+GB_API uint8_t gb_state_load_delta(gb_instance *gb, const uint8_t *base, uint32_t base_size,
+    const uint8_t *delta, uint32_t delta_size);
+
+// Fast hash of everything the game can observe, for telling whether two runs
+// are in the same state without comparing full save states.
+GB_API uint64_t gb_state_hash(gb_instance *gb);
+
+// Log the state hash every `interval` frames completed by gb_run_frame(),
+// and after every instruction of frame `step_frame` (counted from when the
+// log was opened, GB_CHECKPOINT_NO_STEPS for none). See checkpoint.h for
+// the format and `--compare` for finding the first difference of two logs.
+#define GB_CHECKPOINT_NO_STEPS 0xFFFFFFFF
+GB_API uint8_t gb_checkpoint_log(gb_instance *gb, const char *path, uint32_t interval,
+    uint32_t step_frame);
+GB_API uint8_t gb_checkpoint_close(gb_instance *gb);
+
+// Real-time pacing for front ends. Call gb_pace() after each gb_run_frame():
+// it waits until that frame is due at `speed` times real time and returns 1
+// if the frame was drawn and should be presented. Above 1x about one frame
+// per refresh of a `refresh_hz` display (0 for 60) is drawn, the rest run
+// with the PPU's pixel output skipped and leave gb_framebuffer() as it was,
+// unless a video recording, frame dump or GIF history is attached to `gb`.
+// Frames run without gb_pace() are never throttled and always drawn.
+#define GB_SPEED_UNLIMITED 0
+GB_API void gb_set_speed(gb_instance *gb, uint32_t speed, uint32_t refresh_hz);
+GB_API uint32_t gb_speed(gb_instance *gb);
+GB_API uint8_t gb_pace(gb_instance *gb);
+
+typedef struct {
+    uint32_t speed;         // as set, GB_SPEED_UNLIMITED for no limit
+    double   achieved;      // multiple of real time over the last half second
+    uint64_t late;          // frames that finished after they were due
+    uint64_t skipped;       // frames run without pixel output
+} gb_pace_info;
+
+GB_API gb_pace_info gb_pace_get_info(gb_instance *gb);
+
+// Sound from `gb`, synthesised only while enabled and running at 1x
+// (gb_set_speed() mutes anything else). One instance at a time produces
+// audio, enabling another moves the output to it. Samples are 16-bit
+// interleaved stereo, queued by gb_run_frame() and drained by
+// gb_audio_read(), which is safe to call from one other thread such as an
+// audio callback. The output rate follows the reader's pace by up to 0.5% to
+// keep about 40 ms queued. `sample_rate` 0 disables playback, and once
+// nothing is recording either the APU costs nothing beyond its register
+// accesses. Enabling is not safe while another thread is reading. Returns 0
+// if a recording of another instance or rate is running.
+GB_API uint8_t gb_audio_enable(gb_instance *gb, uint32_t sample_rate);
+
+// Fills `count` frames, padding with silence if too few are queued. Returns
+// the frames that were queued samples.
+GB_API uint32_t gb_audio_read(int16_t *frames, uint32_t count);
+
+// Record the sound of `gb` to `fd` as 16-bit stereo, without a device or
+// real-time pacing: every frame run is captured, at any speed. Writes are
+// batched and done on a writer thread. WAV sizes are patched on stop if `fd`
+// can seek; GB_AUDIO_RAW is headerless little-endian PCM for pipes. While
+// playback is enabled the recording takes its rate and `sample_rate` is
+// ignored; without it the output is exactly `sample_rate` and the same for
+// every run. `fd` is never closed. Stopping returns 0 if a write failed.
+typedef enum {
+    GB_AUDIO_WAV,
+    GB_AUDIO_RAW,
+} gb_audio_format;
+
+GB_API uint8_t gb_audio_record(gb_instance *gb, int fd, uint32_t sample_rate,
+    gb_audio_format format);
+GB_API uint8_t gb_audio_record_stop(gb_instance *gb);
+
+typedef struct {
+    uint32_t sample_rate;   // 0 while disabled
+    uint32_t buffered;      // frames queued
+    double   rate_ratio;    // output rate over `sample_rate`, rate control
+    uint64_t produced;
+    uint64_t dropped;       // frames lost to a full queue
+    uint64_t underruns;     // frames gb_audio_read() padded with silence
+    uint64_t recorded;      // frames passed to the recording writer
+    uint64_t record_stalls; // times emulation waited for the writer
+} gb_audio_info;
+
+GB_API gb_audio_info gb_audio_get_info(void);
+
+typedef struct {
+    uint32_t frames;        // frames gb_rewind_step_back() can go back
+    uint32_t keyframes;
+    uint64_t bytes_used;
+    uint32_t arena_bytes;
+    uint32_t state_bytes;
+} gb_rewind_info;
+
+// Rewind history of up to `frames` frames, stored as compressed XOR deltas
+// between consecutive save states in a fixed ring of `arena_bytes`. 0 picks
+// 4 KiB per frame plus room for a few full states, about 15 MB for 60
+// seconds. Oldest frames are dropped first. `frames` 0 disables rewind.
+// History is cleared by loading a ROM or resetting.
+GB_API uint8_t gb_rewind_enable(gb_instance *gb, uint32_t frames, uint32_t arena_bytes);
+
+// Record the current state, normally once after each gb_run_frame().
+// Does nothing while rewind is disabled.
+GB_API void gb_rewind_push(gb_instance *gb);
+
+// Return to the previously recorded frame. Returns 0 at the oldest frame.
+GB_API uint8_t gb_rewind_step_back(gb_instance *gb);
+GB_API gb_rewind_info gb_rewind_get_info(gb_instance *gb);
+
+// Input movies (see movie.h) record or replay the buttons of each frame run
+// with gb_run_frame(), from a save state of the first frame. Replay is bit
+// exact. Recording starts from the current state and is written out by
+// gb_movie_close(); keyframes are stored every `keyframe_interval` frames (0
+// for one a minute). Playing puts the machine in the movie's first frame and
+// ignores host input. Resetting or loading a ROM closes the movie.
+GB_API uint8_t gb_movie_record(gb_instance *gb, const char *path, uint32_t keyframe_interval);
+GB_API uint8_t gb_movie_play(gb_instance *gb, const char *path);
+
+// Jump to `frame` of the playing movie by restoring the nearest keyframe
+// before it and replaying the rest. Returns 0 if `frame` is out of range.
+GB_API uint8_t gb_movie_seek(gb_instance *gb, uint32_t frame);
+
+// Frames recorded or played so far, and the length of the playing movie
+GB_API uint32_t gb_movie_frame(gb_instance *gb);
+GB_API uint32_t gb_movie_length(gb_instance *gb);
+GB_API uint8_t gb_movie_close(gb_instance *gb);
+
+// Frame capture runs on a writer thread fed by a ring of preallocated frames.
+// When the writer falls behind, GB_RECORD_BLOCK waits for it and
+// GB_RECORD_DROP repeats the previous frame in place of the new one, keeping
+// the stream's timing. Identical consecutive frames are only queued once.
+typedef enum {
+    GB_RECORD_BLOCK,
+    GB_RECORD_DROP,
+} gb_record_policy;
+
+// Record every frame completed by gb_run_frame() to `fd`, as Y4M or as
+// headerless 160x144 RGB24 frames at 4194304/70224 fps. gb_pace() draws
+// every frame while recording, whatever the speed. `fd` is never closed.
+// Stopping writes out everything queued and returns 0 if a write failed.
+typedef enum {
+    GB_VIDEO_Y4M,
+    GB_VIDEO_RGB24,
+} gb_video_format;
+
+GB_API uint8_t gb_video_record(gb_instance *gb, int fd, gb_video_format format,
+    gb_record_policy policy);
+GB_API uint8_t gb_video_record_stop(gb_instance *gb);
+
+typedef struct {
+    uint64_t frames;        // completed while recording
+    uint64_t unique;        // queued for the writer, the rest were repeats
+    uint64_t dropped;       // repeated because the writer was behind
+    uint64_t stalls;        // times emulation waited for the writer
+    uint64_t bytes;         // written so far
+} gb_video_info;
+
+// The current or last recording
+GB_API gb_video_info gb_video_get_info(void);
+
+// Save the current frame as a 4-colour, 2 bits per pixel palette PNG
+GB_API uint8_t gb_png_save(gb_instance *gb, const char *path);
+
+// Save every `every`th frame completed by gb_run_frame() to `dir` as PNGs
+// named after the frame number since the dump started (frame_000060.png),
+// encoded and written on a writer thread. Identical frames are encoded once.
+// Emulation waits for the writer rather than skip a frame, and gb_pace()
+// draws every frame while dumping. Stopping writes out everything queued and
+// returns 0 if a write failed.
+GB_API uint8_t gb_frame_dump(gb_instance *gb, const char *dir, uint32_t every);
+GB_API uint8_t gb_frame_dump_stop(gb_instance *gb);
+
+typedef struct {
+    uint64_t frames;        // saved, or queued to be
+    uint64_t unique;        // encoded, the rest were copies of the one before
+    uint64_t stalls;        // times emulation waited for the writer
+    uint64_t bytes;         // written so far
+} gb_frame_dump_info;
+
+// The current or last dump
+GB_API gb_frame_dump_info gb_frame_dump_get_info(void);
+
+// Keep the last `frames` frames completed by gb_run_frame() for
+// gb_gif_save(), 0 to stop. Costs 23 KiB a frame. gb_pace() draws every
+// frame while the history is kept.
+GB_API uint8_t gb_gif_history(gb_instance *gb, uint32_t frames);
+
+// Save the kept frames to `path` as a looping animated GIF, encoded and
+// written on a thread of its own; the history starts over. Returns 0 if the
+// previous save hasn't finished. gb_gif_history(gb, 0) waits for it.
+GB_API uint8_t gb_gif_save(gb_instance *gb, const char *path);
+
+typedef struct {
+    uint32_t frames;        // in the history
+    uint8_t  saving;
+    uint32_t saves;         // finished
+    // Last finished save
+    uint8_t  ok;
+    uint64_t saved_frames;
+    uint32_t images;        // after dropping repeats, cropped to what changed
+    uint64_t bytes;
+    uint64_t encode_ns;
+} gb_gif_info;
+
+GB_API gb_gif_info gb_gif_get_info(void);
+
+// Explore `count` continuations of the current state in parallel, each in a
+// forked copy-on-write child process that runs `fn` with its branch index and
+// `result_size` bytes to fill. Results are copied to `results`, which holds
+// count * result_size bytes, in branch order. The parent machine is
+// untouched. POSIX only. Returns 0 if any branch failed.
+typedef void (*gb_branch_fn)(gb_instance *gb, uint32_t branch, void *result, void *user);
+GB_API uint8_t gb_branch(gb_instance *gb, uint32_t count, uint32_t result_size,
+    gb_branch_fn fn, void *user, void *results);
+
+// Serial output capture, see serial.h
+GB_API void gb_serial_capture(gb_instance *gb, FILE *stream);
+GB_API int gb_serial_stop_on(gb_instance *gb, const char *pattern);
+GB_API int gb_serial_matched(gb_instance *gb);
+GB_API const uint8_t *gb_serial_output(gb_instance *gb, uint32_t *len);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+
+// Animated GIF encoder for 160x144 frames of colour indices 0-3, built up in
+// memory one emulated frame at a time.
+//
+// Pixels stay in the 2-bit palette domain: the colour table has four entries
+// and LZW starts from 2-bit codes. Each image only covers the bounding box
+// of what changed since the last one and leaves the rest in place, and a
+// frame identical to the last only lengthens its delay. Delays are in whole
+// centiseconds, kept in step with the 59.73 Hz clock; viewers slow delays
+// under 2 cs down to 10, so a change less than 2 cs after the last one
+// replaces it rather than get its own image.
+typedef struct gif gif;
+
+typedef struct {
+    uint64_t frames;   // emulated frames added
+    uint32_t images;   // images written, after dropping repeats and merging
+    size_t   size;     // file bytes
+} gif_stats;
+
+// NULL if out of memory
+gif *gif_begin(const uint32_t palette[4]);
+void gif_add(gif *g, const uint8_t *indices);
+
+// Finish the file and free `g`. Returns the file's bytes, for free(), or
+// NULL if growing the buffer failed.
+uint8_t *gif_end(gif *g, gif_stats *stats);
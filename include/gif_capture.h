@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+
+// History of the last frames for saving as an animated GIF (see gif.h). The
+// emulation thread copies each completed frame into a ring; saving hands the
+// whole ring to a thread that encodes and writes the file, and starts a new
+// ring, so a save costs the emulation thread no encoding. Per process.
+//
+// `frames` 0 frees the history, waiting for a save in progress.
+uint8_t gif_capture_init(uint32_t frames);
+uint8_t gif_capture_enabled(void);
+
+// Emulation thread, after each completed frame
+void gif_capture_push(const uint8_t *framebuffer);
+
+// Drop the history without waiting for a save, for a forked child: the
+// saver thread belongs to the parent.
+void gif_capture_detach(void);
+
+// Start saving the history to `path`. Returns 0 if a save is still running
+// or the thread can't start.
+uint8_t gif_capture_save(const char *path);
+
+typedef struct {
+    uint32_t frames;       // held in the history
+    uint8_t  saving;
+    uint32_t saves;        // finished, successful or not
+    // Last finished save
+    uint8_t  ok;
+    uint64_t saved_frames;
+    uint32_t images;
+    uint64_t bytes;
+    uint64_t encode_ns;
+} gif_capture_stats;
+
+gif_capture_stats gif_capture_get_stats(void);
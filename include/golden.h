@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+
+// Golden-image regression runs. A manifest holds one check per line, fields
+// separated by spaces, '#' starting a comment:
+//
+//   name rom frames movie hash [reference]
+//
+// Each check loads `rom` into a fresh machine, plays `movie` (- for none),
+// runs `frames` frames and compares gb_framebuffer_hash() with `hash`, 16
+// hex digits (- for none yet). Paths are relative to the manifest. Checks run
+// in forked children, `jobs` at a time (0 for one per online CPU).
+//
+// A failing check writes its last frame to `out_dir`/name.png, and with a
+// `reference` PNG from an earlier run also name.diff.png: matching pixels in
+// grey, differing ones in red. Blessing writes every frame and prints the
+// manifest back with the hashes found, instead of the report. A blessed
+// check passes once it runs all its frames, whatever its hash.
+typedef struct {
+    uint32_t checks;
+    uint32_t passed;
+    uint32_t failed;     // wrong hash or stopped early
+    uint32_t errors;     // couldn't run
+    uint32_t jobs;
+    uint64_t frames;
+    uint64_t ns;         // wall clock for the whole run
+} golden_summary;
+
+// Returns 0 if the manifest or `out_dir` can't be used
+uint8_t golden_run(const char *manifest, const char *out_dir, uint32_t jobs, uint8_t bless,
+    golden_summary *summary);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Non-cryptographic 64-bit hash for comparing runs and images. Input is read
+// as little-endian words, so results match across hosts. Hashing several
+// buffers chains them by passing each result as the next seed.
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// Called in the child with its job index and `result_size` zeroed bytes of
+// shared memory to fill
+typedef void (*host_fork_fn)(uint32_t index, void *result, void *user);
+
+// Run `count` jobs, each in a forked child that calls `fn` and exits, at most
+// `jobs` at a time (0 for one per online CPU). Once all have exited the
+// results are copied to `results`, count * result_size bytes in job order.
+// A job whose child could not be started or did not exit cleanly leaves its
+// result zeroed. Only the children forked here are waited on.
+//
+// Returns 0 if any job failed that way.
+uint8_t host_fork_run(uint32_t count, uint32_t jobs, uint32_t result_size,
+    host_fork_fn fn, void *user, void *results);
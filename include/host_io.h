@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// write() all of `buf` to `fd`, retrying short writes and interruptions.
+// Returns 0 on error.
+uint8_t host_write(int fd, const void *buf, size_t len);
+
+// Create or replace `path` with `len` bytes. Returns 0 on error, which has
+// been printed.
+uint8_t host_write_file(const char *path, const void *buf, size_t len);
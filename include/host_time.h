@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Monotonic host clock, for measurements only. Emulated time comes from the
+// scheduler and never depends on this.
+uint64_t host_time_ns(void);
+
+// Block until host_time_ns() reaches `deadline_ns`. Sleeps for most of the
+// wait and spins through the last stretch, which is sized from how far
+// recent sleeps overshot, so wakeups land within microseconds.
+void host_time_sleep_until(uint64_t deadline_ns);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "common.h"
+#include "state.h"
+
+// Number of registers in 0xFF00-0xFF7F
+#define IO_REG_COUNT 0x80
+
+#define IO_INDEX(addr) ((addr) & 0x7F)
+
+typedef uint8_t (*io_read_handler)(uint16_t addr);
+typedef void (*io_write_handler)(uint16_t addr, uint8_t value);
+
+void io_init(void);
+
+// Hand a register over to a subsystem. Either handler may be NULL, in which
+// case that direction falls back to the plain backing byte.
+void io_register(uint16_t addr, io_read_handler read, io_write_handler write);
+
+uint8_t io_read(uint16_t addr);
+void io_write(uint16_t addr, uint8_t value);
+
+void io_save(state_buffer *s);
+void io_load(state_buffer *s);
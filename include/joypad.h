@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+#include "state.h"
+
+#define JOYPAD_ADDR 0xFF00
+
+// Button bits of a host input mask, set while the button is held
+#define JOYPAD_RIGHT  0x01
+#define JOYPAD_LEFT   0x02
+#define JOYPAD_UP     0x04
+#define JOYPAD_DOWN   0x08
+#define JOYPAD_A      0x10
+#define JOYPAD_B      0x20
+#define JOYPAD_SELECT 0x40
+#define JOYPAD_START  0x80
+
+// Host events queued between drains, must be a power of two
+#define JOYPAD_QUEUE_SIZE 64
+
+// T-cycles between drains of the host queue, one scanline
+#define JOYPAD_POLL_CYCLES 456
+
+typedef struct {
+    uint64_t host_ns;  // host clock when the event was pushed
+    uint8_t  buttons;  // full held mask after the event
+} joypad_event;
+
+// Time from joypad_push() to the first P1 read that could observe it
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} joypad_latency;
+
+// Single producer, single consumer ring. The producer only writes `head` and
+// the consumer only writes `tail`, so each index lives on its own cache line.
+typedef struct {
+    joypad_event events[JOYPAD_QUEUE_SIZE];
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+} joypad_queue;
+
+typedef struct {
+    uint8_t  buttons;     // held mask currently seen by the game
+    uint8_t  select;      // P1 bits 4-5 as last written
+    uint64_t unseen_ns;   // push time of an applied event not yet read, or 0
+    joypad_latency latency;
+} joypad_context;
+
+void joypad_init(void);
+
+// Producer side. May be called from one host thread other than the emulation
+// thread. Returns 0 when the queue is full and the event was dropped.
+uint8_t joypad_push(uint8_t buttons);
+
+// Emulation thread only. Applies a mask immediately, bypassing the queue, for
+// drivers that need inputs to land on an exact frame.
+void joypad_set_buttons(uint8_t buttons);
+
+// Held mask currently seen by the game
+uint8_t joypad_buttons(void);
+
+// Emulation thread only. Take everything queued so far now rather than at the
+// next poll, applying it or, with `apply` 0, discarding it.
+void joypad_drain(uint8_t apply);
+
+// Emulation thread only. Take everything queued so far without applying it
+// and return the mask it would leave held, the current one if none.
+uint8_t joypad_drain_final(void);
+
+joypad_latency joypad_latency_stats(void);
+
+// Only what the game can observe, the host queue and latency stats are not
+// machine state.
+void joypad_save(state_buffer *s);
+void joypad_load(state_buffer *s);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+#include "apu.h"
+#include "bus.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "dma.h"
+#include "io.h"
+#include "joypad.h"
+#include "ppu.h"
+#include "ppu_fetcher.h"
+#include "scheduler.h"
+#include "serial.h"
+#include "state.h"
+#include "timer.h"
+
+#define MACHINE_CACHE_LINE 64
+#define MACHINE_PAGE_SIZE  4096
+
+// Every piece of mutable state of one emulated Game Boy, in one allocation.
+// Copying the struct clones the machine; the ROM it points at is read only
+// and stays outside. Modules reach their part through `machine`, usually
+// behind a `#define ctx (machine->module)`.
+//
+// Fields used on every cycle or instruction come first so they share the
+// leading cache lines. Large memory regions are page aligned.
+typedef struct gb_machine {
+    scheduler_context scheduler;
+    cpu_context       cpu;
+    cartridge_context cartridge;   // ROM bank for banked reads
+    dma_context       dma;
+    uint8_t           interrupt_enable;
+    uint8_t           dirty_tracking;
+    timer_context     timer;
+    ppu_context       ppu;
+    ppu_fetcher       fetcher;
+    uint8_t           hram[BUS_HRAM_SIZE];
+    uint8_t           io_registers[IO_REG_COUNT];
+
+    uint8_t           oam[BUS_OAM_SIZE] __attribute__((aligned(MACHINE_CACHE_LINE)));
+    joypad_context    joypad;
+    uint64_t          dirty[STATE_DIRTY_WORDS];
+    joypad_queue      joypad_queue;
+    serial_context    serial;
+    apu_context       apu;
+
+    uint8_t vram[BUS_VRAM_SIZE]     __attribute__((aligned(MACHINE_PAGE_SIZE)));
+    uint8_t wram[BUS_WRAM_SIZE]     __attribute__((aligned(MACHINE_PAGE_SIZE)));
+    uint8_t cart_ram[CARTRIDGE_RAM_MAX] __attribute__((aligned(MACHINE_PAGE_SIZE)));
+    uint8_t framebuffer[2][GB_SCREEN_RES_X * GB_SCREEN_RES_Y]  // front and back
+        __attribute__((aligned(MACHINE_PAGE_SIZE)));
+} gb_machine;
+
+// The machine being run, switched by each gb_* entry point
+extern gb_machine *machine;
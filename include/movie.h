@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.h"
+
+// Movie file: a fixed header, keyframe save states as they were recorded,
+// then one input byte per frame and the keyframe index. Multi-byte values
+// are little-endian, as in save states.
+//
+//   0  u32 magic           16 u64 hash_bytes() of the frame 0 state
+//   4  u16 version         24 u32 offset of the inputs
+//   6  u16 cart checksum   28 u32 offset of the index
+//   8  u32 frame count     32 u32 keyframe count
+//   12 u32 keyframe interval  36 u32 save state size
+//
+// Index entries are a u32 frame and a u32 file offset. A keyframe holds the
+// state before its frame's input is applied. Frame 0 always has one, so a
+// movie can start from any state.
+#define MOVIE_MAGIC   0x564D4247  // "GBMV"
+#define MOVIE_VERSION 2
+#define MOVIE_HEADER_SIZE 40
+#define MOVIE_INDEX_ENTRY_SIZE 8
+
+// One minute of frames
+#define MOVIE_DEFAULT_KEYFRAME_INTERVAL 3600
+
+typedef enum {
+    MOVIE_OFF,
+    MOVIE_RECORDING,
+    MOVIE_PLAYING,
+} movie_mode;
+
+// Start recording from the current state, replacing any movie in progress.
+// Returns 0 on failure.
+uint8_t movie_record(const char *path, uint32_t keyframe_interval);
+
+// Load a movie and put the machine in its frame 0 state. Fails if the movie
+// is for another ROM or its first keyframe does not match the stored hash.
+uint8_t movie_play(const char *path);
+
+// Called before each frame is run. Records or applies that frame's input.
+// Returns 0 when playback has no more frames.
+uint8_t movie_frame(void);
+
+// Restore the last keyframe at or before `frame`, returning the frame it
+// holds. The caller runs the remaining frames. Returns 0 with no effect if
+// no movie is playing or `frame` is past its end.
+uint8_t movie_seek_keyframe(uint32_t frame, uint32_t *keyframe);
+
+// Forget the movie without finishing it, for a forked child whose file
+// offset is shared with the parent's recording or playback.
+void movie_detach(void);
+
+movie_mode movie_get_mode(void);
+uint32_t movie_current_frame(void);
+uint32_t movie_length(void);
+
+// Finish the movie. A recording is written out here, returns 0 if that fails.
+uint8_t movie_close(void);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+#define PACER_UNLIMITED 0
+
+// Frames the host may fall behind before pacing gives up catching up
+#define PACER_MAX_FRAMES_BEHIND 4
+
+// Host time the achieved speed is averaged over
+#define PACER_MEASURE_NS 500000000
+
+// Real-time pacing of emulated frames on the host clock. Not machine state,
+// it lives beside the machine in the instance.
+typedef struct {
+    uint32_t speed;            // multiple of real time, or PACER_UNLIMITED
+    uint64_t frame_ns;         // host time per emulated frame at `speed`
+    uint64_t present_ns;       // display refresh period
+    uint64_t deadline_ns;      // when the last frame was due, 0 before the first
+    uint64_t next_present_ns;  // earliest host time worth drawing another frame for
+    uint64_t last_ns;          // when the previous pacer_frame() returned
+    uint8_t  drawing;          // the frame being run has pixel output
+
+    uint64_t measure_start_ns;
+    uint32_t measure_frames;
+    uint8_t  measured;         // a full PACER_MEASURE_NS has passed
+    double   achieved;         // speed over the last PACER_MEASURE_NS
+    uint64_t late;             // frames that finished after their deadline
+    uint64_t skipped;          // frames run without pixel output, counted by the caller
+} pacer;
+
+// Start pacing at `speed` times real time, drawing at most one frame per
+// refresh of a `refresh_hz` display when above 1x. Resets the statistics.
+void pacer_init(pacer *p, uint32_t speed, uint32_t refresh_hz);
+
+// Call after each emulated frame. Waits until the frame is due, then decides
+// whether the next one is worth drawing, returned in `p->drawing`. Returns
+// whether the frame just run was.
+uint8_t pacer_frame(pacer *p);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.h"
+
+// Filter byte plus 2-bit pixels, four to a byte
+#define PNG_ROW_SIZE(width) (1 + ((width) * 2 + 7) / 8)
+
+// Stored deflate blocks hold at most this many bytes each
+#define PNG_STORED_BLOCK 65535
+
+// Largest file png_encode() writes: signature, IHDR, PLTE, IEND, then IDAT
+// with its zlib header, block headers and Adler-32
+#define PNG_MAX_SIZE(width, height) \
+    (8 + 25 + 24 + 12 + 12 + 2 + 4 + PNG_ROW_SIZE(width) * (height) \
+        + 5 * (PNG_ROW_SIZE(width) * (height) / PNG_STORED_BLOCK + 1))
+
+// Encode colour indices 0-3, one byte per pixel, as a 4-colour palette PNG
+// at 2 bits per pixel. `palette` holds the ARGB colour of each index. The
+// image data goes in stored (uncompressed) deflate blocks: a 160x144 frame is
+// about 6 KB and encodes at memcpy speed, with no compressor state.
+// Returns the file size, or 0 if it doesn't fit in `capacity` bytes.
+uint32_t png_encode(const uint8_t *indices, uint32_t width, uint32_t height,
+    const uint32_t palette[4], uint8_t *out, uint32_t capacity);
+
+// Read back a file written by png_encode() into `indices`, width * height
+// bytes. Only its own layout is understood: 2-bit palette, stored blocks,
+// no row filters. Returns 0 for anything else.
+uint8_t png_decode(const uint8_t *data, uint32_t size, uint32_t width, uint32_t height,
+    uint8_t *indices);
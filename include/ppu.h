@@ -1,8 +1,7 @@
 #pragma once
 
 #include "common.h"
-
-#define PPU_BG_SIZE 256
+#include "state.h"
 
 typedef enum {
     OAM_SCAN,
@@ -30,18 +29,25 @@ typedef struct {
     uint8_t WY;
 
     // internal state
-    uint8_t   bg[PPU_BG_SIZE * PPU_BG_SIZE][3];  // [r, g, b]
-    uint32_t  bg_idx;
     ppu_state state;
     uint16_t  cycles;
     uint8_t   n_line_pixels_drawn;
-} ppu_context;
+    uint8_t   front;      // framebuffer[front] is the last completed frame
 
-extern uint8_t ppu_view[GB_SCREEN_RES_X * GB_SCREEN_RES_Y * 3];
+    // Host setting, not saved. Frames keep their timing and interrupts but
+    // write no pixels, leaving the last drawn frame in the view.
+    uint8_t   skip_pixels;
+} ppu_context;
 
-// Indicate that SDL should draw the current PPU view
-extern uint8_t ppu_view_updated;
+// Completed frame, one colour index (0-3) per pixel, held in the machine arena.
+// Lines are drawn straight into the other buffer, and the two swap at VBlank.
+#define ppu_view (machine->framebuffer[machine->ppu.front])
+#define ppu_back (machine->framebuffer[machine->ppu.front ^ 1])
 
 void ppu_init(void);
 void ppu_step(void);
+// Swap the finished back buffer to the front
 void ppu_update_view(void);
+void ppu_skip_pixels(uint8_t skip);
+void ppu_save(state_buffer *s);
+void ppu_load(state_buffer *s);
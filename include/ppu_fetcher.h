@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "state.h"
 
 #define FETCHER_QUEUE_SIZE 16
 
@@ -40,3 +41,5 @@ typedef struct {
 void ppu_feetcher_init(ppu_fetcher *f);
 void ppu_fetcher_set(ppu_fetcher *f, uint16_t map_base_addr, uint8_t scx, uint8_t scy, uint8_t ly);
 void ppu_fetcher_step(ppu_fetcher *f, uint8_t signed_addr_mode);
+void ppu_fetcher_save(ppu_fetcher *f, state_buffer *s);
+void ppu_fetcher_load(ppu_fetcher *f, state_buffer *s);
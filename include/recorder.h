@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+
+// Frames of colour indices queued for the writer thread, must be a power of
+// two. 32 frames, about half a second, in 720 KiB.
+#define RECORDER_SLOTS 32
+
+#define RECORDER_FRAME_SIZE (GB_SCREEN_RES_X * GB_SCREEN_RES_Y)
+
+// Frame pipeline from the emulation thread to a writer thread. Completed
+// frames are copied into a ring of preallocated slots, one memcpy per frame;
+// everything else (conversion, encoding, I/O) is the sink's job on the
+// writer thread. A frame identical to the one before takes no slot and
+// reaches the sink as a repeat. With GB_RECORD_DROP a frame arriving to a
+// full ring is also turned into a repeat, so streams keep their timing.
+typedef struct {
+    // Called on the writer thread with each frame in order. `indices` is NULL
+    // for a repeat of the previous frame. `index` counts frames from 0.
+    // Returning 0 reports a write error and stops further calls.
+    uint8_t (*frame)(void *user, const uint8_t *indices, uint64_t index);
+    void *user;
+} recorder_sink;
+
+typedef struct {
+    uint64_t frames;    // pushed
+    uint64_t unique;    // copied to the writer
+    uint64_t dropped;   // turned into repeats because the ring was full
+    uint64_t stalls;    // times GB_RECORD_BLOCK waited for the writer
+} recorder_stats;
+
+typedef struct recorder recorder;
+
+// NULL if the ring or thread can't be set up
+recorder *recorder_start(recorder_sink sink, gb_record_policy policy);
+
+// Emulation thread only
+void recorder_push(recorder *r, const uint8_t *frame);
+
+// Hand the sink every queued frame, then stop the thread and free `r`.
+// Returns 0 if the sink failed.
+uint8_t recorder_stop(recorder *r);
+
+recorder_stats recorder_get_stats(const recorder *r);
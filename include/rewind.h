@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+
+// Frames between full keyframes kept alongside the per-frame deltas
+#define REWIND_KEYFRAME_INTERVAL 60
+
+typedef struct {
+    uint32_t frames;        // frames that can currently be stepped back
+    uint32_t keyframes;
+    uint64_t bytes_used;    // compressed entries currently stored
+    uint32_t arena_bytes;   // fixed ring size
+    uint32_t state_bytes;   // one uncompressed save state
+} rewind_stats;
+
+// Arena bytes per frame when no size is given, deltas are mostly far smaller
+#define REWIND_DEFAULT_FRAME_BYTES 4096
+
+// Keep up to `max_frames` frames of history in a ring of `arena_bytes`, or a
+// default size for 0. Oldest frames are dropped when either runs out.
+// Returns 0 on failure.
+uint8_t rewind_init(uint32_t max_frames, uint32_t arena_bytes);
+void rewind_free(void);
+// Drop all history, e.g. after the machine was reset
+void rewind_reset(void);
+uint8_t rewind_enabled(void);
+
+// Record the current machine state as the newest frame.
+void rewind_push(void);
+
+// Put the machine back to the frame before the newest, dropping the newest.
+// Returns 0 when there is no older frame.
+uint8_t rewind_step_back(void);
+
+rewind_stats rewind_get_stats(void);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+
+// Largest factor a filter can produce, for sizing output buffers
+#define SCALE_MAX_FACTOR 4
+
+// Kernel sets, each level needs the ones below it
+typedef enum {
+    SCALE_ISA_SCALAR,
+    SCALE_ISA_SSE2,
+    SCALE_ISA_AVX2,
+    SCALE_ISA_COUNT
+} scale_isa;
+
+// ARGB8888 greyscale for each colour index, 85 = 255/3
+extern const uint32_t scale_grey_palette[4];
+
+// Output pixels per source pixel along each axis. `factor` is only used by
+// GB_SCALE_NEAREST (1 to SCALE_MAX_FACTOR). Returns 0 for bad arguments.
+uint32_t scale_factor(gb_scale_filter filter, uint32_t factor);
+
+// Upscale a frame of GB_SCREEN_RES_X * GB_SCREEN_RES_Y colour indices into
+// ARGB8888 rows `pitch` bytes apart, such as a locked streaming texture.
+// All filters work on the indices and look colours up last, so the output
+// only contains palette colours except where GB_SCALE_HQ2X blends edges.
+void scale_frame(gb_scale_filter filter, uint32_t factor, const uint8_t *src,
+    const uint32_t palette[4], uint32_t *dst, uint32_t pitch);
+
+// Kernels are picked from the host CPU on first use. Selecting a level the
+// CPU lacks returns 0 and changes nothing; benchmarks use this to time each.
+uint8_t scale_use_isa(scale_isa isa);
+scale_isa scale_best_isa(void);
+const char *scale_isa_name(scale_isa isa);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common.h"
+#include "state.h"
+
+// Deadline value of an event that is not pending
+#define SCHED_NEVER UINT64_MAX
+
+typedef enum {
+    SCHED_TIMER_OVERFLOW,
+    SCHED_TIMER_RELOAD,
+    SCHED_DMA_END,
+    SCHED_JOYPAD_POLL,
+    SCHED_SERIAL,
+    SCHED_RUN_LIMIT,
+    SCHED_EVENT_COUNT
+} sched_event;
+
+typedef void (*sched_handler)(void);
+
+typedef struct {
+    uint64_t now;                          // T-cycles since power on
+    uint64_t next;                         // earliest pending deadline
+    uint64_t deadline[SCHED_EVENT_COUNT];
+} scheduler_context;
+
+void scheduler_init(void);
+void scheduler_register(sched_event event, sched_handler handler);
+void scheduler_schedule(sched_event event, uint64_t at);
+void scheduler_cancel(sched_event event);
+void scheduler_step(void);
+uint64_t scheduler_now(void);
+void scheduler_save(state_buffer *s);
+void scheduler_load(state_buffer *s);
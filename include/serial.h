@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+#include "state.h"
+
+#define SERIAL_SB_ADDR 0xFF01
+#define SERIAL_SC_ADDR 0xFF02
+
+// Internal clock runs at 8192 Hz
+#define SERIAL_CYCLES_PER_BIT 512
+
+// Output kept for inspection and pattern matching, older bytes are discarded
+#define SERIAL_CAPTURE_SIZE 4096
+
+#define SERIAL_MAX_PATTERNS 4
+#define SERIAL_NO_MATCH -1
+
+typedef struct {
+    uint8_t  sb;        // 0xFF01
+    uint8_t  sc;        // 0xFF02
+    uint8_t  out[SERIAL_CAPTURE_SIZE];
+    uint32_t out_len;
+    int      matched;   // index of the pattern that stopped emulation
+} serial_context;
+
+void serial_init(void);
+
+// Echo every transferred byte to `stream` as it completes, NULL to disable.
+void serial_capture(FILE *stream);
+
+// Stop emulation once the output ends with `pattern`. The string is not
+// copied and must outlive the run. Returns the pattern's index, or
+// SERIAL_NO_MATCH when the pattern table is full.
+int serial_stop_on(const char *pattern);
+
+// Index of the pattern that stopped emulation, or SERIAL_NO_MATCH.
+int serial_matched(void);
+
+const uint8_t *serial_output(uint32_t *len);
+
+// Registers only, captured output belongs to the host
+void serial_save(state_buffer *s);
+void serial_load(state_buffer *s);
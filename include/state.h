@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common.h"
+
+// Save state layout: a fixed header, then every large memory region as a run
+// of 256-byte pages, then each subsystem's section in a fixed order.
+// Multi-byte values are little-endian regardless of host.
+#define STATE_MAGIC       0x53534247  // "GBSS"
+#define STATE_DELTA_MAGIC 0x44534247  // "GBSD"
+#define STATE_VERSION 4
+
+#define STATE_HEADER_SIZE 16
+
+// Paged memory, in state order. Page N of a full state sits at
+// STATE_HEADER_SIZE + N * STATE_PAGE_SIZE.
+#define STATE_PAGE_SIZE      256
+#define STATE_PAGE_VRAM      0    // 8 KiB addressable VRAM
+#define STATE_PAGE_WRAM      32   // 8 KiB
+#define STATE_PAGE_PPU_VIEW  64   // 160x144 framebuffer, the completed frame
+#define STATE_PAGE_PPU_BACK  154  // 160x144 framebuffer being drawn
+#define STATE_PAGE_CART_RAM  244  // 0-32 KiB, depends on the cartridge
+#define STATE_PAGE_MAX       (STATE_PAGE_CART_RAM + 128)
+#define STATE_DIRTY_WORDS    ((STATE_PAGE_MAX + 63) / 64)
+
+// One bit per page written since the last full save or load, maintained by
+// the write paths while tracking is on. Both live in the machine arena. The
+// PPU_VIEW and PPU_BACK pages are output the game can't read back, rewritten
+// every frame, so they are never marked: restores and deltas skip them.
+#define state_dirty          (machine->dirty)
+#define state_dirty_tracking (machine->dirty_tracking)
+
+#define STATE_MARK_DIRTY(page) do { \
+        if (state_dirty_tracking) { \
+            state_dirty[(page) >> 6] |= (uint64_t) 1 << ((page) & 63); \
+        } \
+    } while (0)
+
+typedef struct state_buffer {
+    uint8_t *buf;  // NULL to only count bytes
+    uint32_t pos;
+} state_buffer;
+
+void state_put_u8(state_buffer *s, uint8_t value);
+void state_put_u16(state_buffer *s, uint16_t value);
+void state_put_u32(state_buffer *s, uint32_t value);
+void state_put_u64(state_buffer *s, uint64_t value);
+void state_put_bytes(state_buffer *s, const void *src, uint32_t len);
+
+uint8_t  state_get_u8(state_buffer *s);
+uint16_t state_get_u16(state_buffer *s);
+uint32_t state_get_u32(state_buffer *s);
+uint64_t state_get_u64(state_buffer *s);
+void state_get_bytes(state_buffer *s, void *dest, uint32_t len);
+
+// Size of a full state for the loaded cartridge, header included.
+uint32_t state_size(void);
+
+// Callers guarantee `buf` holds state_size() bytes. Loading validates the
+// header and returns 0, leaving the machine untouched, if it does not match.
+// Neither moves the base dirty pages are tracked against, so rewind and movie
+// keyframes can use them under a gb_dirty_tracking() caller. Saving leaves
+// the marks alone, loading marks every tracked page.
+void state_save(uint8_t *buf);
+uint8_t state_load(const uint8_t *buf, uint32_t size);
+
+// Make the current machine the base: clear the dirty pages. Only the
+// caller that turned tracking on owns the base, through gb_state_save/load.
+void state_set_base(void);
+
+// Hash of the memory and registers a game can observe: VRAM, WRAM, cartridge
+// RAM and every subsystem section (OAM, HRAM, CPU...). Runs that hash equal
+// behave identically from here on. The framebuffer is left out, so frames
+// skipped for speed don't change it.
+uint64_t state_hash(void);
+
+void state_set_dirty_tracking(uint8_t enable);
+
+// Return to `base`, which must be the state saved or loaded when the base was
+// last set with tracking on, copying back only the pages written since.
+uint8_t state_restore(const uint8_t *base, uint32_t size);
+
+// Incremental snapshots hold the page bitmap, the subsystem sections and only
+// the pages written since the base. Saving returns 0 if `size` is too small.
+// Loading needs the same base and leaves the pages it changed marked dirty.
+uint32_t state_delta_size(void);
+uint32_t state_save_delta(uint8_t *buf, uint32_t size);
+uint8_t state_load_delta(const uint8_t *base, uint32_t base_size,
+    const uint8_t *delta, uint32_t delta_size);
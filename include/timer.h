@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.h"
+#include "state.h"
+
+#define TIMER_DIV_ADDR  0xFF04
+#define TIMER_TIMA_ADDR 0xFF05
+#define TIMER_TMA_ADDR  0xFF06
+#define TIMER_TAC_ADDR  0xFF07
+
+// DIV value left behind by the DMG boot ROM (upper byte of the counter)
+#define TIMER_POST_BOOT_COUNTER 0xABCC
+
+typedef struct {
+    uint64_t div_base;   // scheduler time at which the internal counter was 0
+    uint64_t tima_sync;  // scheduler time TIMA was last brought up to date
+    uint8_t  tima;       // 0xFF05
+    uint8_t  tma;        // 0xFF06
+    uint8_t  tac;        // 0xFF07
+    uint8_t  reloading;  // TIMA overflowed, TMA reload is pending
+} timer_context;
+
+void timer_init(void);
+// Internal 16-bit counter, DIV is its upper byte
+uint16_t timer_counter(void);
+uint8_t timer_read(uint16_t addr);
+void timer_write(uint16_t addr, uint8_t value);
+void timer_save(state_buffer *s);
+void timer_load(state_buffer *s);
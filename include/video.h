@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include "gb.h"
+#include "recorder.h"
+
+// Video capture through the recorder: Y4M (4:4:4, full frame rate of
+// 4194304/70224 fps) or headerless RGB24 frames, at 1x, for ffmpeg to
+// encode offline. Conversion and writes happen on the writer thread; a
+// repeated frame is written again from the bytes of the last one.
+// Per process, `fd` stays owned by the caller.
+uint8_t video_open(int fd, gb_video_format format, gb_record_policy policy);
+uint8_t video_recording(void);
+
+// Emulation thread, after each completed frame
+void video_push(const uint8_t *framebuffer);
+
+// Returns 0 if a write failed
+uint8_t video_close(void);
+
+// Forget the recording without stopping it, for a forked child: the writer
+// thread and its ring belong to the parent.
+void video_detach(void);
+
+typedef struct {
+    recorder_stats frames;
+    uint64_t       bytes;
+} video_stats;
+
+video_stats video_get_stats(void);
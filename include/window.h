@@ -1,8 +1,34 @@
 #pragma once
 
 #include "common.h"
+#include "gb.h"
 
-uint8_t window_init(void);
-void window_step(void);
-void window_draw(void);
+// Frames are scaled into the texture with `filter` (see gb_scale())
+uint8_t window_init(gb_scale_filter filter, uint32_t factor);
+// Open a paused stereo 16-bit output device fed by gb_audio_read(). Returns
+// the sample rate it runs at, 0 if there is no audio device.
+uint32_t window_audio_open(uint32_t sample_rate);
+void window_audio_start(void);
+// Drains all pending input, once per frame. Returns 0 once the window has
+// been closed
+uint8_t window_step(void);
+// R is held, frames should step backwards
+uint8_t window_rewinding(void);
+// Tab presses since the last call, each selects the next speed
+uint32_t window_speed_presses(void);
+// G pressed since the last call, save a GIF of the last few seconds
+uint8_t window_gif_requested(void);
+// Refresh rate of the display showing the window
+uint32_t window_refresh_hz(void);
+// Requested speed (0 for unlimited) and achieved speed, in the title bar
+void window_show_speed(uint32_t speed, double achieved);
+// Time to scale a frame into the streaming texture, not counting present
+typedef struct {
+    uint64_t frames;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} window_upload_stats;
+
+void window_draw(const uint8_t *framebuffer);
+window_upload_stats window_get_upload_stats(void);
 void window_exit(void);
\ No newline at end of file
@@ -0,0 +1,534 @@
+#include "apu.h"
+#include "audio.h"
+#include "io.h"
+#include "machine.h"
+#include "scheduler.h"
+#include "timer.h"
+
+#include <string.h>
+
+#define ctx (machine->apu)
+
+// Register offsets from 0xFF10. Channel n's NRn0-NRn4 are at n * 5.
+#define NR10 0x00
+#define NR30 0x0A
+#define NR32 0x0C
+#define NR43 0x12
+#define NR50 0x14
+#define NR51 0x15
+#define NR52 0x16
+#define WAVE 0x20
+
+#define PULSE1 0
+#define PULSE2 1
+#define WAVE_CH 2
+#define NOISE 3
+
+// Longest span voices run between audio flushes, about 8 ms
+#define FLUSH_CYCLES 32768
+
+// Registers reset by powering the APU off, NR10-NR51
+#define POWER_REGS (NR52)
+
+// High levels of each duty cycle, first step in the top bit
+static const uint8_t duty_patterns[4] = { 0x01, 0x81, 0x87, 0x7E };
+
+static const uint8_t noise_divisors[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+// DMG register values left by the boot ROM after its chime on pulse 1
+static const uint8_t post_boot_regs[POWER_REGS] = {
+    0x80, 0xBF, 0xF3, 0xFF, 0xBF,   // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,   // NR21-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,   // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,   // NR41-NR44
+    0x77, 0xF3,                     // NR50, NR51
+};
+
+static uint8_t apu_read(uint16_t addr);
+static void apu_write(uint16_t addr, uint8_t value);
+
+static uint8_t *channel_regs(int c) {
+    return &ctx.regs[c * 5];
+}
+
+static uint16_t frequency(int c) {
+    uint8_t *r = channel_regs(c);
+    return r[3] | ((r[4] & 0x07) << 8);
+}
+
+static uint16_t max_length(int c) {
+    return c == WAVE_CH ? 256 : 64;
+}
+
+// NRc1 sets the clocks left, 6 bits wide except on the wave channel
+static void load_length(int c) {
+    uint8_t nrx1 = channel_regs(c)[1];
+    ctx.ch[c].length = max_length(c) - (c == WAVE_CH ? nrx1 : nrx1 & 0x3F);
+}
+
+// T-cycles per waveform step, 0 for a channel that never steps
+static uint32_t period(int c) {
+    uint8_t shift;
+
+    switch (c) {
+        case PULSE1:
+        case PULSE2:
+            return (2048 - frequency(c)) * 4;
+        case WAVE_CH:
+            return (2048 - frequency(c)) * 2;
+        default:
+            shift = ctx.regs[NR43] >> 4;
+            return shift >= 14 ? 0 : (uint32_t) noise_divisors[ctx.regs[NR43] & 0x07] << shift;
+    }
+}
+
+// DAC input of channel `c` at its current waveform position, 0-15
+static int32_t output(int c) {
+    apu_voice *v = &ctx.voice[c];
+    uint8_t sample, code;
+
+    if (!ctx.ch[c].enabled) {
+        return 0;
+    }
+    switch (c) {
+        case PULSE1:
+        case PULSE2:
+            return (duty_patterns[channel_regs(c)[1] >> 6] >> (7 - v->pos)) & 0x01
+                ? ctx.ch[c].volume : 0;
+        case WAVE_CH:
+            code = (ctx.regs[NR32] >> 5) & 0x03;
+            sample = ctx.regs[WAVE + v->pos / 2];
+            sample = v->pos & 0x01 ? sample & 0x0F : sample >> 4;
+            return code ? sample >> (code - 1) : 0;
+        default:
+            return v->lfsr & 0x01 ? 0 : ctx.ch[c].volume;
+    }
+}
+
+// Whether stepping the waveform can change the output at all
+static uint8_t audible(int c) {
+    if (!ctx.ch[c].enabled) {
+        return 0;
+    }
+    return c == WAVE_CH ? (ctx.regs[NR32] & 0x60) != 0 : ctx.ch[c].volume != 0;
+}
+
+static void advance(int c) {
+    apu_voice *v = &ctx.voice[c];
+    uint16_t bit;
+
+    switch (c) {
+        case PULSE1:
+        case PULSE2:
+            v->pos = (v->pos + 1) & 0x07;
+            break;
+        case WAVE_CH:
+            v->pos = (v->pos + 1) & 0x1F;
+            break;
+        default:
+            bit = (v->lfsr ^ (v->lfsr >> 1)) & 0x01;
+            v->lfsr = (v->lfsr >> 1) | (bit << 14);
+            if (ctx.regs[NR43] & 0x08) {
+                v->lfsr = (v->lfsr & ~0x40) | (bit << 6);
+            }
+            break;
+    }
+}
+
+// Weight of channel `c` on each side from NR50 and NR51
+static int32_t gain_left(int c) {
+    return ((ctx.regs[NR51] >> (c + 4)) & 0x01) * (((ctx.regs[NR50] >> 4) & 0x07) + 1);
+}
+
+static int32_t gain_right(int c) {
+    return ((ctx.regs[NR51] >> c) & 0x01) * ((ctx.regs[NR50] & 0x07) + 1);
+}
+
+static void set_level(int c, uint64_t at, int32_t level) {
+    int32_t delta = level - ctx.voice[c].level;
+
+    if (delta) {
+        audio_step(at, delta * gain_left(c), delta * gain_right(c));
+        ctx.voice[c].level = level;
+    }
+}
+
+// Report every channel's output after a register or sequencer change
+static void update_levels(uint64_t at) {
+    if (ctx.voicing) {
+        for (int c = 0; c < 4; c++) {
+            set_level(c, at, output(c));
+        }
+    }
+}
+
+// Step the waveform of channel `c` through every edge before `to`. Edges are
+// the only cost, so a silent channel costs nothing.
+static void run_voice(int c, uint64_t to) {
+    apu_voice *v = &ctx.voice[c];
+    uint32_t step = period(c);
+
+    if (!audible(c) || !step) {
+        if (v->next < to) {
+            v->next = to;
+        }
+        return;
+    }
+    while (v->next < to) {
+        advance(c);
+        set_level(c, v->next, output(c));
+        v->next += step;
+    }
+}
+
+static void run_voices(uint64_t to) {
+    while (ctx.voiced < to) {
+        uint64_t until = ctx.flushed + FLUSH_CYCLES;
+        until = until < to ? until : to;
+
+        for (int c = 0; c < 4; c++) {
+            run_voice(c, until);
+        }
+        ctx.voiced = until;
+        if (until - ctx.flushed >= FLUSH_CYCLES) {
+            audio_flush(until);
+            ctx.flushed = until;
+        }
+    }
+}
+
+// Start or stop synthesis to follow the host's audio output
+static void update_voicing(uint64_t now) {
+    uint8_t active = ctx.output && audio_active();
+
+    if (active == ctx.voicing) {
+        return;
+    }
+    ctx.voicing = active;
+    if (!ctx.voicing) {
+        return;
+    }
+
+    audio_resume(now);
+    ctx.voiced = now;
+    ctx.flushed = now;
+    for (int c = 0; c < 4; c++) {
+        ctx.voice[c].next = now;
+        ctx.voice[c].level = 0;
+    }
+    update_levels(now);
+}
+
+static void clock_length(void) {
+    for (int c = 0; c < 4; c++) {
+        apu_channel *ch = &ctx.ch[c];
+        if (ch->length_enable && ch->length && --ch->length == 0) {
+            ch->enabled = 0;
+        }
+    }
+}
+
+// Next sweep frequency, disabling the channel on overflow
+static uint16_t sweep_calculate(void) {
+    uint8_t  nr10 = ctx.regs[NR10];
+    uint16_t offset = ctx.sweep_shadow >> (nr10 & 0x07);
+    uint16_t freq = nr10 & 0x08 ? ctx.sweep_shadow - offset : ctx.sweep_shadow + offset;
+
+    if (freq > 2047) {
+        ctx.ch[PULSE1].enabled = 0;
+    }
+    return freq;
+}
+
+static void clock_sweep(void) {
+    uint8_t nr10 = ctx.regs[NR10];
+    uint8_t sweep_period = (nr10 >> 4) & 0x07;
+
+    if (--ctx.sweep_timer) {
+        return;
+    }
+    ctx.sweep_timer = sweep_period ? sweep_period : 8;
+    if (!ctx.sweep_enabled || !sweep_period) {
+        return;
+    }
+
+    uint16_t freq = sweep_calculate();
+    if (freq <= 2047 && (nr10 & 0x07)) {
+        uint8_t *r = channel_regs(PULSE1);
+        ctx.sweep_shadow = freq;
+        r[3] = freq & 0xFF;
+        r[4] = (r[4] & ~0x07) | (freq >> 8);
+        sweep_calculate();
+    }
+}
+
+static void clock_envelopes(void) {
+    static const int channels[3] = { PULSE1, PULSE2, NOISE };
+
+    for (int i = 0; i < 3; i++) {
+        apu_channel *ch = &ctx.ch[channels[i]];
+        uint8_t nrx2 = channel_regs(channels[i])[2];
+        uint8_t env_period = nrx2 & 0x07;
+
+        if (!env_period || --ch->env_timer) {
+            continue;
+        }
+        ch->env_timer = env_period;
+        if ((nrx2 & 0x08) && ch->volume < 15) {
+            ch->volume++;
+        } else if (!(nrx2 & 0x08) && ch->volume > 0) {
+            ch->volume--;
+        }
+    }
+}
+
+static void frame_sequencer_clock(void) {
+    if (ctx.power) {
+        if (!(ctx.fs_step & 0x01)) {
+            clock_length();
+        }
+        if (ctx.fs_step == 2 || ctx.fs_step == 6) {
+            clock_sweep();
+        }
+        if (ctx.fs_step == 7) {
+            clock_envelopes();
+        }
+    }
+    ctx.fs_step = (ctx.fs_step + 1) & 0x07;
+}
+
+// Catch up to the current cycle: sequencer clocks in order, and while audio
+// is active every waveform step in between
+static void apu_sync(void) {
+    uint64_t now = scheduler_now();
+
+    while (ctx.fs_next <= now) {
+        if (ctx.voicing) {
+            run_voices(ctx.fs_next);
+        }
+        frame_sequencer_clock();
+        update_levels(ctx.fs_next);
+        ctx.fs_next += APU_FS_PERIOD;
+    }
+    if (ctx.voicing) {
+        run_voices(now);
+    }
+    update_voicing(now);
+}
+
+void apu_init(void) {
+    uint8_t output = ctx.output;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.output = output;
+    memcpy(ctx.regs, post_boot_regs, sizeof(post_boot_regs));
+    ctx.power = 1;
+
+    // The chime has faded out, but pulse 1 is still on
+    ctx.ch[PULSE1].enabled = 1;
+    ctx.ch[PULSE1].dac = 1;
+    ctx.sweep_timer = 8;
+    ctx.fs_next = scheduler_now() + APU_FS_PERIOD - (timer_counter() & (APU_FS_PERIOD - 1));
+    for (int c = 0; c < 4; c++) {
+        load_length(c);
+        ctx.voice[c].lfsr = 0x7FFF;
+    }
+
+    for (uint16_t addr = APU_FIRST_ADDR; addr <= APU_NR52_ADDR; addr++) {
+        io_register(addr, apu_read, apu_write);
+    }
+    for (uint16_t addr = APU_WAVE_ADDR; addr < APU_FIRST_ADDR + APU_REG_COUNT; addr++) {
+        io_register(addr, apu_read, apu_write);
+    }
+}
+
+void apu_output(uint8_t enable) {
+    ctx.output = enable;
+}
+
+static uint8_t apu_read(uint16_t addr) {
+    uint8_t i = addr - APU_FIRST_ADDR;
+    uint8_t status;
+
+    apu_sync();
+    if (i != NR52) {
+        return ctx.regs[i];
+    }
+    status = ctx.power << 7;
+    for (int c = 0; c < 4; c++) {
+        status |= ctx.ch[c].enabled << c;
+    }
+    return status;
+}
+
+static void trigger(int c) {
+    apu_channel *ch = &ctx.ch[c];
+    apu_voice *v = &ctx.voice[c];
+    uint8_t *r = channel_regs(c);
+
+    ch->enabled = ch->dac;
+    if (!ch->length) {
+        ch->length = max_length(c);
+    }
+    ch->volume = r[2] >> 4;
+    ch->env_timer = r[2] & 0x07;
+
+    v->next = scheduler_now() + period(c);
+    if (c == WAVE_CH) {
+        v->pos = 0;
+    }
+    v->lfsr = 0x7FFF;
+
+    if (c == PULSE1) {
+        uint8_t sweep_period = (ctx.regs[NR10] >> 4) & 0x07;
+        ctx.sweep_shadow = frequency(PULSE1);
+        ctx.sweep_timer = sweep_period ? sweep_period : 8;
+        ctx.sweep_enabled = sweep_period || (ctx.regs[NR10] & 0x07);
+        if (ctx.regs[NR10] & 0x07) {
+            sweep_calculate();
+        }
+    }
+}
+
+static void power_off(void) {
+    memset(ctx.regs, 0, POWER_REGS);
+    for (int c = 0; c < 4; c++) {
+        ctx.ch[c].enabled = 0;
+        ctx.ch[c].dac = 0;
+        ctx.ch[c].length_enable = 0;
+    }
+    ctx.power = 0;
+}
+
+// Channel register NRcr
+static void channel_write(int c, uint8_t r, uint8_t value) {
+    apu_channel *ch = &ctx.ch[c];
+
+    switch (r) {
+        case 1:
+            load_length(c);
+            break;
+        case 2:
+            if (c != WAVE_CH) {
+                ch->dac = (value & 0xF8) != 0;
+                ch->enabled &= ch->dac;
+            }
+            break;
+        case 4:
+            ch->length_enable = (value >> 6) & 0x01;
+            if (value & 0x80) {
+                trigger(c);
+            }
+            break;
+    }
+}
+
+static void apu_write(uint16_t addr, uint8_t value) {
+    uint8_t i = addr - APU_FIRST_ADDR;
+    int32_t left = 0, right = 0;
+
+    apu_sync();
+    if (i >= WAVE) {
+        ctx.regs[i] = value;
+        update_levels(scheduler_now());
+        return;
+    }
+    if (i == NR52) {
+        if (ctx.power && !(value & 0x80)) {
+            power_off();
+        } else if (!ctx.power && (value & 0x80)) {
+            ctx.power = 1;
+            ctx.fs_step = 0;
+        }
+        update_levels(scheduler_now());
+        return;
+    }
+    if (!ctx.power) {
+        return;
+    }
+
+    // Volume and panning move every playing channel at once
+    if (ctx.voicing && (i == NR50 || i == NR51)) {
+        for (int c = 0; c < 4; c++) {
+            left -= ctx.voice[c].level * gain_left(c);
+            right -= ctx.voice[c].level * gain_right(c);
+        }
+    }
+    ctx.regs[i] = value;
+    if (i == NR30) {
+        ctx.ch[WAVE_CH].dac = value >> 7;
+        ctx.ch[WAVE_CH].enabled &= ctx.ch[WAVE_CH].dac;
+    } else if (i < NR50) {
+        channel_write(i / 5, i % 5, value);
+    } else if (ctx.voicing) {
+        for (int c = 0; c < 4; c++) {
+            left += ctx.voice[c].level * gain_left(c);
+            right += ctx.voice[c].level * gain_right(c);
+        }
+        audio_step(scheduler_now(), left, right);
+    }
+    update_levels(scheduler_now());
+}
+
+// A DIV reset drops counter bit 12, a falling edge if it was set, and
+// restarts the sequencer's period from now
+void apu_div_write(void) {
+    apu_sync();
+    if (timer_counter() & (APU_FS_PERIOD / 2)) {
+        frame_sequencer_clock();
+        update_levels(scheduler_now());
+    }
+    ctx.fs_next = scheduler_now() + APU_FS_PERIOD;
+}
+
+void apu_frame_end(void) {
+    apu_sync();
+    if (ctx.voicing) {
+        audio_flush(scheduler_now());
+        ctx.flushed = scheduler_now();
+    }
+}
+
+// Synced first, so the state doesn't depend on when registers were last
+// touched or whether audio is on
+void apu_save(state_buffer *s) {
+    apu_sync();
+    state_put_bytes(s, ctx.regs, sizeof(ctx.regs));
+    for (int c = 0; c < 4; c++) {
+        apu_channel *ch = &ctx.ch[c];
+        state_put_u8(s, ch->enabled);
+        state_put_u8(s, ch->dac);
+        state_put_u8(s, ch->length_enable);
+        state_put_u16(s, ch->length);
+        state_put_u8(s, ch->volume);
+        state_put_u8(s, ch->env_timer);
+    }
+    state_put_u8(s, ctx.power);
+    state_put_u8(s, ctx.sweep_enabled);
+    state_put_u8(s, ctx.sweep_timer);
+    state_put_u16(s, ctx.sweep_shadow);
+    state_put_u8(s, ctx.fs_step);
+    state_put_u64(s, ctx.fs_next);
+}
+
+void apu_load(state_buffer *s) {
+    state_get_bytes(s, ctx.regs, sizeof(ctx.regs));
+    for (int c = 0; c < 4; c++) {
+        apu_channel *ch = &ctx.ch[c];
+        ch->enabled = state_get_u8(s);
+        ch->dac = state_get_u8(s);
+        ch->length_enable = state_get_u8(s);
+        ch->length = state_get_u16(s);
+        ch->volume = state_get_u8(s);
+        ch->env_timer = state_get_u8(s);
+    }
+    ctx.power = state_get_u8(s);
+    ctx.sweep_enabled = state_get_u8(s);
+    ctx.sweep_timer = state_get_u8(s);
+    ctx.sweep_shadow = state_get_u16(s);
+    ctx.fs_step = state_get_u8(s);
+    ctx.fs_next = state_get_u64(s);
+
+    // Synthesis restarts from silence at the next sync
+    ctx.voicing = 0;
+}
@@ -0,0 +1,247 @@
+#include "audio.h"
+#include "audio_file.h"
+#include "gb.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#define PI 3.14159265358979323846
+
+// Kernel cutoff as a fraction of the sample rate, under Nyquist so the
+// window's transition band stays clear of aliasing
+#define CUTOFF 0.45
+
+// Full scale for the loudest possible mix, 4 channels at level 15 times the
+// master volume of 8
+#define MIX_MAX (4 * 15 * 8)
+#define GAIN    (30000.0f / MIX_MAX)
+
+// DC blocking high-pass corner, the DACs only ever output positive levels
+#define HIGHPASS_HZ 20.0
+
+// Positions in the sample buffer are 32.32 fixed point
+#define FRAC_BITS 32
+
+typedef struct {
+    int16_t  frames[AUDIO_RING_SIZE * 2];
+    uint32_t head __attribute__((aligned(64)));  // written by the producer
+    uint32_t tail __attribute__((aligned(64)));  // written by the consumer
+} audio_ring;
+
+static float kernel[AUDIO_PHASES][AUDIO_TAPS] __attribute__((aligned(16)));
+static uint8_t kernel_ready;
+
+static struct {
+    uint32_t rate;
+    uint8_t  playback;        // a consumer drains the ring
+    uint8_t  muted;
+    uint64_t nominal_step;    // buffer samples per T-cycle at the nominal rate
+    uint64_t step;            // the same, bent by rate control
+    uint64_t base_cycle;      // T-cycle at buffer position `base_pos`
+    uint64_t base_pos;        // always below one sample
+    float    delta[2][AUDIO_BUFFER_SIZE + AUDIO_TAPS];
+    float    level[2];        // running sum of the deltas
+    float    dc[2];
+    float    highpass;
+    uint64_t produced;
+    uint64_t dropped;
+} out;
+
+static audio_ring ring;
+static uint64_t underruns;
+
+// Windowed sinc impulses at each sub-sample offset, each summing to 1.
+// Summing impulses and integrating gives band-limited steps.
+static void build_kernel(void) {
+    for (int p = 0; p < AUDIO_PHASES; p++) {
+        double sum = 0.0;
+        for (int k = 0; k < AUDIO_TAPS; k++) {
+            double t = k - (AUDIO_TAPS / 2 - 1) - (double) p / AUDIO_PHASES;
+            double x = 2.0 * CUTOFF * t;
+            double sinc = x == 0.0 ? 1.0 : sin(PI * x) / (PI * x);
+            double w = t / (AUDIO_TAPS / 2);
+            double window = fabs(w) >= 1.0 ? 0.0
+                : 0.42 + 0.5 * cos(PI * w) + 0.08 * cos(2.0 * PI * w);
+            kernel[p][k] = sinc * window;
+            sum += kernel[p][k];
+        }
+        for (int k = 0; k < AUDIO_TAPS; k++) {
+            kernel[p][k] /= sum;
+        }
+    }
+    kernel_ready = 1;
+}
+
+static uint32_t ring_count(void) {
+    uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+// Producer side, returns the frames that fit
+static uint32_t ring_write(const int16_t *frames, uint32_t count) {
+    uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+    uint32_t space = AUDIO_RING_SIZE - ring_count();
+
+    count = count < space ? count : space;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t slot = (head + i) & (AUDIO_RING_SIZE - 1);
+        ring.frames[slot * 2] = frames ? frames[i * 2] : 0;
+        ring.frames[slot * 2 + 1] = frames ? frames[i * 2 + 1] : 0;
+    }
+    __atomic_store_n(&ring.head, head + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+void audio_init(uint32_t sample_rate) {
+    if (sample_rate && !kernel_ready) {
+        build_kernel();
+    }
+    out.rate = sample_rate;
+    out.playback = 0;
+    out.nominal_step = ((uint64_t) sample_rate << FRAC_BITS) / GB_CLOCK_HZ;
+    out.step = out.nominal_step;
+    out.highpass = sample_rate ? 1.0 - exp(-2.0 * PI * HIGHPASS_HZ / sample_rate) : 0.0f;
+    out.produced = 0;
+    out.dropped = 0;
+    ring.head = 0;
+    ring.tail = 0;
+    underruns = 0;
+}
+
+void audio_set_playback(uint8_t playback) {
+    out.playback = playback;
+}
+
+uint8_t audio_playback(void) {
+    return out.playback;
+}
+
+uint8_t audio_active(void) {
+    return out.rate && ((out.playback && !out.muted) || audio_file_recording());
+}
+
+void audio_set_muted(uint8_t muted) {
+    out.muted = muted;
+}
+
+void audio_resume(uint64_t now) {
+    memset(out.delta, 0, sizeof(out.delta));
+    memset(out.level, 0, sizeof(out.level));
+    memset(out.dc, 0, sizeof(out.dc));
+    out.base_cycle = now;
+    out.base_pos = 0;
+
+    uint32_t count = ring_count();
+    if (out.playback && count < AUDIO_RING_SIZE / 2) {
+        ring_write(NULL, AUDIO_RING_SIZE / 2 - count);
+    }
+}
+
+static uint64_t position(uint64_t at) {
+    return out.base_pos + (at - out.base_cycle) * out.step;
+}
+
+void audio_step(uint64_t at, int32_t left, int32_t right) {
+    uint64_t pos = position(at);
+    uint32_t i = pos >> FRAC_BITS;
+    const float *k = kernel[(pos >> (FRAC_BITS - 6)) & (AUDIO_PHASES - 1)];
+
+    // The APU flushes often enough that this only guards against misuse
+    if (i >= AUDIO_BUFFER_SIZE) {
+        return;
+    }
+#ifdef __SSE__
+    __m128 l = _mm_set1_ps(left);
+    __m128 r = _mm_set1_ps(right);
+    for (int t = 0; t < AUDIO_TAPS; t += 4) {
+        __m128 taps = _mm_load_ps(k + t);
+        float *dl = &out.delta[0][i + t];
+        float *dr = &out.delta[1][i + t];
+        _mm_storeu_ps(dl, _mm_add_ps(_mm_loadu_ps(dl), _mm_mul_ps(l, taps)));
+        _mm_storeu_ps(dr, _mm_add_ps(_mm_loadu_ps(dr), _mm_mul_ps(r, taps)));
+    }
+#else
+    for (int t = 0; t < AUDIO_TAPS; t++) {
+        out.delta[0][i + t] += left * k[t];
+        out.delta[1][i + t] += right * k[t];
+    }
+#endif
+}
+
+void audio_flush(uint64_t now) {
+    int16_t samples[AUDIO_BUFFER_SIZE * 2];
+    uint64_t pos = position(now);
+    uint32_t n = pos >> FRAC_BITS;
+
+    n = n < AUDIO_BUFFER_SIZE ? n : AUDIO_BUFFER_SIZE;
+    for (int c = 0; c < 2; c++) {
+        float level = out.level[c];
+        float dc = out.dc[c];
+        for (uint32_t i = 0; i < n; i++) {
+            level += out.delta[c][i];
+            dc += (level - dc) * out.highpass;
+            float v = (level - dc) * GAIN;
+            samples[i * 2 + c] = v > 32767.0f ? 32767 : v < -32768.0f ? -32768 : (int16_t) v;
+        }
+        out.level[c] = level;
+        out.dc[c] = dc;
+
+        // Steps near the end still spill into the next samples
+        memmove(out.delta[c], out.delta[c] + n, AUDIO_TAPS * sizeof(float));
+        memset(out.delta[c] + AUDIO_TAPS, 0, n * sizeof(float));
+    }
+    out.base_cycle = now;
+    out.base_pos = pos - ((uint64_t) n << FRAC_BITS);
+
+    if (audio_file_recording()) {
+        audio_file_write(samples, n);
+    }
+    if (!out.playback || out.muted) {
+        out.step = out.nominal_step;
+        return;
+    }
+
+    uint32_t written = ring_write(samples, n);
+    out.produced += written;
+    out.dropped += n - written;
+
+    // Fewer samples per cycle while the ring is over half full, more while
+    // under, so the consumer's clock is followed without audible pitch shift
+    double fill = (double) ring_count() / AUDIO_RING_SIZE;
+    out.step = out.nominal_step * (1.0 + (1.0 - 2.0 * fill) * AUDIO_MAX_RATE_DELTA);
+}
+
+uint32_t audio_read(int16_t *frames, uint32_t count) {
+    uint32_t tail = __atomic_load_n(&ring.tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+    uint32_t available = head - tail;
+    uint32_t n = count < available ? count : available;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t slot = (tail + i) & (AUDIO_RING_SIZE - 1);
+        frames[i * 2] = ring.frames[slot * 2];
+        frames[i * 2 + 1] = ring.frames[slot * 2 + 1];
+    }
+    __atomic_store_n(&ring.tail, tail + n, __ATOMIC_RELEASE);
+
+    memset(frames + n * 2, 0, (count - n) * 2 * sizeof(int16_t));
+    __atomic_store_n(&underruns, underruns + (count - n), __ATOMIC_RELAXED);
+    return n;
+}
+
+audio_stats audio_get_stats(void) {
+    audio_stats stats = {
+        .sample_rate = out.rate,
+        .buffered = ring_count(),
+        .rate_ratio = out.nominal_step ? (double) out.step / out.nominal_step : 1.0,
+        .produced = out.produced,
+        .dropped = out.dropped,
+        .underruns = __atomic_load_n(&underruns, __ATOMIC_RELAXED),
+    };
+    return stats;
+}
@@ -0,0 +1,255 @@
+// pthreads, lseek
+#define _POSIX_C_SOURCE 200112L
+
+#include "audio_file.h"
+#include "host_io.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WAV_HEADER_SIZE 44
+
+typedef struct audio_batch {
+    struct audio_batch *next;
+    uint32_t frames;
+    int16_t  samples[AUDIO_FILE_BATCH_FRAMES * 2];
+} audio_batch;
+
+static struct {
+    uint8_t         open;
+    int             fd;
+    gb_audio_format format;
+    uint32_t        sample_rate;
+    uint64_t        frames;
+    uint64_t        stalls;
+
+    audio_batch    *current;       // being filled by the emulation thread
+    audio_batch    *queue;         // full, oldest first, for the writer
+    audio_batch    *queue_tail;
+    audio_batch    *spare;         // written out, ready for reuse
+    uint32_t        allocated;
+
+    pthread_t       writer;
+    pthread_mutex_t lock;
+    pthread_cond_t  queued;        // the writer has work or should finish
+    pthread_cond_t  freed;         // a batch went back to `spare`
+    uint8_t         closing;
+    uint8_t         failed;        // a write failed, set by the writer
+} file;
+
+static void put_u16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    put_u16(p, value & 0xFFFF);
+    put_u16(p + 2, value >> 16);
+}
+
+// Canonical 44-byte header. `data_size` 0xFFFFFFFF marks a stream of unknown
+// length.
+static void wav_header(uint8_t *h, uint32_t data_size) {
+    uint32_t riff_size = data_size == 0xFFFFFFFF ? data_size : data_size + WAV_HEADER_SIZE - 8;
+
+    memcpy(h, "RIFF", 4);
+    put_u32(h + 4, riff_size);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_u32(h + 16, 16);                       // fmt chunk size
+    put_u16(h + 20, 1);                        // PCM
+    put_u16(h + 22, 2);                        // channels
+    put_u32(h + 24, file.sample_rate);
+    put_u32(h + 28, file.sample_rate * 4);     // bytes per second
+    put_u16(h + 32, 4);                        // bytes per frame
+    put_u16(h + 34, 16);                       // bits per sample
+    memcpy(h + 36, "data", 4);
+    put_u32(h + 40, data_size);
+}
+
+static void *writer_main(void *arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&file.lock);
+    for (;;) {
+        while (!file.queue && !file.closing) {
+            pthread_cond_wait(&file.queued, &file.lock);
+        }
+        audio_batch *b = file.queue;
+        if (!b) {
+            break;
+        }
+        file.queue = b->next;
+        pthread_mutex_unlock(&file.lock);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (uint32_t i = 0; i < b->frames * 2; i++) {
+            b->samples[i] = __builtin_bswap16(b->samples[i]);
+        }
+#endif
+        uint8_t ok = host_write(file.fd, b->samples, b->frames * 2 * sizeof(int16_t));
+
+        pthread_mutex_lock(&file.lock);
+        file.failed |= !ok;
+        b->next = file.spare;
+        file.spare = b;
+        pthread_cond_signal(&file.freed);
+    }
+    pthread_mutex_unlock(&file.lock);
+    return NULL;
+}
+
+// An empty batch for the producer, waiting only once the cap is reached.
+// NULL only if the first allocation fails.
+static audio_batch *take_batch(void) {
+    audio_batch *b;
+
+    pthread_mutex_lock(&file.lock);
+    if (!file.spare && file.allocated < AUDIO_FILE_MAX_BATCHES) {
+        b = malloc(sizeof(audio_batch));
+        if (b) {
+            file.allocated++;
+            b->next = file.spare;
+            file.spare = b;
+        }
+    }
+    if (!file.spare && !file.allocated) {
+        pthread_mutex_unlock(&file.lock);
+        return NULL;
+    }
+    if (!file.spare) {
+        file.stalls++;
+        while (!file.spare) {
+            pthread_cond_wait(&file.freed, &file.lock);
+        }
+    }
+    b = file.spare;
+    file.spare = b->next;
+    pthread_mutex_unlock(&file.lock);
+
+    b->next = NULL;
+    b->frames = 0;
+    return b;
+}
+
+static void queue_batch(audio_batch *b) {
+    pthread_mutex_lock(&file.lock);
+    if (file.queue) {
+        file.queue_tail->next = b;
+    } else {
+        file.queue = b;
+    }
+    file.queue_tail = b;
+    pthread_cond_signal(&file.queued);
+    pthread_mutex_unlock(&file.lock);
+}
+
+uint8_t audio_file_open(int fd, uint32_t sample_rate, gb_audio_format format) {
+    uint8_t header[WAV_HEADER_SIZE];
+
+    if (file.open) {
+        printf("[ERROR] audio_file_open: already recording\n");
+        return 0;
+    }
+    memset(&file, 0, sizeof(file));
+    file.fd = fd;
+    file.format = format;
+    file.sample_rate = sample_rate;
+
+    // Sizes are patched on close if the descriptor can seek
+    if (format == GB_AUDIO_WAV) {
+        wav_header(header, 0xFFFFFFFF);
+        if (!host_write(file.fd, header, sizeof(header))) {
+            printf("[ERROR] audio_file_open: write fail\n");
+            return 0;
+        }
+    }
+
+    pthread_mutex_init(&file.lock, NULL);
+    pthread_cond_init(&file.queued, NULL);
+    pthread_cond_init(&file.freed, NULL);
+    file.current = take_batch();
+    if (!file.current) {
+        printf("[ERROR] audio_file_open: malloc fail\n");
+        return 0;
+    }
+    if (pthread_create(&file.writer, NULL, writer_main, NULL) != 0) {
+        printf("[ERROR] audio_file_open: can't start writer thread\n");
+        free(file.current);
+        return 0;
+    }
+    file.open = 1;
+    return 1;
+}
+
+uint8_t audio_file_recording(void) {
+    return file.open;
+}
+
+void audio_file_write(const int16_t *frames, uint32_t count) {
+    while (count) {
+        audio_batch *b = file.current;
+        uint32_t n = AUDIO_FILE_BATCH_FRAMES - b->frames;
+
+        n = count < n ? count : n;
+        memcpy(b->samples + b->frames * 2, frames, n * 2 * sizeof(int16_t));
+        b->frames += n;
+        frames += n * 2;
+        count -= n;
+        file.frames += n;
+
+        if (b->frames == AUDIO_FILE_BATCH_FRAMES) {
+            queue_batch(b);
+            file.current = take_batch();
+        }
+    }
+}
+
+void audio_file_detach(void) {
+    memset(&file, 0, sizeof(file));
+}
+
+uint8_t audio_file_close(void) {
+    uint8_t header[WAV_HEADER_SIZE];
+
+    if (!file.open) {
+        return 1;
+    }
+    if (file.current->frames) {
+        queue_batch(file.current);
+    } else {
+        free(file.current);
+    }
+    pthread_mutex_lock(&file.lock);
+    file.closing = 1;
+    pthread_cond_signal(&file.queued);
+    pthread_mutex_unlock(&file.lock);
+    pthread_join(file.writer, NULL);
+
+    while (file.spare) {
+        audio_batch *next = file.spare->next;
+        free(file.spare);
+        file.spare = next;
+    }
+    pthread_mutex_destroy(&file.lock);
+    pthread_cond_destroy(&file.queued);
+    pthread_cond_destroy(&file.freed);
+    file.open = 0;
+
+    uint64_t data_size = file.frames * 4;
+    if (file.format == GB_AUDIO_WAV && data_size < 0xFFFFFFFF - WAV_HEADER_SIZE
+            && lseek(file.fd, 0, SEEK_SET) == 0) {
+        wav_header(header, data_size);
+        file.failed |= !host_write(file.fd, header, sizeof(header));
+        lseek(file.fd, 0, SEEK_END);
+    }
+    if (file.failed) {
+        printf("[ERROR] audio_file_close: write fail\n");
+    }
+    return !file.failed;
+}
+
+audio_file_stats audio_file_get_stats(void) {
+    audio_file_stats stats = { file.frames, file.stalls };
+    return stats;
+}
@@ -0,0 +1,39 @@
+#include "branch.h"
+#include "audio.h"
+#include "audio_file.h"
+#include "checkpoint.h"
+#include "frame_dump.h"
+#include "gif_capture.h"
+#include "host_fork.h"
+#include "movie.h"
+#include "serial.h"
+#include "video.h"
+
+typedef struct {
+    gb_instance *gb;
+    gb_branch_fn fn;
+    void        *user;
+} branch_job;
+
+// In the child
+static void run_branch(uint32_t index, void *result, void *user) {
+    branch_job *job = user;
+
+    // The branch is not part of the logged, recorded or captured run
+    checkpoint_close();
+    movie_detach();
+    serial_capture(NULL);
+    video_detach();
+    frame_dump_detach();
+    gif_capture_detach();
+    audio_file_detach();
+    audio_set_playback(0);
+    job->fn(job->gb, index, result, job->user);
+}
+
+uint8_t branch_run(gb_instance *gb, uint32_t count, uint32_t result_size,
+        gb_branch_fn fn, void *user, void *results) {
+    branch_job job = { gb, fn, user };
+
+    return host_fork_run(count, 0, result_size, run_branch, &job, results);
+}
@@ -1,14 +1,32 @@
 #include "bus.h"
 #include "cartridge.h"
+#include "dma.h"
+#include "io.h"
+#include "machine.h"
+#include "gb.h"
 
-uint8_t vram[BUS_VRAM_SIZE];
-uint8_t wram[BUS_WRAM_SIZE];
-uint8_t  oam[BUS_OAM_SIZE];
-uint8_t mmio[BUS_IO_REG_SIZE];
-uint8_t hram[BUS_HRAM_SIZE];
-uint8_t enable_interrupt;
+#include <string.h>
+
+// Bus memory lives in the machine arena
+#define vram (machine->vram)
+#define wram (machine->wram)
+#define oam  (machine->oam)
+#define hram (machine->hram)
+#define enable_interrupt (machine->interrupt_enable)
+
+void bus_init(void) {
+    memset(vram, 0, sizeof(vram));
+    memset(wram, 0, sizeof(wram));
+    memset(oam, 0, sizeof(oam));
+    memset(hram, 0, sizeof(hram));
+    enable_interrupt = 0;
+}
 
 uint8_t bus_read(uint16_t addr) {
+    if (machine->dma.active && dma_blocks(addr)) {
+        return 0xFF;
+    }
+
     switch (addr) {
         case 0x0000 ... BUS_VRAM_ADDR - 1:
             return cartridge_rom_read(addr);
@@ -32,7 +50,7 @@ uint8_t bus_read(uint16_t addr) {
             return 0;
         case BUS_IO_REG_ADDR ... BUS_HRAM_ADDR - 1:
             // Input-Output Registers
-            return mmio[addr - BUS_IO_REG_ADDR];
+            return io_read(addr);
         case BUS_HRAM_ADDR ... BUS_IE_REG_ADDR - 1:
             // High RAM
             return hram[addr - BUS_HRAM_ADDR];
@@ -44,7 +62,17 @@ uint8_t bus_read(uint16_t addr) {
     }
 }
 
+// Address watched by GB_UNTIL_WRITE
+uint16_t bus_watch_addr;
+
 void bus_write(uint16_t addr, uint8_t value) {
+    if (machine->dma.active && dma_blocks(addr)) {
+        return;
+    }
+    if (addr == bus_watch_addr && (emu_until & GB_UNTIL_WRITE)) {
+        emu_stop(GB_STOP_WRITE);
+    }
+
     switch (addr) {
         case 0x0000 ... BUS_VRAM_ADDR - 1:
             // Cartridge ROM
@@ -53,18 +81,21 @@ void bus_write(uint16_t addr, uint8_t value) {
         case BUS_VRAM_ADDR ... BUS_EXT_RAM_ADDR - 1:
             // Video RAM
             vram[addr - BUS_VRAM_ADDR] = value;
+            STATE_MARK_DIRTY(STATE_PAGE_VRAM + ((addr - BUS_VRAM_ADDR) >> 8));
             break;
         case BUS_EXT_RAM_ADDR ... BUS_WRAM_ADDR - 1:
             // External RAM
-            cartridge_ram_write(addr, value);
+            cartridge_ram_write(addr - BUS_EXT_RAM_ADDR, value);
             break;
         case BUS_WRAM_ADDR ... BUS_ECHO_ADDR - 1:
             // Working RAM
             wram[addr - BUS_WRAM_ADDR] = value;
+            STATE_MARK_DIRTY(STATE_PAGE_WRAM + ((addr - BUS_WRAM_ADDR) >> 8));
             break;
         case BUS_ECHO_ADDR ... BUS_OAM_ADDR - 1:
             // Echo (of WRAM) RAM
             wram[addr - BUS_ECHO_ADDR] = value;
+            STATE_MARK_DIRTY(STATE_PAGE_WRAM + ((addr - BUS_ECHO_ADDR) >> 8));
             break;
         case BUS_OAM_ADDR ... BUS_UNUSABLE_ADDR - 1:
             // Object Attribute Memory
@@ -75,7 +106,7 @@ void bus_write(uint16_t addr, uint8_t value) {
             break;
         case BUS_IO_REG_ADDR ... BUS_HRAM_ADDR - 1:
             // Input-Output Registers
-            mmio[addr - BUS_IO_REG_ADDR] = value;
+            io_write(addr, value);
             break;
         case BUS_HRAM_ADDR ... BUS_IE_REG_ADDR - 1:
             // High RAM
@@ -98,4 +129,34 @@ void bus_write_16(uint16_t addr, uint16_t value) {
     uint8_t high = (value >> 8) & 0xFF;
     bus_write(addr, low);
     bus_write(addr + 1, high);
-}
\ No newline at end of file
+}
+
+uint8_t *bus_direct_ptr(uint16_t addr) {
+    switch (addr) {
+        case 0x0000 ... BUS_VRAM_ADDR - 1:
+            return cartridge_rom_ptr(addr);
+        case BUS_VRAM_ADDR ... BUS_EXT_RAM_ADDR - 1:
+            return &vram[addr - BUS_VRAM_ADDR];
+        case BUS_WRAM_ADDR ... BUS_ECHO_ADDR - 1:
+            return &wram[addr - BUS_WRAM_ADDR];
+        case BUS_ECHO_ADDR ... BUS_OAM_ADDR - 1:
+            return &wram[addr - BUS_ECHO_ADDR];
+        case BUS_OAM_ADDR ... BUS_UNUSABLE_ADDR - 1:
+            return &oam[addr - BUS_OAM_ADDR];
+        default:
+            return NULL;
+    }
+}
+
+// VRAM and WRAM are paged memory, saved by the state module
+void bus_save(state_buffer *s) {
+    state_put_bytes(s, oam, sizeof(oam));
+    state_put_bytes(s, hram, sizeof(hram));
+    state_put_u8(s, enable_interrupt);
+}
+
+void bus_load(state_buffer *s) {
+    state_get_bytes(s, oam, sizeof(oam));
+    state_get_bytes(s, hram, sizeof(hram));
+    enable_interrupt = state_get_u8(s);
+}
@@ -1,6 +1,61 @@
 #include "cartridge.h"
+#include "machine.h"
 
-static cartridge_context ctx;
+#include <string.h>
+
+#define ctx (machine->cartridge)
+// Sized for the largest supported cartridge, ctx.ram_size is what is present
+#define ram (machine->cart_ram)
+
+// Set up banking and cartridge RAM from the header of the ROM in ctx.rom
+static uint8_t parse_header(void) {
+    // Both banks of the 0000-7FFF window are read without further checks
+    if (ctx.rom_size < CARTRIDGE_ROM_BANK_SIZE * 2) {
+        printf("[ERROR] cartridge_load: ROM smaller than 32 KiB\n");
+        return 0;
+    }
+
+    // Some header data
+    switch (ctx.rom[CARTRIDGE_TYPE_ADDR]) {
+        case 0x00:
+            ctx.cartridge_type = ROM_ONLY;
+            ctx.ram_size = CARTRIDGE_RAM_BANK_SIZE;
+            break;
+        case 0x03:  // MBC1+RAM+BATTERY
+
+            // fall through
+        case 0x02:  // MBC1+RAM
+            ctx.ram_size = CARTRIDGE_RAM_BANK_SIZE * 4;
+            ctx.cartridge_type = MBC1;
+            break;
+        case 0x01:  // MBC1
+            ctx.ram_size = 0;
+            ctx.cartridge_type = MBC1;
+            break;
+        default:
+            printf("[ERROR] unsupported cartridge type: %02X\n", ctx.rom[CARTRIDGE_TYPE_ADDR]);
+            return 0;
+    }
+    // Zeroed so identical runs produce identical save states
+    memset(ram, 0, sizeof(ram));
+    uint8_t size_code = ctx.rom[CARTRIDGE_BANK_ADDR];
+    if (size_code > 7 || (2u << size_code) > MAX_NUM_BANKS) {
+        printf("[ERROR] unsupported ROM size: %02X\n", size_code);
+        return 0;
+    }
+    ctx.rom_bank_count = 2 << size_code;
+    if (ctx.rom_size < (uint32_t) ctx.rom_bank_count * CARTRIDGE_ROM_BANK_SIZE) {
+        printf("[ERROR] cartridge_load: ROM shorter than its header's %u banks\n",
+            ctx.rom_bank_count);
+        return 0;
+    }
+    ctx.rom_bank = 0;
+
+    ctx.ram_enable = 0;
+    ctx.ram_bank = 0;
+
+    return 1;
+}
 
 uint8_t cartridge_rom_load(const char *rom_path) {
     FILE *f = fopen(rom_path, "rb");
@@ -8,6 +63,8 @@ uint8_t cartridge_rom_load(const char *rom_path) {
         printf("[ERROR] cartridge_load: Could not open '%s'\n", rom_path);
         return 0;
     }
+
+    cartridge_cleanup();
     
     // Determine file size
     fseek(f, 0, SEEK_END);
@@ -18,44 +75,45 @@ uint8_t cartridge_rom_load(const char *rom_path) {
     ctx.rom = (uint8_t *) malloc(ctx.rom_size);
     if (!ctx.rom) {
         printf("[ERROR] cartridge_load: malloc fail\n");
+        fclose(f);
         return 0;
     }
 
     // Read file content to cartridge
     if (!fread(ctx.rom, ctx.rom_size, 1, f)) {
         printf("[ERROR] cartridge_load: fread fail\n");
+        fclose(f);
         return 0;
     }
 
     // Finished with the file
     fclose(f);
 
-    // Some header data
-    switch (ctx.rom[CARTRIDGE_TYPE_ADDR]) {
-        case 0x00:
-            ctx.cartridge_type = ROM_ONLY;
-            ctx.ram = malloc(CARTRIDGE_RAM_BANK_SIZE);
-            break;
-        case 0x03:  // MBC1+RAM+BATTERY
+    return parse_header();
+}
 
-            // fall through
-        case 0x02:  // MBC1+RAM
-            ctx.ram = malloc(CARTRIDGE_RAM_BANK_SIZE * 4);
-            // fall through
-        case 0x01:  // MBC1
-            ctx.cartridge_type = MBC1;
-            break;
-        default:
-            printf("[ERROR] unsupported cartridge type: %02X\n", ctx.rom[CARTRIDGE_TYPE_ADDR]);
-            exit(1);
+// Load a ROM image the caller already has in memory. The image is copied, so
+// the caller's buffer may be freed once this returns.
+uint8_t cartridge_rom_load_from_memory(const uint8_t *data, uint32_t size) {
+    cartridge_cleanup();
+
+    ctx.rom_size = size;
+    ctx.rom = (uint8_t *) malloc(ctx.rom_size);
+    if (!ctx.rom) {
+        printf("[ERROR] cartridge_load: malloc fail\n");
+        return 0;
     }
-    ctx.rom_bank_count = 2 << ctx.rom[CARTRIDGE_BANK_ADDR];
-    ctx.rom_bank = 0;
+    memcpy(ctx.rom, data, size);
 
-    ctx.ram_enable = 0;
-    ctx.ram_bank = 0;
+    return parse_header();
+}
 
-    return 1;
+// ROM offset of `addr` in the 4000-7FFF window. It wraps at the size the
+// header declares, a power of two no larger than the image, as the MBC
+// drives no more address lines than the ROM has.
+static uint32_t banked_offset(uint16_t addr) {
+    uint32_t offset = addr + ctx.rom_bank * CARTRIDGE_ROM_BANK_SIZE;
+    return offset & ((uint32_t) ctx.rom_bank_count * CARTRIDGE_ROM_BANK_SIZE - 1);
 }
 
 uint8_t cartridge_rom_read(uint16_t addr) {
@@ -65,7 +123,7 @@ uint8_t cartridge_rom_read(uint16_t addr) {
             return ctx.rom[addr];
         case 0x4000 ... 0x7FFF:
             // ROM bank 1-N
-            return ctx.rom[addr + ctx.rom_bank * 0x4000];
+            return ctx.rom[banked_offset(addr)];
         default:
             printf("[ERROR] cartridge_read bad address %04X\n", addr);
             exit(1);
@@ -73,6 +131,14 @@ uint8_t cartridge_rom_read(uint16_t addr) {
     }
 }
 
+// Direct pointer into the currently mapped ROM, for bulk copies.
+uint8_t *cartridge_rom_ptr(uint16_t addr) {
+    if (addr < 0x4000) {
+        return &ctx.rom[addr];
+    }
+    return &ctx.rom[banked_offset(addr)];
+}
+
 void cartridge_bank_operation(uint16_t addr, uint8_t value) {
     if (ctx.cartridge_type == ROM_ONLY) { return; }
     // assume MBC1
@@ -120,10 +186,10 @@ void cartridge_print_info(void) {
 uint8_t cartridge_ram_read(uint16_t addr) {
     switch (ctx.cartridge_type) {
         case ROM_ONLY:
-            return ctx.ram[addr];
+            return ram[addr];
         case MBC1:
-            if (ctx.ram) {
-                return ctx.ram[addr + ctx.ram_bank * CARTRIDGE_RAM_BANK_SIZE];
+            if (ctx.ram_size) {
+                return ram[addr + ctx.ram_bank * CARTRIDGE_RAM_BANK_SIZE];
             } else {
                 printf("RAM not enabled\n");
                 // fall through
@@ -138,7 +204,8 @@ uint8_t cartridge_ram_read(uint16_t addr) {
 void cartridge_ram_write(uint16_t addr, uint8_t value) {
     switch (ctx.cartridge_type) {
         case ROM_ONLY:
-            ctx.ram[addr] = value;
+            ram[addr] = value;
+            STATE_MARK_DIRTY(STATE_PAGE_CART_RAM + (addr >> 8));
             break;
         default:
             printf("[WARN] cartridge_ram_write: Unsupported cartridge type\n");
@@ -149,8 +216,38 @@ void cartridge_ram_write(uint16_t addr, uint8_t value) {
 void cartridge_cleanup(void) {
     if (ctx.rom) {
         free(ctx.rom);
+        ctx.rom = NULL;
     }
-    if (ctx.ram) {
-        free(ctx.ram);
+    ctx.ram_size = 0;
+}
+
+uint8_t *cartridge_ram_ptr(void) {
+    return ctx.ram_size ? ram : NULL;
+}
+
+uint32_t cartridge_ram_size(void) {
+    return ctx.ram_size;
+}
+
+// Header global checksum, used to tie save states to their ROM
+uint16_t cartridge_checksum(void) {
+    if (!ctx.rom || ctx.rom_size < CARTRIDGE_CHECKSUM_ADDR + 2) {
+        return 0;
     }
-}
\ No newline at end of file
+    return (ctx.rom[CARTRIDGE_CHECKSUM_ADDR] << 8) | ctx.rom[CARTRIDGE_CHECKSUM_ADDR + 1];
+}
+
+// Banking registers only, cartridge RAM is paged memory saved by the state module
+void cartridge_save(state_buffer *s) {
+    state_put_u8(s, ctx.rom_bank);
+    state_put_u8(s, ctx.ram_enable);
+    state_put_u8(s, ctx.ram_bank);
+    state_put_u8(s, ctx.mode);
+}
+
+void cartridge_load(state_buffer *s) {
+    ctx.rom_bank = state_get_u8(s);
+    ctx.ram_enable = state_get_u8(s);
+    ctx.ram_bank = state_get_u8(s);
+    ctx.mode = state_get_u8(s);
+}
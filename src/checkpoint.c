@@ -0,0 +1,185 @@
+#include "checkpoint.h"
+#include "cartridge.h"
+#include "scheduler.h"
+#include "state.h"
+
+#include <string.h>
+
+static struct {
+    FILE    *file;
+    uint32_t interval;
+    uint32_t step_frame;
+    uint32_t frame;     // frames completed since the log was opened
+    uint32_t step;
+} ctx;
+
+static void write_record(const checkpoint_record *r) {
+    uint8_t buf[CHECKPOINT_RECORD_SIZE];
+    state_buffer s = { buf, 0 };
+
+    state_put_u32(&s, r->frame);
+    state_put_u32(&s, r->step);
+    state_put_u16(&s, r->pc);
+    state_put_u64(&s, r->cycles);
+    state_put_u64(&s, r->hash);
+    fwrite(buf, 1, sizeof(buf), ctx.file);
+}
+
+uint8_t checkpoint_open(const char *path, uint32_t interval, uint32_t step_frame) {
+    uint8_t header[CHECKPOINT_HEADER_SIZE];
+    state_buffer s = { header, 0 };
+
+    checkpoint_close();
+    ctx.file = fopen(path, "wb");
+    if (!ctx.file) {
+        printf("[ERROR] checkpoint_open: can't open %s\n", path);
+        return 0;
+    }
+    ctx.interval = interval ? interval : 1;
+    ctx.step_frame = step_frame;
+    ctx.frame = 0;
+    ctx.step = 0;
+
+    state_put_u32(&s, CHECKPOINT_MAGIC);
+    state_put_u16(&s, CHECKPOINT_VERSION);
+    state_put_u16(&s, cartridge_checksum());
+    state_put_u32(&s, ctx.interval);
+    fwrite(header, 1, sizeof(header), ctx.file);
+    return 1;
+}
+
+uint8_t checkpoint_stepping(void) {
+    return ctx.file && ctx.frame == ctx.step_frame;
+}
+
+void checkpoint_step(uint16_t pc) {
+    checkpoint_record r = { ctx.frame, ctx.step++, pc, scheduler_now(), state_hash() };
+    write_record(&r);
+}
+
+void checkpoint_frame_done(uint16_t pc) {
+    if (!ctx.file) {
+        return;
+    }
+    if (ctx.frame % ctx.interval == 0 || ctx.frame == ctx.step_frame) {
+        checkpoint_record r = { ctx.frame, CHECKPOINT_FRAME_END, pc, scheduler_now(),
+            state_hash() };
+        write_record(&r);
+    }
+    ctx.frame++;
+    ctx.step = 0;
+}
+
+uint8_t checkpoint_close(void) {
+    uint8_t ok = 1;
+
+    if (ctx.file) {
+        ok = !ferror(ctx.file);
+        ok = fclose(ctx.file) == 0 && ok;
+        if (!ok) {
+            printf("[ERROR] checkpoint_close: failed to write log\n");
+        }
+    }
+    memset(&ctx, 0, sizeof(ctx));
+    return ok;
+}
+
+// Read a whole log. Returns the records, NULL on failure.
+static checkpoint_record *read_log(const char *path, uint32_t *count, uint32_t *interval) {
+    uint8_t buf[CHECKPOINT_RECORD_SIZE];
+    FILE *file = fopen(path, "rb");
+
+    if (!file) {
+        printf("[ERROR] checkpoint_compare: can't open %s\n", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    state_buffer s = { buf, 0 };
+    if (size < CHECKPOINT_HEADER_SIZE
+            || fread(buf, 1, CHECKPOINT_HEADER_SIZE, file) != CHECKPOINT_HEADER_SIZE
+            || state_get_u32(&s) != CHECKPOINT_MAGIC
+            || state_get_u16(&s) != CHECKPOINT_VERSION) {
+        printf("[ERROR] checkpoint_compare: %s is not a checkpoint log\n", path);
+        fclose(file);
+        return NULL;
+    }
+    state_get_u16(&s);
+    *interval = state_get_u32(&s);
+    *count = (size - CHECKPOINT_HEADER_SIZE) / CHECKPOINT_RECORD_SIZE;
+
+    checkpoint_record *records = malloc((*count ? *count : 1) * sizeof(checkpoint_record));
+    if (!records) {
+        printf("[ERROR] checkpoint_compare: malloc fail\n");
+        fclose(file);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < *count; i++) {
+        if (fread(buf, 1, sizeof(buf), file) != sizeof(buf)) {
+            printf("[ERROR] checkpoint_compare: %s is truncated\n", path);
+            free(records);
+            fclose(file);
+            return NULL;
+        }
+        s = (state_buffer) { buf, 0 };
+        records[i].frame  = state_get_u32(&s);
+        records[i].step   = state_get_u32(&s);
+        records[i].pc     = state_get_u16(&s);
+        records[i].cycles = state_get_u64(&s);
+        records[i].hash   = state_get_u64(&s);
+    }
+    fclose(file);
+    return records;
+}
+
+static uint8_t same(const checkpoint_record *a, const checkpoint_record *b) {
+    return a->frame == b->frame && a->step == b->step && a->pc == b->pc
+        && a->cycles == b->cycles && a->hash == b->hash;
+}
+
+uint8_t checkpoint_compare(const char *path_a, const char *path_b, checkpoint_divergence *result) {
+    uint32_t count_a, count_b, interval_a, interval_b;
+    checkpoint_record *a = read_log(path_a, &count_a, &interval_a);
+    checkpoint_record *b = read_log(path_b, &count_b, &interval_b);
+
+    memset(result, 0, sizeof(*result));
+    if (!a || !b || interval_a != interval_b) {
+        if (a && b) {
+            printf("[ERROR] checkpoint_compare: logs use different intervals\n");
+        }
+        free(a);
+        free(b);
+        return 0;
+    }
+
+    // Once two runs diverge they stay diverged, so the records that match
+    // form a prefix and the first mismatch can be bisected
+    uint32_t shared = count_a < count_b ? count_a : count_b;
+    uint32_t lo = 0;
+    uint32_t hi = shared;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (same(&a[mid], &b[mid])) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo > 0) {
+        result->last_match = a[lo - 1];
+    }
+    if (lo < shared) {
+        result->diverged = 1;
+        result->first_a = a[lo];
+        result->first_b = b[lo];
+    } else {
+        result->length_differs = count_a != count_b;
+    }
+
+    free(a);
+    free(b);
+    return 1;
+}
@@ -1,5 +1,8 @@
 #include "cpu.h"
 #include "bus.h"
+#include "io.h"
+#include "gb.h"
+#include "machine.h"
 
 // Pull out 3 bits of an op code following the format: XXYYYZZZ
 #define YYY(op) ((op >> 3) & 0x07)
@@ -43,7 +46,14 @@
 #define REG_HL_SET(value) REG_H = ((value) >> 8) & 0xFF; REG_L = value & 0xFF
 #define REG_AF_SET(value) REG_A = ((value) >> 8) & 0xFF; REG_F = value & 0xFF
 
-static cpu_context ctx;
+#define ctx (machine->cpu)
+
+// Targets of GB_UNTIL_PC and GB_UNTIL_INTERRUPT
+uint16_t cpu_watch_pc;
+uint8_t  cpu_watch_interrupts;
+
+uint8_t cpu_if_read(uint16_t addr);
+void cpu_if_write(uint16_t addr, uint8_t value);
 
 void print_state(void) {
     uint8_t reg_f = 0;
@@ -503,10 +513,10 @@ void execute(uint8_t op) {
             bus_write(REG_HL, REG_ZZZ(op));
             break;
 
-        // HALT - prevent PC increment
+        // HALT - wait for an interrupt to become pending
         case 0x76:
             ctx.t_cycles = 4;
-            ctx.pc--;
+            ctx.halted = 1;
             break;
         
         // LD (HL), A
@@ -1381,6 +1391,14 @@ void execute(uint8_t op) {
             }
             break;
 
+        // RETI
+        case 0xD9:
+            ctx.t_cycles = 16;
+            ctx.pc = bus_read_16(ctx.sp);
+            ctx.sp += 2;
+            ctx.ime = 1;
+            break;
+
         // JP C, u16
         case 0xDA:
             intermediate = fetch_16();
@@ -1544,7 +1562,8 @@ void execute(uint8_t op) {
         // DI - Disable Interrupts
         case 0xF3:
             ctx.t_cycles = 4;
-            bus_write(BUS_IE_REG_ADDR, 0);
+            ctx.ime = 0;
+            ctx.ime_pending = 0;
             break;
 
         // PUSH AF
@@ -1601,7 +1620,7 @@ void execute(uint8_t op) {
         // EI - Enable Interrupts
         case 0xFB:
             ctx.t_cycles = 4;
-            bus_write(BUS_IE_REG_ADDR, 1);
+            ctx.ime_pending = 1;
             break;
 
         // CP A, u8 - Compare register A to immediate 8
@@ -1644,6 +1663,75 @@ void cpu_init(void) {
 
     ctx.pc = 0x0100;
     ctx.sp = 0xfffe;
+
+    ctx.t_cycles = 0;
+    ctx.ime = 0;
+    ctx.ime_pending = 0;
+    ctx.halted = 0;
+    ctx.interrupt_flag = 0;
+
+    io_register(INT_IF_ADDR, cpu_if_read, cpu_if_write);
+}
+
+// Jump to the highest priority pending interrupt, if any may be taken.
+// Returns 1 when an interrupt was dispatched in place of an instruction.
+uint8_t service_interrupt(void) {
+    uint8_t pending = bus_read(BUS_IE_REG_ADDR) & ctx.interrupt_flag & INT_MASK;
+    if (!pending) {
+        return 0;
+    }
+
+    // A pending interrupt always ends HALT, even with IME off
+    ctx.halted = 0;
+    if (!ctx.ime) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < 5; i++) {
+        uint8_t flag = 1 << i;
+        if (pending & flag) {
+            ctx.t_cycles = 20;
+            ctx.ime = 0;
+            ctx.interrupt_flag &= ~flag;
+            ctx.sp -= 2;
+            bus_write_16(ctx.sp, ctx.pc);
+            ctx.pc = 0x40 + i * 8;
+            if ((emu_until & GB_UNTIL_INTERRUPT) && (flag & cpu_watch_interrupts)) {
+                emu_stop(GB_STOP_INTERRUPT);
+            }
+            break;
+        }
+    }
+    return 1;
+}
+
+void cpu_request_interrupt(uint8_t flag) {
+    ctx.interrupt_flag |= flag;
+}
+
+uint16_t cpu_pc(void) {
+    return ctx.pc;
+}
+
+uint8_t cpu_if_read(uint16_t addr) {
+    (void) addr;
+    return ctx.interrupt_flag;
+}
+
+void cpu_if_write(uint16_t addr, uint8_t value) {
+    (void) addr;
+    ctx.interrupt_flag = value & INT_MASK;
+}
+
+// Instructions run in full when they start, so PC landing on the target here
+// means the target instruction is next and has not executed.
+static void check_pc(void) {
+    if ((emu_until & GB_UNTIL_PC) && ctx.pc == cpu_watch_pc) {
+        emu_stop(GB_STOP_PC);
+    }
+    if (emu_until & GB_UNTIL_STEP) {
+        emu_stop(GB_STOP_STEP);
+    }
 }
 
 void cpu_step(void) {
@@ -1653,7 +1741,55 @@ void cpu_step(void) {
     }
     // ctx.t_cycles to be added onto by execute
 
+    if (service_interrupt()) {
+        check_pc();
+        return;
+    }
+    if (ctx.halted) {
+        ctx.t_cycles = 4;
+        return;
+    }
+
+    // EI is delayed by one instruction, so latch it before executing
+    uint8_t enable_ime = ctx.ime_pending;
+
     // print_state();
     uint8_t op = fetch();
     execute(op);
-}
\ No newline at end of file
+
+    if (enable_ime && ctx.ime_pending) {
+        ctx.ime = 1;
+        ctx.ime_pending = 0;
+    }
+    check_pc();
+}
+
+void cpu_save(state_buffer *s) {
+    state_put_bytes(s, ctx.registers, sizeof(ctx.registers));
+    state_put_u8(s, REG_A);
+    state_put_u8(s, REG_F_Z << 7 | REG_F_N << 6 | REG_F_H << 5 | REG_F_C << 4);
+    state_put_u16(s, ctx.pc);
+    state_put_u16(s, ctx.sp);
+    state_put_u8(s, ctx.t_cycles);
+    state_put_u8(s, ctx.ime);
+    state_put_u8(s, ctx.ime_pending);
+    state_put_u8(s, ctx.halted);
+    state_put_u8(s, ctx.interrupt_flag);
+}
+
+void cpu_load(state_buffer *s) {
+    state_get_bytes(s, ctx.registers, sizeof(ctx.registers));
+    REG_A = state_get_u8(s);
+    uint8_t flags = state_get_u8(s);
+    REG_F_SET_Z((flags >> 7) & 0x01);
+    REG_F_SET_N((flags >> 6) & 0x01);
+    REG_F_SET_H((flags >> 5) & 0x01);
+    REG_F_SET_C((flags >> 4) & 0x01);
+    ctx.pc = state_get_u16(s);
+    ctx.sp = state_get_u16(s);
+    ctx.t_cycles = state_get_u8(s);
+    ctx.ime = state_get_u8(s);
+    ctx.ime_pending = state_get_u8(s);
+    ctx.halted = state_get_u8(s);
+    ctx.interrupt_flag = state_get_u8(s);
+}
@@ -0,0 +1,96 @@
+#include "dma.h"
+#include "bus.h"
+#include "gb.h"
+#include "machine.h"
+#include "scheduler.h"
+#include "io.h"
+
+#include <string.h>
+
+#define ctx (machine->dma)
+
+static void dma_on_end(void);
+
+void dma_init(void) {
+    ctx.active = 0;
+    ctx.vram_source = 0;
+    ctx.source_register = 0xFF;
+    scheduler_register(SCHED_DMA_END, dma_on_end);
+    io_register(DMA_ADDR, dma_read, dma_write);
+}
+
+// Games start a transfer every frame to refresh sprites, so the whole 160 bytes
+// are moved up front. Nothing can observe OAM until the transfer window ends,
+// which is the only part that has to be timed.
+void dma_start(uint8_t source_page) {
+    uint16_t source = source_page << 8;
+
+    // Pages 0xE0-0xFF read the echo of WRAM, never OAM itself or the IO registers
+    if (source >= BUS_ECHO_ADDR) {
+        source -= BUS_ECHO_ADDR - BUS_WRAM_ADDR;
+    }
+    uint8_t *dest = bus_direct_ptr(BUS_OAM_ADDR);
+    uint8_t *src  = bus_direct_ptr(source);
+
+    // A restarted transfer copies from the new source, so drop the lockout first
+    ctx.active = 0;
+
+    if (src) {
+        memcpy(dest, src, DMA_LENGTH);
+    } else {
+        // External RAM is banked and may be disabled, take the slow path
+        for (uint16_t i = 0; i < DMA_LENGTH; i++) {
+            dest[i] = bus_read(source + i);
+        }
+    }
+    // The copy bypasses bus_write(), which is where writes are watched
+    if ((emu_until & GB_UNTIL_WRITE) && (uint16_t) (bus_watch_addr - BUS_OAM_ADDR) < DMA_LENGTH) {
+        emu_stop(GB_STOP_WRITE);
+    }
+
+    ctx.vram_source = source >= BUS_VRAM_ADDR && source < BUS_EXT_RAM_ADDR;
+    ctx.active = 1;
+    scheduler_schedule(SCHED_DMA_END, scheduler_now() + DMA_CYCLES);
+}
+
+uint8_t dma_read(uint16_t addr) {
+    (void) addr;
+    return ctx.source_register;
+}
+
+void dma_write(uint16_t addr, uint8_t value) {
+    (void) addr;
+    ctx.source_register = value;
+    dma_start(value);
+}
+
+// The CPU keeps access to HRAM and the IO registers during a transfer. OAM is
+// busy, as is whichever of the external or video buses the source sits on.
+uint8_t dma_blocks(uint16_t addr) {
+    if (addr >= BUS_IO_REG_ADDR) {
+        return 0;
+    }
+    if (addr >= BUS_OAM_ADDR) {
+        return 1;
+    }
+    if (addr >= BUS_VRAM_ADDR && addr < BUS_EXT_RAM_ADDR) {
+        return ctx.vram_source;
+    }
+    return !ctx.vram_source;
+}
+
+static void dma_on_end(void) {
+    ctx.active = 0;
+}
+
+void dma_save(state_buffer *s) {
+    state_put_u8(s, ctx.active);
+    state_put_u8(s, ctx.vram_source);
+    state_put_u8(s, ctx.source_register);
+}
+
+void dma_load(state_buffer *s) {
+    ctx.active = state_get_u8(s);
+    ctx.vram_source = state_get_u8(s);
+    ctx.source_register = state_get_u8(s);
+}
@@ -1,48 +1,1005 @@
+// fileno, fdopen, dup2
+#define _POSIX_C_SOURCE 200112L
+
 #include "emulator.h"
-#include "cartridge.h"
-#include "cpu.h"
 #include "common.h"
-#include "ppu.h"
+#include "gb.h"
+#include "checkpoint.h"
+#include "golden.h"
+#include "joypad.h"
+#include "serial.h"
+#include "host_time.h"
+#include "scale.h"
+#ifndef GB_HEADLESS
 #include "window.h"
+#endif
+
+#include <string.h>
+#include <unistd.h>
 
-#define USAGE "rom_path"
+#define USAGE "[options] rom_path"
+
+#define OPTIONS_HELP \
+    "  --headless     run without a window (always on in headless builds)\n" \
+    "  --frames N     stop after N frames\n" \
+    "  --serial       echo serial output to stdout\n" \
+    "  --until STR    stop once serial output ends with STR\n" \
+    "  --test-rom     stop on \"Passed\" or \"Failed\", exit 2 on failure\n" \
+    "  --stats        print startup time, emulation speed and windowed frame timing\n" \
+    "  --speed N      pace to N times real time, 0 for unlimited (window default 1,\n" \
+    "                 Tab cycles 1/2/4/unlimited)\n" \
+    "  --no-audio     don't open an audio device in the window (sound plays at 1x)\n" \
+    "  --audio FILE   record sound at any speed, WAV if FILE ends in .wav, otherwise\n" \
+    "                 raw s16le stereo (- for stdout, other output moves to stderr)\n" \
+    "  --sample-rate N  audio rate in Hz (default 48000, the window's device may differ)\n" \
+    "  --video FILE   record frames on a writer thread, Y4M if FILE ends in .y4m,\n" \
+    "                 otherwise raw rgb24 160x144 (- for stdout, as for --audio)\n" \
+    "  --video-drop   repeat frames instead of waiting when the video writer falls behind\n" \
+    "  --bench-state N  after the run, time N save state snapshots and restores\n" \
+    "  --filter NAME  upscaler: none, nearest2, nearest3, nearest4, epx, scale3x, hq2x\n" \
+    "  --screenshot FILE  write the last frame, as a 4-colour PNG if FILE ends in .png,\n" \
+    "                 otherwise through --filter as a PPM image\n" \
+    "  --dump-frames DIR  save every --dump-every N frames (default 1) to DIR as PNGs\n" \
+    "  --gif FILE     keep the last --gif-seconds S (default 10) of frames and save them\n" \
+    "                 as an animated GIF when G is pressed, or at exit when headless\n" \
+    "  --bench-scale N  time N frames through each upscaler and instruction set\n" \
+    "  --rewind S     keep S seconds of rewind history (hold R in the window), in about\n" \
+    "                 250 KB per second\n" \
+    "  --bench-rewind N  record N frames of rewind history, then step back through it\n" \
+    "  --bench-branch N  explore N input branches by fork and by snapshot/restore\n" \
+    "  --record FILE  record input to a movie from power on\n" \
+    "  --keyframes N  frames between movie keyframes (default 3600)\n" \
+    "  --play FILE    replay a movie, stopping at its end\n" \
+    "  --seek N       start playback at frame N\n" \
+    "  --checkpoints FILE  log a state hash every --checkpoint-every N frames (default 60)\n" \
+    "  --step-frame N also log every instruction of frame N\n" \
+    "  --compare A B  report where two checkpoint logs first differ, exit 2 if they do,\n" \
+    "                 no ROM needed\n" \
+    "  --golden FILE  run the manifest's frame hash checks in parallel, exit 2 on any\n" \
+    "                 failure, no ROM needed (see golden.h)\n" \
+    "  --golden-out DIR  where failing checks write their frame and diff PNGs\n" \
+    "                 (default golden-out)\n" \
+    "  --golden-bless print the manifest back with the hashes found, saving every frame\n" \
+    "  --jobs N       checks run at once (default one per CPU)\n"
 
 #define MIN_ARGC 2
 
-uint8_t emu_run;
+#define DEFAULT_CHECKPOINT_INTERVAL 60
+
+// Frames each --bench-branch branch runs
+#define BENCH_BRANCH_FRAMES 60
+
+// Rounded from 59.73, for sizing rewind and GIF history
+#define FRAMES_PER_SECOND 60
+
+#define DEFAULT_GIF_SECONDS 10
+
+#define DEFAULT_GOLDEN_OUT "golden-out"
+
+// Asked of the audio device, which may pick another
+#define DEFAULT_SAMPLE_RATE 48000
+
+typedef struct {
+    const char     *name;
+    gb_scale_filter filter;
+    uint32_t        factor;
+} filter_option;
+
+static const filter_option filters[] = {
+    { "none",     GB_SCALE_NEAREST, 1 },
+    { "nearest2", GB_SCALE_NEAREST, 2 },
+    { "nearest3", GB_SCALE_NEAREST, 3 },
+    { "nearest4", GB_SCALE_NEAREST, 4 },
+    { "epx",      GB_SCALE_EPX,     0 },
+    { "scale3x",  GB_SCALE_3X,      0 },
+    { "hq2x",     GB_SCALE_HQ2X,    0 },
+};
+
+#define FILTER_COUNT (sizeof(filters) / sizeof(filters[0]))
+
+typedef struct {
+    const char *rom_path;
+    uint8_t     headless;
+    uint64_t    frame_limit;  // 0 for no limit
+    uint8_t     serial_echo;
+    uint8_t     test_rom;
+    uint8_t     waiting;      // a stop pattern was registered
+    uint8_t     stats;
+    uint8_t     paced;        // --speed given, or running in the window
+    uint32_t    speed;
+    uint8_t     no_audio;
+    const char *audio_path;
+    uint32_t    sample_rate;
+    const char *video_path;
+    gb_record_policy video_policy;
+    uint32_t    bench_state;  // save/load iterations to time, 0 to skip
+    const filter_option *filter;
+    const char *screenshot_path;
+    const char *dump_dir;
+    uint32_t    dump_every;
+    const char *gif_path;
+    uint32_t    gif_seconds;
+    uint32_t    bench_scale;  // frames to scale per filter, 0 to skip
+    uint32_t    rewind_seconds;
+    uint32_t    bench_rewind; // frames to record and rewind, 0 to skip
+    uint32_t    bench_branch; // branches to explore, 0 to skip
+    const char *record_path;
+    uint32_t    keyframe_interval;
+    const char *play_path;
+    uint32_t    seek_frame;
+    const char *checkpoint_path;
+    uint32_t    checkpoint_interval;
+    uint32_t    step_frame;
+    const char *compare[2];
+    const char *golden_path;
+    const char *golden_out;
+    uint8_t     golden_bless;
+    uint32_t    jobs;         // 0 for one per CPU
+} emulator_options;
+
+// Index returned by gb_serial_stop_on(gb, "Failed") with --test-rom
+static int failed_pattern = SERIAL_NO_MATCH;
+
+static void usage(const char *exec_name) {
+    printf("Usage: %s %s\n%s", exec_name, USAGE, OPTIONS_HELP);
+}
+
+static gb_instance *gb;
+
+static const filter_option *find_filter(const char *name) {
+    for (uint32_t i = 0; i < FILTER_COUNT; i++) {
+        if (strcmp(filters[i].name, name) == 0) {
+            return &filters[i];
+        }
+    }
+    return NULL;
+}
+
+static uint8_t parse_args(int argc, char *argv[], emulator_options *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+    opts->step_frame = GB_CHECKPOINT_NO_STEPS;
+    opts->speed = 1;
+    opts->sample_rate = DEFAULT_SAMPLE_RATE;
+    opts->filter = &filters[0];
+    opts->dump_every = 1;
+    opts->gif_seconds = DEFAULT_GIF_SECONDS;
+    opts->golden_out = DEFAULT_GOLDEN_OUT;
+#ifdef GB_HEADLESS
+    opts->headless = 1;
+#endif
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            opts->headless = 1;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            opts->frame_limit = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--serial") == 0) {
+            opts->serial_echo = 1;
+        } else if (strcmp(argv[i], "--until") == 0 && i + 1 < argc) {
+            if (gb_serial_stop_on(gb, argv[++i]) == SERIAL_NO_MATCH) {
+                printf("[ERROR] too many --until patterns\n");
+                return 0;
+            }
+            opts->waiting = 1;
+        } else if (strcmp(argv[i], "--test-rom") == 0) {
+            opts->test_rom = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            opts->stats = 1;
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            opts->speed = strtoul(argv[++i], NULL, 10);
+            opts->paced = 1;
+        } else if (strcmp(argv[i], "--no-audio") == 0) {
+            opts->no_audio = 1;
+        } else if (strcmp(argv[i], "--audio") == 0 && i + 1 < argc) {
+            opts->audio_path = argv[++i];
+        } else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+            opts->sample_rate = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--video") == 0 && i + 1 < argc) {
+            opts->video_path = argv[++i];
+        } else if (strcmp(argv[i], "--video-drop") == 0) {
+            opts->video_policy = GB_RECORD_DROP;
+        } else if (strcmp(argv[i], "--bench-state") == 0 && i + 1 < argc) {
+            opts->bench_state = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            opts->filter = find_filter(argv[++i]);
+            if (!opts->filter) {
+                printf("[ERROR] unknown filter '%s'\n", argv[i]);
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc) {
+            opts->screenshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--dump-frames") == 0 && i + 1 < argc) {
+            opts->dump_dir = argv[++i];
+        } else if (strcmp(argv[i], "--dump-every") == 0 && i + 1 < argc) {
+            opts->dump_every = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--gif") == 0 && i + 1 < argc) {
+            opts->gif_path = argv[++i];
+        } else if (strcmp(argv[i], "--gif-seconds") == 0 && i + 1 < argc) {
+            opts->gif_seconds = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bench-scale") == 0 && i + 1 < argc) {
+            opts->bench_scale = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            opts->rewind_seconds = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bench-rewind") == 0 && i + 1 < argc) {
+            opts->bench_rewind = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bench-branch") == 0 && i + 1 < argc) {
+            opts->bench_branch = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            opts->record_path = argv[++i];
+        } else if (strcmp(argv[i], "--keyframes") == 0 && i + 1 < argc) {
+            opts->keyframe_interval = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+            opts->play_path = argv[++i];
+        } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+            opts->seek_frame = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--checkpoints") == 0 && i + 1 < argc) {
+            opts->checkpoint_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            opts->checkpoint_interval = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--step-frame") == 0 && i + 1 < argc) {
+            opts->step_frame = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+            opts->compare[0] = argv[++i];
+            opts->compare[1] = argv[++i];
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            opts->golden_path = argv[++i];
+        } else if (strcmp(argv[i], "--golden-out") == 0 && i + 1 < argc) {
+            opts->golden_out = argv[++i];
+        } else if (strcmp(argv[i], "--golden-bless") == 0) {
+            opts->golden_bless = 1;
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            opts->jobs = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] == '-') {
+            printf("Unknown option '%s'\n", argv[i]);
+            return 0;
+        } else {
+            opts->rom_path = argv[i];
+        }
+    }
+
+    if (opts->test_rom) {
+        gb_serial_stop_on(gb, "Passed");
+        failed_pattern = gb_serial_stop_on(gb, "Failed");
+        opts->waiting = 1;
+    }
+
+    if (!opts->sample_rate) {
+        printf("[ERROR] --sample-rate must be above 0\n");
+        return 0;
+    }
+
+    if (!opts->dump_every) {
+        printf("[ERROR] --dump-every must be above 0\n");
+        return 0;
+    }
+
+    if (!opts->gif_seconds) {
+        printf("[ERROR] --gif-seconds must be above 0\n");
+        return 0;
+    }
+
+    if (opts->record_path && opts->play_path) {
+        printf("[ERROR] --record and --play can't be combined\n");
+        return 0;
+    }
+
+    if (opts->audio_path && opts->video_path && strcmp(opts->audio_path, "-") == 0
+            && strcmp(opts->video_path, "-") == 0) {
+        printf("[ERROR] --audio and --video can't both write to stdout\n");
+        return 0;
+    }
+
+    if (!opts->headless) {
+        opts->paced = 1;
+    }
+
+    return opts->rom_path != NULL || opts->compare[0] != NULL || opts->golden_path != NULL;
+}
+
+// GIF saves run in the background, each finished one is reported once
+static uint32_t gif_saves_reported;
+
+static void report_gif(const char *path) {
+    gb_gif_info gif = gb_gif_get_info();
+
+    if (gif.saving || gif.saves == gif_saves_reported) {
+        return;
+    }
+    gif_saves_reported = gif.saves;
+    if (gif.ok) {
+        printf("GIF: saved %llu frames to %s as %u images, %.1f KiB, encoded in %.1f ms\n",
+            (unsigned long long) gif.saved_frames, path, gif.images, gif.bytes / 1024.0,
+            gif.encode_ns / 1e6);
+    }
+}
+
+// Run until stopped or `frame_limit` frames have completed, returning the
+// number of frames completed.
+static uint64_t run_headless(uint64_t frame_limit, uint8_t paced) {
+    uint64_t frames = 0;
+
+    while (gb_run_frame(gb)) {
+        gb_rewind_push(gb);
+        if (paced) {
+            gb_pace(gb);
+        }
+        frames++;
+        if (frames == frame_limit) {
+            break;
+        }
+    }
+    return frames;
+}
+
+static void bench_state(uint32_t iterations) {
+    uint32_t size = gb_state_size(gb);
+    uint8_t *buf = malloc(size);
+    if (!buf) {
+        printf("[ERROR] bench_state: malloc fail\n");
+        return;
+    }
+
+    uint64_t start_ns = host_time_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        gb_state_save(gb, buf, size);
+    }
+    uint64_t saved_ns = host_time_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        gb_state_load(gb, buf, size);
+    }
+    uint64_t loaded_ns = host_time_ns();
+
+    double save_us = (saved_ns - start_ns) / 1e3 / iterations;
+    double load_us = (loaded_ns - saved_ns) / 1e3 / iterations;
+    printf("State: %u bytes, save %.2f us, load %.2f us (%.0f MB/s), %.0f round trips/s\n",
+        size, save_us, load_us, size / load_us, 1e6 / (save_us + load_us));
+
+    // Incremental snapshots over one frame and over one scanline
+    uint64_t spans[2] = { GB_CYCLES_PER_FRAME, 456 };
+    uint8_t *delta = malloc(size * 2);
+    gb_dirty_tracking(gb, 1);
+    for (int span = 0; span < 2 && delta; span++) {
+        uint64_t delta_ns = 0;
+        uint64_t restore_ns = 0;
+        uint32_t delta_size = 0;
+
+        gb_state_save(gb, buf, size);
+        for (uint32_t i = 0; i < iterations; i++) {
+            gb_run_cycles(gb, spans[span]);
+            uint64_t t0 = host_time_ns();
+            delta_size = gb_state_save_delta(gb, delta, size * 2);
+            uint64_t t1 = host_time_ns();
+            gb_state_restore(gb, buf, size);
+            restore_ns += host_time_ns() - t1;
+            delta_ns += t1 - t0;
+        }
+        printf("Delta after %llu cycles: %u bytes, save %.2f us, restore %.2f us\n",
+            (unsigned long long) spans[span], delta_size,
+            delta_ns / 1e3 / iterations, restore_ns / 1e3 / iterations);
+    }
+    gb_dirty_tracking(gb, 0);
+
+    free(delta);
+    free(buf);
+}
+
+static uint8_t has_extension(const char *path, const char *ext) {
+    size_t len = strlen(path);
+    size_t ext_len = strlen(ext);
+    return len > ext_len && strcmp(path + len - ext_len, ext) == 0;
+}
+
+// Binary PPM, readable by nearly every image tool without a codec, or the
+// unscaled colour indices as a palette PNG
+static uint8_t write_screenshot(const char *path, const filter_option *f) {
+    if (has_extension(path, ".png")) {
+        return gb_png_save(gb, path);
+    }
+
+    uint32_t scale = gb_scale_factor(f->filter, f->factor);
+    uint32_t width = GB_FRAMEBUFFER_WIDTH * scale;
+    uint32_t height = GB_FRAMEBUFFER_HEIGHT * scale;
+    uint32_t *argb = malloc(width * height * sizeof(uint32_t));
+    uint8_t *rgb = malloc(width * height * 3);
+    FILE *file = NULL;
+    uint8_t ok = 0;
+
+    if (!argb || !rgb) {
+        printf("[ERROR] write_screenshot: malloc fail\n");
+        goto done;
+    }
+    gb_scale(gb_framebuffer(gb), f->filter, f->factor, NULL, argb, width * sizeof(uint32_t));
+    for (uint32_t i = 0; i < width * height; i++) {
+        rgb[i * 3]     = argb[i] >> 16;
+        rgb[i * 3 + 1] = argb[i] >> 8;
+        rgb[i * 3 + 2] = argb[i];
+    }
+
+    file = fopen(path, "wb");
+    if (!file) {
+        printf("[ERROR] write_screenshot: can't open %s\n", path);
+        goto done;
+    }
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    ok = fwrite(rgb, 1, width * height * 3, file) == width * height * 3;
+    if (fclose(file) != 0 || !ok) {
+        printf("[ERROR] write_screenshot: write to %s failed\n", path);
+        ok = 0;
+    }
+
+done:
+    free(argb);
+    free(rgb);
+    return ok;
+}
+
+static void bench_scale(uint32_t frames) {
+    uint32_t *out = malloc(GB_FRAMEBUFFER_WIDTH * GB_FRAMEBUFFER_HEIGHT * sizeof(uint32_t)
+        * SCALE_MAX_FACTOR * SCALE_MAX_FACTOR);
+    if (!out) {
+        printf("[ERROR] bench_scale: malloc fail\n");
+        return;
+    }
+
+    const uint8_t *frame = gb_framebuffer(gb);
+    for (uint32_t i = 0; i < FILTER_COUNT; i++) {
+        const filter_option *f = &filters[i];
+        uint32_t scale = gb_scale_factor(f->filter, f->factor);
+        uint32_t pitch = GB_FRAMEBUFFER_WIDTH * scale * sizeof(uint32_t);
+
+        printf("Scale %-8s %ux:", f->name, scale);
+        for (scale_isa isa = 0; isa <= scale_best_isa(); isa++) {
+            scale_use_isa(isa);
+            uint64_t start_ns = host_time_ns();
+            for (uint32_t n = 0; n < frames; n++) {
+                gb_scale(frame, f->filter, f->factor, NULL, out, pitch);
+            }
+            printf(" %s %.2f us", scale_isa_name(isa), (host_time_ns() - start_ns) / 1e3 / frames);
+        }
+        printf("\n");
+    }
+    scale_use_isa(scale_best_isa());
+    free(out);
+}
+
+static void print_record(const char *name, const checkpoint_record *r) {
+    printf("  %s: frame %u ", name, r->frame);
+    if (r->step == CHECKPOINT_FRAME_END) {
+        printf("end");
+    } else {
+        printf("step %u", r->step);
+    }
+    printf(", PC %04X, cycle %llu, hash %016llx\n", r->pc,
+        (unsigned long long) r->cycles, (unsigned long long) r->hash);
+}
+
+static int compare_logs(const char *path_a, const char *path_b) {
+    checkpoint_divergence d;
+
+    if (!checkpoint_compare(path_a, path_b, &d)) {
+        return EMU_EXIT_ERROR;
+    }
+    if (!d.diverged) {
+        printf(d.length_differs ? "Logs match until one ends\n" : "Logs match\n");
+        return EMU_EXIT_OK;
+    }
+
+    printf("Logs diverge\n");
+    print_record("last match", &d.last_match);
+    print_record("first A", &d.first_a);
+    print_record("first B", &d.first_b);
+    if (d.first_a.step != CHECKPOINT_FRAME_END) {
+        return EMU_EXIT_FAILED;
+    }
+
+    // Frame records only narrow it to the frames since the last match
+    uint32_t from = d.first_a.frame;
+    if (d.last_match.step == CHECKPOINT_FRAME_END && d.last_match.frame + 1 < from) {
+        printf("Rerun both with --checkpoint-every 1 to find the frame\n");
+    } else {
+        printf("Rerun both with --step-frame %u to find the instruction\n", from);
+    }
+    return EMU_EXIT_FAILED;
+}
+
+static int run_golden(const char *manifest, const char *out_dir, uint32_t jobs, uint8_t bless) {
+    golden_summary s;
+
+    if (!golden_run(manifest, out_dir, jobs, bless, &s)) {
+        return EMU_EXIT_ERROR;
+    }
+    double seconds = s.ns / 1e9;
+    printf("%sGolden: %u passed, %u failed, %u errors of %u checks, %llu frames in %.2f s "
+        "on %u jobs (%.0f fps)\n", bless ? "# " : "", s.passed, s.failed, s.errors, s.checks,
+        (unsigned long long) s.frames, seconds, s.jobs, seconds > 0 ? s.frames / seconds : 0.0);
+    if (!bless && (s.failed || s.errors)) {
+        printf("Frames of failing checks are in %s\n", out_dir);
+    }
+    // Blessing only fails on checks that couldn't run
+    return s.errors || (!bless && s.failed) ? EMU_EXIT_FAILED : EMU_EXIT_OK;
+}
+
+static void print_rewind_info(void) {
+    gb_rewind_info info = gb_rewind_get_info(gb);
+    double per_frame = info.frames ? info.bytes_used / (double) (info.frames + 1) : 0.0;
+    printf("Rewind: %u frames in %.1f KiB (%u keyframes), %.0f bytes/frame, "
+        "60 s needs %.2f MiB (%u byte state)\n",
+        info.frames, info.bytes_used / 1024.0, info.keyframes, per_frame,
+        per_frame * FRAMES_PER_SECOND * 60 / (1024.0 * 1024.0), info.state_bytes);
+}
+
+static void bench_rewind(uint32_t frames) {
+    if (!gb_rewind_enable(gb, frames, 0)) {
+        return;
+    }
+
+    uint64_t push_ns = 0;
+    for (uint32_t i = 0; i < frames && gb_run_frame(gb); i++) {
+        uint64_t t0 = host_time_ns();
+        gb_rewind_push(gb);
+        push_ns += host_time_ns() - t0;
+    }
+    print_rewind_info();
+
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint32_t steps = 0;
+    for (;;) {
+        uint64_t t0 = host_time_ns();
+        uint8_t stepped = gb_rewind_step_back(gb);
+        uint64_t elapsed = host_time_ns() - t0;
+        if (!stepped) {
+            break;
+        }
+        total_ns += elapsed;
+        max_ns = elapsed > max_ns ? elapsed : max_ns;
+        steps++;
+    }
+    printf("Rewind: record %.2f us/frame, step back avg %.2f us, max %.2f us over %u frames\n",
+        push_ns / 1e3 / frames, steps ? total_ns / 1e3 / steps : 0.0, max_ns / 1e3, steps);
+    gb_rewind_enable(gb, 0, 0);
+}
+
+// A branch holds a different button pattern for every frame and reports the
+// hash it ends on.
+static void explore(gb_instance *branch_gb, uint32_t branch, void *result, void *user) {
+    (void) user;
+    uint64_t hash;
+
+    for (uint32_t frame = 0; frame < BENCH_BRANCH_FRAMES; frame++) {
+        gb_set_buttons(branch_gb, (branch * 0x9E + frame) >> 3);
+        gb_run_frame(branch_gb);
+    }
+    hash = gb_state_hash(branch_gb);
+    memcpy(result, &hash, sizeof(hash));
+}
+
+static void bench_branch(uint32_t count) {
+    uint32_t size = gb_state_size(gb);
+    uint8_t *base = malloc(size);
+    uint64_t *forked = malloc(count * sizeof(uint64_t));
+    uint64_t *restored = malloc(count * sizeof(uint64_t));
+    if (!base || !forked || !restored) {
+        printf("[ERROR] bench_branch: malloc fail\n");
+        free(base);
+        free(forked);
+        free(restored);
+        return;
+    }
+
+    uint64_t start_ns = host_time_ns();
+    uint8_t ok = gb_branch(gb, count, sizeof(uint64_t), explore, NULL, forked);
+    uint64_t forked_ns = host_time_ns();
+
+    gb_state_save(gb, base, size);
+    for (uint32_t branch = 0; branch < count; branch++) {
+        gb_state_load(gb, base, size);
+        explore(gb, branch, &restored[branch], NULL);
+    }
+    gb_state_load(gb, base, size);
+    uint64_t restored_ns = host_time_ns();
+
+    uint8_t match = ok && memcmp(forked, restored, count * sizeof(uint64_t)) == 0;
+    printf("Branch: %u branches of %u frames, fork %.2f ms, snapshot/restore %.2f ms, "
+        "results %s\n", count, BENCH_BRANCH_FRAMES,
+        (forked_ns - start_ns) / 1e6, (restored_ns - forked_ns) / 1e6,
+        match ? "match" : "differ");
+
+    free(base);
+    free(forked);
+    free(restored);
+}
+
+#ifndef GB_HEADLESS
+// Host time spent per windowed frame
+typedef struct {
+    uint64_t frames;
+    uint64_t emulate_ns;      // input, emulation and rewind
+    uint64_t idle_ns;         // waiting in gb_pace() until the frame is due
+    uint64_t present_ns;      // conversion and SDL present
+    uint64_t max_busy_ns;     // worst emulate + present
+} frame_timing;
+
+static frame_timing timing;
+
+// Speeds Tab steps through
+static const uint32_t speeds[] = { 1, 2, 4, GB_SPEED_UNLIMITED };
+#define SPEED_COUNT (sizeof(speeds) / sizeof(speeds[0]))
+
+static uint32_t next_speed(uint32_t speed) {
+    for (uint32_t i = 0; i < SPEED_COUNT - 1; i++) {
+        if (speeds[i] == speed) {
+            return speeds[i + 1];
+        }
+    }
+    return speeds[0];
+}
+
+static uint64_t run_window(uint64_t frame_limit, uint32_t speed, const char *gif_path) {
+    uint32_t refresh_hz = window_refresh_hz();
+    double shown = -1.0;
+
+    gb_set_speed(gb, speed, refresh_hz);
+    for (;;) {
+        uint64_t t0 = host_time_ns();
+        if (!window_step()) {
+            break;
+        }
+        for (uint32_t presses = window_speed_presses(); presses; presses--) {
+            speed = next_speed(speed);
+            gb_set_speed(gb, speed, refresh_hz);
+        }
+        if (window_gif_requested() && gif_path) {
+            gb_gif_save(gb, gif_path);
+        }
+        if (gif_path) {
+            report_gif(gif_path);
+        }
+        if (window_rewinding()) {
+            gb_rewind_step_back(gb);
+        } else if (gb_run_frame(gb)) {
+            gb_rewind_push(gb);
+        } else {
+            break;
+        }
+        uint64_t t1 = host_time_ns();
+        uint8_t drawn = gb_pace(gb);
+        uint64_t t2 = host_time_ns();
+        if (drawn) {
+            window_draw(gb_framebuffer(gb));
+        }
+        uint64_t t3 = host_time_ns();
+
+        // The achieved speed changes twice a second, and resets with the speed
+        gb_pace_info pace = gb_pace_get_info(gb);
+        if (pace.achieved != shown) {
+            window_show_speed(pace.speed, pace.achieved);
+            shown = pace.achieved;
+        }
+
+        uint64_t busy = (t1 - t0) + (t3 - t2);
+        timing.emulate_ns += t1 - t0;
+        timing.idle_ns += t2 - t1;
+        timing.present_ns += t3 - t2;
+        timing.max_busy_ns = busy > timing.max_busy_ns ? busy : timing.max_busy_ns;
+        timing.frames++;
+        if (timing.frames == frame_limit) {
+            break;
+        }
+    }
+    return timing.frames;
+}
+
+static void print_frame_timing(void) {
+    double frames = timing.frames ? (double) timing.frames : 1.0;
+    printf("Frame time: emulate %.2f ms, idle %.2f ms, present %.2f ms, worst busy %.2f ms\n",
+        timing.emulate_ns / 1e6 / frames, timing.idle_ns / 1e6 / frames,
+        timing.present_ns / 1e6 / frames, timing.max_busy_ns / 1e6);
+
+    window_upload_stats upload = window_get_upload_stats();
+    if (upload.frames) {
+        printf("Texture upload: avg %.2f us, max %.2f us over %llu frames\n",
+            upload.total_ns / 1e3 / upload.frames, upload.max_ns / 1e3,
+            (unsigned long long) upload.frames);
+    }
+}
+#endif
+
+static void print_audio_info(void) {
+    gb_audio_info audio = gb_audio_get_info();
+    printf("Audio: %u Hz, %u frames queued, rate x%.4f, %llu produced, %llu dropped, "
+        "%llu underrun, %llu recorded, %llu writer stalls\n", audio.sample_rate,
+        audio.buffered, audio.rate_ratio, (unsigned long long) audio.produced,
+        (unsigned long long) audio.dropped, (unsigned long long) audio.underruns,
+        (unsigned long long) audio.recorded, (unsigned long long) audio.record_stalls);
+}
+
+static void print_video_info(void) {
+    gb_video_info video = gb_video_get_info();
+    printf("Video: %llu frames, %llu unique, %llu dropped, %llu writer stalls, %.1f MiB\n",
+        (unsigned long long) video.frames, (unsigned long long) video.unique,
+        (unsigned long long) video.dropped, (unsigned long long) video.stalls,
+        video.bytes / (1024.0 * 1024.0));
+}
+
+static void print_dump_info(void) {
+    gb_frame_dump_info dump = gb_frame_dump_get_info();
+    printf("Dump: %llu frames, %llu unique, %llu writer stalls, %.1f KiB\n",
+        (unsigned long long) dump.frames, (unsigned long long) dump.unique,
+        (unsigned long long) dump.stalls, dump.bytes / 1024.0);
+}
+
+// Capture output file, "-" for stdout. The capture then keeps the real
+// stdout to itself and everything else printed, --stats, --serial and errors
+// included, goes to stderr instead.
+static FILE *open_output(const char *path) {
+    if (strcmp(path, "-") == 0) {
+        fflush(stdout);
+        int fd = dup(STDOUT_FILENO);
+        if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            printf("[ERROR] can't redirect stdout\n");
+            return NULL;
+        }
+        return fdopen(fd, "wb");
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("[ERROR] can't open %s\n", path);
+    }
+    return file;
+}
+
+static uint8_t close_output(FILE *file) {
+    return fclose(file) == 0;
+}
+
+static FILE *audio_file;
+static FILE *video_file;
+
+static uint8_t start_audio_record(const char *path, uint32_t sample_rate) {
+    gb_audio_format format = has_extension(path, ".wav") ? GB_AUDIO_WAV : GB_AUDIO_RAW;
+
+    audio_file = open_output(path);
+    return audio_file && gb_audio_record(gb, fileno(audio_file), sample_rate, format);
+}
+
+static uint8_t stop_audio_record(const char *path) {
+    gb_audio_info audio = gb_audio_get_info();
+    uint8_t ok = gb_audio_record_stop(gb);
+
+    ok &= close_output(audio_file);
+    if (ok) {
+        printf("Audio: recorded %.2f s to %s\n",
+            (double) gb_audio_get_info().recorded / audio.sample_rate, path);
+    }
+    return ok;
+}
+
+static uint8_t start_video_record(const char *path, gb_record_policy policy) {
+    gb_video_format format = has_extension(path, ".y4m") ? GB_VIDEO_Y4M : GB_VIDEO_RGB24;
+
+    video_file = open_output(path);
+    return video_file && gb_video_record(gb, fileno(video_file), format, policy);
+}
+
+static uint8_t stop_video_record(const char *path) {
+    uint8_t ok = gb_video_record_stop(gb);
+
+    ok &= close_output(video_file);
+    if (ok) {
+        printf("Video: recorded %llu frames to %s\n",
+            (unsigned long long) gb_video_get_info().frames, path);
+    }
+    return ok;
+}
+
+static void print_pace_info(void) {
+    gb_pace_info pace = gb_pace_get_info(gb);
+    if (pace.speed == GB_SPEED_UNLIMITED) {
+        printf("Pacing: unlimited");
+    } else {
+        printf("Pacing: %ux", pace.speed);
+    }
+    printf(", achieved %.2fx, %llu late, %llu frames not drawn\n", pace.achieved,
+        (unsigned long long) pace.late, (unsigned long long) pace.skipped);
+}
 
 int emulator_run(int argc, char *argv[]) {
+    uint64_t start_ns = host_time_ns();
+    emulator_options opts;
+    int status = EMU_EXIT_ERROR;
+#ifndef GB_HEADLESS
+    uint8_t window_open = 0;
+#endif
 
-    if (argc < MIN_ARGC) {
+    gb = gb_create();
+    if (!gb) {
+        printf("[ERROR] emulator_run: can't create the emulator\n");
+        goto done;
+    }
+    if (argc < MIN_ARGC || !parse_args(argc, argv, &opts)) {
         printf("Incorrect args\n");
-        printf("Usage: %s %s\n", argv[0], USAGE);
-        return 1;
+        usage(argv[0]);
+        goto done;
+    }
+    if (opts.compare[0]) {
+        gb_destroy(gb);
+        return compare_logs(opts.compare[0], opts.compare[1]);
+    }
+    if (opts.golden_path) {
+        gb_destroy(gb);
+        return run_golden(opts.golden_path, opts.golden_out, opts.jobs, opts.golden_bless);
     }
 
-    if (!cartridge_rom_load(argv[1])) {
+    if (!gb_load_rom(gb, opts.rom_path)) {
         printf("Failed to load ROM\nExiting\n");
-        return 1;
+        goto done;
     }
 
-    if (!window_init()) {
-        return 1;
+#ifndef GB_HEADLESS
+    if (!opts.headless) {
+        if (!window_init(opts.filter->filter, opts.filter->factor)) {
+            goto done;
+        }
+        window_open = 1;
+    }
+    if (!opts.headless && !opts.no_audio) {
+        uint32_t sample_rate = window_audio_open(opts.sample_rate);
+        if (sample_rate) {
+            gb_audio_enable(gb, sample_rate);
+            window_audio_start();
+        }
     }
+#endif
 
-    cpu_init();
-    ppu_init();
-    emu_run = 1;
+    if (opts.serial_echo) {
+        gb_serial_capture(gb, stdout);
+    }
+    if (opts.play_path && (!gb_movie_play(gb, opts.play_path)
+            || (opts.seek_frame && !gb_movie_seek(gb, opts.seek_frame)))) {
+        goto done;
+    }
+    if (opts.record_path && !gb_movie_record(gb, opts.record_path, opts.keyframe_interval)) {
+        goto done;
+    }
+    if (opts.checkpoint_path && !gb_checkpoint_log(gb, opts.checkpoint_path,
+            opts.checkpoint_interval, opts.step_frame)) {
+        goto done;
+    }
+    if (opts.rewind_seconds
+            && !gb_rewind_enable(gb, opts.rewind_seconds * FRAMES_PER_SECOND, 0)) {
+        goto done;
+    }
+    if (opts.audio_path && !start_audio_record(opts.audio_path, opts.sample_rate)) {
+        goto done;
+    }
+    if (opts.video_path && !start_video_record(opts.video_path, opts.video_policy)) {
+        goto done;
+    }
+    if (opts.dump_dir && !gb_frame_dump(gb, opts.dump_dir, opts.dump_every)) {
+        goto done;
+    }
+    if (opts.gif_path && !gb_gif_history(gb, opts.gif_seconds * FRAMES_PER_SECOND)) {
+        goto done;
+    }
 
-    while (emu_run) {        
-        cpu_step();
-        ppu_step();
-        window_step();
-        
-        if (ppu_view_updated) {
-            window_draw();
-            ppu_view_updated = 0;
+    uint64_t run_ns = host_time_ns();
+    uint64_t frames;
+#ifndef GB_HEADLESS
+    if (!opts.headless) {
+        frames = run_window(opts.frame_limit, opts.speed, opts.gif_path);
+    } else
+#endif
+    {
+        if (opts.paced) {
+            gb_set_speed(gb, opts.speed, 0);
         }
+        frames = run_headless(opts.frame_limit, opts.paced);
     }
+    uint64_t end_ns = host_time_ns();
 
-    window_exit();
-    return 0;
+    if (opts.stats) {
+        double seconds = (end_ns - run_ns) / 1e9;
+        printf("Startup: %.1f us\n", (run_ns - start_ns) / 1e3);
+        printf("Ran %llu frames, %llu cycles in %.3f s (%.1f fps)\n",
+            (unsigned long long) frames, (unsigned long long) gb_cycles(gb),
+            seconds, seconds > 0 ? frames / seconds : 0.0);
+        printf("State hash: %016llx\n", (unsigned long long) gb_state_hash(gb));
+        printf("Frame hash: %016llx\n", (unsigned long long) gb_framebuffer_hash(gb));
+#ifndef GB_HEADLESS
+        if (!opts.headless) {
+            print_frame_timing();
+        }
+#endif
+        if (opts.paced) {
+            print_pace_info();
+        }
+        if (gb_audio_get_info().sample_rate) {
+            print_audio_info();
+        }
+    }
+
+    if (opts.screenshot_path && !write_screenshot(opts.screenshot_path, opts.filter)) {
+        goto done;
+    }
+    if (opts.bench_state) {
+        bench_state(opts.bench_state);
+    }
+    if (opts.bench_scale) {
+        bench_scale(opts.bench_scale);
+    }
+    if (opts.play_path && opts.stats) {
+        printf("Movie: played to frame %u of %u\n", gb_movie_frame(gb), gb_movie_length(gb));
+    }
+    if (opts.record_path) {
+        printf("Movie: recorded %u frames to %s\n", gb_movie_frame(gb), opts.record_path);
+    }
+    if (!gb_movie_close(gb) || !gb_checkpoint_close(gb)) {
+        goto done;
+    }
+    if (opts.audio_path && !stop_audio_record(opts.audio_path)) {
+        goto done;
+    }
+    if (opts.video_path && !stop_video_record(opts.video_path)) {
+        goto done;
+    }
+    if (opts.dump_dir && !gb_frame_dump_stop(gb)) {
+        goto done;
+    }
+    if (opts.gif_path) {
+        uint8_t saved = !opts.headless || gb_gif_save(gb, opts.gif_path);
+
+        // Waits for the save
+        gb_gif_history(gb, 0);
+        report_gif(opts.gif_path);
+        if (!saved || (opts.headless && !gb_gif_get_info().ok)) {
+            goto done;
+        }
+    }
+    // After the writers have drained, so the byte counts are final
+    if (opts.video_path && opts.stats) {
+        print_video_info();
+    }
+    if (opts.dump_dir) {
+        printf("Dump: saved %llu frames to %s\n",
+            (unsigned long long) gb_frame_dump_get_info().frames, opts.dump_dir);
+        if (opts.stats) {
+            print_dump_info();
+        }
+    }
+    if (opts.rewind_seconds && opts.stats) {
+        print_rewind_info();
+    }
+    if (opts.bench_rewind) {
+        bench_rewind(opts.bench_rewind);
+    }
+    if (opts.bench_branch) {
+        bench_branch(opts.bench_branch);
+    }
+
+    joypad_latency latency = joypad_latency_stats();
+    if (latency.count) {
+        printf("Input latency: avg %.2f ms, max %.2f ms over %llu events\n",
+            latency.total_ns / (double) latency.count / 1e6,
+            latency.max_ns / 1e6, (unsigned long long) latency.count);
+    }
+
+    int matched = gb_serial_matched(gb);
+    if (matched != SERIAL_NO_MATCH) {
+        status = matched == failed_pattern ? EMU_EXIT_FAILED : EMU_EXIT_OK;
+    } else {
+        status = opts.waiting ? EMU_EXIT_TIMEOUT : EMU_EXIT_OK;
+    }
+
+    // Every exit once the emulator exists, so the window and recordings are
+    // always shut down
+done:
+#ifndef GB_HEADLESS
+    if (window_open) {
+        window_exit();
+    }
+#endif
+    gb_destroy(gb);
+    return status;
 }
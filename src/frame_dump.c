@@ -0,0 +1,98 @@
+#include "frame_dump.h"
+#include "host_io.h"
+#include "png.h"
+#include "scale.h"
+
+#include <string.h>
+
+#define PNG_FRAME_SIZE PNG_MAX_SIZE(GB_SCREEN_RES_X, GB_SCREEN_RES_Y)
+
+#define DUMP_PATH_MAX 4096
+
+static struct {
+    recorder        *recorder;
+    char             dir[DUMP_PATH_MAX];
+    uint32_t         every;
+    uint32_t         countdown;       // frames until the next one is pushed
+    uint8_t          encoded[PNG_FRAME_SIZE];
+    uint32_t         encoded_size;
+    uint64_t         bytes;
+    recorder_stats   last_stats;      // kept once the recorder is gone
+} dump;
+
+// Writer thread. A repeat is the last encoded file under the next name.
+static uint8_t write_frame(void *user, const uint8_t *indices, uint64_t index) {
+    char path[DUMP_PATH_MAX + 32];
+    (void) user;
+
+    if (indices) {
+        dump.encoded_size = png_encode(indices, GB_SCREEN_RES_X, GB_SCREEN_RES_Y,
+            scale_grey_palette, dump.encoded, sizeof(dump.encoded));
+    }
+    snprintf(path, sizeof(path), "%s/frame_%06llu.png", dump.dir,
+        (unsigned long long) (index + 1) * dump.every);
+    __atomic_store_n(&dump.bytes, dump.bytes + dump.encoded_size, __ATOMIC_RELAXED);
+    return host_write_file(path, dump.encoded, dump.encoded_size);
+}
+
+uint8_t frame_dump_open(const char *dir, uint32_t every) {
+    if (dump.recorder) {
+        printf("[ERROR] frame_dump_open: already dumping\n");
+        return 0;
+    }
+    if (!every || strlen(dir) >= sizeof(dump.dir)) {
+        printf("[ERROR] frame_dump_open: bad arguments\n");
+        return 0;
+    }
+    strcpy(dump.dir, dir);
+    dump.every = every;
+    dump.countdown = every;
+    dump.bytes = 0;
+    memset(&dump.last_stats, 0, sizeof(dump.last_stats));
+
+    recorder_sink sink = { write_frame, NULL };
+    dump.recorder = recorder_start(sink, GB_RECORD_BLOCK);
+    return dump.recorder != NULL;
+}
+
+uint8_t frame_dump_recording(void) {
+    return dump.recorder != NULL;
+}
+
+void frame_dump_push(const uint8_t *framebuffer) {
+    if (--dump.countdown) {
+        return;
+    }
+    dump.countdown = dump.every;
+    recorder_push(dump.recorder, framebuffer);
+}
+
+uint8_t frame_dump_close(void) {
+    if (!dump.recorder) {
+        return 1;
+    }
+    dump.last_stats = recorder_get_stats(dump.recorder);
+    uint8_t ok = recorder_stop(dump.recorder);
+    dump.recorder = NULL;
+    return ok;
+}
+
+void frame_dump_detach(void) {
+    dump.recorder = NULL;
+}
+
+frame_dump_stats frame_dump_get_stats(void) {
+    frame_dump_stats stats = {
+        dump.recorder ? recorder_get_stats(dump.recorder) : dump.last_stats,
+        __atomic_load_n(&dump.bytes, __ATOMIC_RELAXED),
+    };
+    return stats;
+}
+
+uint8_t frame_dump_save(const char *path, const uint8_t *framebuffer) {
+    uint8_t png[PNG_FRAME_SIZE];
+    uint32_t size = png_encode(framebuffer, GB_SCREEN_RES_X, GB_SCREEN_RES_Y,
+        scale_grey_palette, png, sizeof(png));
+
+    return size && host_write_file(path, png, size);
+}
@@ -0,0 +1,670 @@
+// posix_memalign
+#define _POSIX_C_SOURCE 200112L
+
+#include "gb.h"
+#include "common.h"
+#include "apu.h"
+#include "audio.h"
+#include "audio_file.h"
+#include "branch.h"
+#include "bus.h"
+#include "cartridge.h"
+#include "checkpoint.h"
+#include "cpu.h"
+#include "dma.h"
+#include "frame_dump.h"
+#include "gif_capture.h"
+#include "hash.h"
+#include "io.h"
+#include "joypad.h"
+#include "machine.h"
+#include "movie.h"
+#include "pacer.h"
+#include "ppu.h"
+#include "rewind.h"
+#include "scale.h"
+#include "scheduler.h"
+#include "serial.h"
+#include "state.h"
+#include "timer.h"
+#include "video.h"
+
+#include <string.h>
+
+uint8_t emu_run;
+uint32_t emu_until;
+
+static uint8_t stop_reason;
+// Every reason that fired during the last run as 1 << reason, several can
+// land on the same cycle
+static uint32_t stops;
+
+gb_machine *machine;
+
+// The machine comes first, so an instance is one page-aligned allocation
+struct gb_instance {
+    gb_machine machine;
+    uint8_t    rom_loaded;
+    uint8_t    owns_rom;    // clones share the ROM of the instance they came from
+    pacer      pace;
+};
+
+static uint32_t instance_count;
+
+// The instance audio output follows
+static gb_instance *audio_instance;
+static gb_instance *video_instance;
+static gb_instance *dump_instance;
+static gb_instance *gif_instance;
+
+// Point the modules at `gb`'s machine, done by every entry point
+static void use(gb_instance *gb) {
+    machine = &gb->machine;
+}
+
+void emu_stop(uint8_t reason) {
+    stops |= 1u << reason;
+    if (emu_run) {
+        emu_run = 0;
+        stop_reason = reason;
+    }
+}
+
+static void on_run_limit(void) {
+    emu_stop(GB_STOP_CYCLES);
+}
+
+static gb_instance *allocate(void) {
+    void *p;
+
+    if (posix_memalign(&p, MACHINE_PAGE_SIZE, sizeof(gb_instance)) != 0) {
+        printf("[ERROR] gb_create: malloc fail\n");
+        return NULL;
+    }
+    instance_count++;
+    return p;
+}
+
+gb_instance *gb_create(void) {
+    gb_instance *gb = allocate();
+    if (!gb) {
+        return NULL;
+    }
+
+    memset(gb, 0, sizeof(*gb));
+    gb->owns_rom = 1;
+    pacer_init(&gb->pace, 1, 0);
+    gb_reset(gb);
+    return gb;
+}
+
+gb_instance *gb_clone(gb_instance *gb) {
+    gb_instance *clone = allocate();
+    if (!clone) {
+        return NULL;
+    }
+
+    memcpy(clone, gb, sizeof(*clone));
+    clone->owns_rom = 0;
+    clone->machine.apu.output = 0;
+    return clone;
+}
+
+size_t gb_instance_size(void) {
+    return sizeof(gb_instance);
+}
+
+void gb_destroy(gb_instance *gb) {
+    use(gb);
+    if (gb->owns_rom) {
+        cartridge_cleanup();
+    }
+    if (gb == audio_instance) {
+        audio_instance = NULL;
+        audio_file_close();
+        audio_init(0);
+    }
+    if (gb == video_instance) {
+        video_instance = NULL;
+        video_close();
+    }
+    if (gb == dump_instance) {
+        dump_instance = NULL;
+        frame_dump_close();
+    }
+    if (gb == gif_instance) {
+        gif_instance = NULL;
+        gif_capture_init(0);
+    }
+
+    // Movies, checkpoint logs and rewind are per process
+    if (--instance_count == 0) {
+        movie_close();
+        checkpoint_close();
+        rewind_free();
+    }
+    machine = NULL;
+    free(gb);
+}
+
+// A clone loading its own ROM must leave the shared one alone
+static void take_rom(gb_instance *gb) {
+    use(gb);
+    if (!gb->owns_rom) {
+        machine->cartridge.rom = NULL;
+        gb->owns_rom = 1;
+    }
+}
+
+uint8_t gb_load_rom(gb_instance *gb, const char *path) {
+    take_rom(gb);
+    gb->rom_loaded = cartridge_rom_load(path);
+    gb_reset(gb);
+    return gb->rom_loaded;
+}
+
+uint8_t gb_load_rom_from_memory(gb_instance *gb, const uint8_t *rom, uint32_t size) {
+    take_rom(gb);
+    gb->rom_loaded = cartridge_rom_load_from_memory(rom, size);
+    gb_reset(gb);
+    return gb->rom_loaded;
+}
+
+void gb_reset(gb_instance *gb) {
+    use(gb);
+    movie_close();
+    scheduler_init();
+    bus_init();
+    io_init();
+    cpu_init();
+    ppu_init();
+    timer_init();
+    dma_init();
+    joypad_init();
+    serial_init();
+    apu_init();
+    scheduler_register(SCHED_RUN_LIMIT, on_run_limit);
+    rewind_reset();
+}
+
+gb_stop_reason gb_run_until(gb_instance *gb, const gb_until *until) {
+    use(gb);
+    if (!gb->rom_loaded) {
+        return GB_STOP_NONE;
+    }
+
+    emu_until = until->conditions;
+    bus_watch_addr = until->write_addr;
+    cpu_watch_pc = until->pc;
+    cpu_watch_interrupts = until->interrupts;
+    if (emu_until & GB_UNTIL_CYCLES) {
+        if (!until->cycles) {
+            return GB_STOP_CYCLES;
+        }
+        scheduler_schedule(SCHED_RUN_LIMIT, scheduler_now() + until->cycles);
+    }
+
+    // Every condition ends the run through emu_stop(), so this is the only
+    // check made per cycle
+    stop_reason = GB_STOP_NONE;
+    stops = 0;
+    emu_run = 1;
+    while (emu_run) {
+        scheduler_step();
+        cpu_step();
+        ppu_step();
+    }
+
+    scheduler_cancel(SCHED_RUN_LIMIT);
+    emu_until = 0;
+    return stop_reason;
+}
+
+uint8_t gb_run_frame(gb_instance *gb) {
+    use(gb);
+    gb_until until = { .conditions = GB_UNTIL_FRAME };
+
+    if (!gb->rom_loaded) {
+        return 0;
+    }
+    // Playback ends the run once the movie is out of frames
+    if (!movie_frame()) {
+        return 0;
+    }
+    if (checkpoint_stepping()) {
+        until.conditions |= GB_UNTIL_STEP;
+    }
+
+    while (gb_run_until(gb, &until) == GB_STOP_STEP) {
+        checkpoint_step(cpu_pc());
+        if (stops & (1u << GB_STOP_FRAME)) {
+            break;
+        }
+    }
+    if (!(stops & (1u << GB_STOP_FRAME))) {
+        return 0;
+    }
+    if (gb == audio_instance && audio_active()) {
+        apu_frame_end();
+    }
+    if (gb == video_instance && video_recording()) {
+        video_push(gb_framebuffer(gb));
+    }
+    if (gb == dump_instance && frame_dump_recording()) {
+        frame_dump_push(gb_framebuffer(gb));
+    }
+    if (gb == gif_instance && gif_capture_enabled()) {
+        gif_capture_push(gb_framebuffer(gb));
+    }
+    checkpoint_frame_done(cpu_pc());
+    return 1;
+}
+
+uint64_t gb_run_cycles(gb_instance *gb, uint64_t cycles) {
+    gb_until until = { .conditions = GB_UNTIL_CYCLES, .cycles = cycles };
+
+    use(gb);
+    uint64_t start = scheduler_now();
+
+    gb_run_until(gb, &until);
+    return scheduler_now() - start;
+}
+
+uint64_t gb_cycles(gb_instance *gb) {
+    use(gb);
+    return scheduler_now();
+}
+
+void gb_set_buttons(gb_instance *gb, uint8_t buttons) {
+    use(gb);
+    joypad_set_buttons(buttons);
+}
+
+uint32_t gb_scale_factor(gb_scale_filter filter, uint32_t factor) {
+    return scale_factor(filter, factor);
+}
+
+void gb_scale(const uint8_t *framebuffer, gb_scale_filter filter, uint32_t factor,
+        const uint32_t *palette, uint32_t *dst, uint32_t pitch) {
+    scale_frame(filter, factor, framebuffer, palette ? palette : scale_grey_palette, dst, pitch);
+}
+
+const uint8_t *gb_framebuffer(gb_instance *gb) {
+    uint8_t front = __atomic_load_n(&gb->machine.ppu.front, __ATOMIC_ACQUIRE);
+    return gb->machine.framebuffer[front];
+}
+
+uint64_t gb_framebuffer_hash(gb_instance *gb) {
+    return hash_bytes(gb_framebuffer(gb), GB_FRAMEBUFFER_WIDTH * GB_FRAMEBUFFER_HEIGHT, 0);
+}
+
+uint8_t gb_peek(gb_instance *gb, uint16_t addr) {
+    use(gb);
+    return bus_read(addr);
+}
+
+void gb_poke(gb_instance *gb, uint16_t addr, uint8_t value) {
+    use(gb);
+    bus_write(addr, value);
+}
+
+uint32_t gb_state_size(gb_instance *gb) {
+    use(gb);
+    return state_size();
+}
+
+uint32_t gb_state_save(gb_instance *gb, uint8_t *buf, uint32_t size) {
+    uint32_t needed = gb_state_size(gb);
+    if (size < needed) {
+        return 0;
+    }
+    state_save(buf);
+    state_set_base();
+    return needed;
+}
+
+uint8_t gb_state_load(gb_instance *gb, const uint8_t *buf, uint32_t size) {
+    use(gb);
+    if (!state_load(buf, size)) {
+        return 0;
+    }
+    state_set_base();
+    return 1;
+}
+
+void gb_dirty_tracking(gb_instance *gb, uint8_t enable) {
+    use(gb);
+    state_set_dirty_tracking(enable);
+}
+
+uint8_t gb_state_restore(gb_instance *gb, const uint8_t *base, uint32_t size) {
+    use(gb);
+    return state_restore(base, size);
+}
+
+uint32_t gb_state_delta_size(gb_instance *gb) {
+    use(gb);
+    return state_delta_size();
+}
+
+uint32_t gb_state_save_delta(gb_instance *gb, uint8_t *buf, uint32_t size) {
+    use(gb);
+    return state_save_delta(buf, size);
+}
+
+uint8_t gb_state_load_delta(gb_instance *gb, const uint8_t *base, uint32_t base_size,
+        const uint8_t *delta, uint32_t delta_size) {
+    use(gb);
+    return state_load_delta(base, base_size, delta, delta_size);
+}
+
+uint64_t gb_state_hash(gb_instance *gb) {
+    use(gb);
+    return state_hash();
+}
+
+uint8_t gb_checkpoint_log(gb_instance *gb, const char *path, uint32_t interval,
+        uint32_t step_frame) {
+    use(gb);
+    return checkpoint_open(path, interval, step_frame);
+}
+
+uint8_t gb_checkpoint_close(gb_instance *gb) {
+    use(gb);
+    return checkpoint_close();
+}
+
+void gb_set_speed(gb_instance *gb, uint32_t speed, uint32_t refresh_hz) {
+    use(gb);
+    pacer_init(&gb->pace, speed, refresh_hz);
+    ppu_skip_pixels(0);
+    // Frames run faster than the samples are played
+    audio_set_muted(speed != 1);
+}
+
+uint32_t gb_speed(gb_instance *gb) {
+    return gb->pace.speed;
+}
+
+uint8_t gb_pace(gb_instance *gb) {
+    use(gb);
+    uint8_t drew = pacer_frame(&gb->pace);
+    // A recorder takes every frame, so pixels are only skipped without one.
+    // The pacer still picks the frames worth presenting.
+    uint8_t skip = !gb->pace.drawing && gb != video_instance && gb != dump_instance
+        && gb != gif_instance;
+    ppu_skip_pixels(skip);
+    gb->pace.skipped += skip;
+    return drew;
+}
+
+gb_pace_info gb_pace_get_info(gb_instance *gb) {
+    gb_pace_info info = { gb->pace.speed, gb->pace.achieved, gb->pace.late,
+        gb->pace.skipped };
+    return info;
+}
+
+// Make `gb` the instance synthesising audio
+static void take_audio(gb_instance *gb) {
+    if (audio_instance && audio_instance != gb) {
+        audio_instance->machine.apu.output = 0;
+    }
+    audio_instance = gb;
+    use(gb);
+    apu_output(1);
+}
+
+static void release_audio(void) {
+    if (audio_instance) {
+        audio_instance->machine.apu.output = 0;
+    }
+    audio_instance = NULL;
+    audio_init(0);
+}
+
+uint8_t gb_audio_enable(gb_instance *gb, uint32_t sample_rate) {
+    uint32_t rate = audio_get_stats().sample_rate;
+
+    if (!audio_file_recording()) {
+        if (!sample_rate) {
+            release_audio();
+            return 1;
+        }
+        take_audio(gb);
+        audio_init(sample_rate);
+    } else if (sample_rate && (gb != audio_instance || sample_rate != rate)) {
+        printf("[ERROR] gb_audio_enable: another instance or rate is recording\n");
+        return 0;
+    }
+    audio_set_playback(sample_rate != 0);
+    return 1;
+}
+
+uint8_t gb_audio_record(gb_instance *gb, int fd, uint32_t sample_rate, gb_audio_format format) {
+    if (audio_file_recording()) {
+        printf("[ERROR] gb_audio_record: already recording\n");
+        return 0;
+    }
+    if (audio_playback()) {
+        if (gb != audio_instance) {
+            printf("[ERROR] gb_audio_record: another instance is playing\n");
+            return 0;
+        }
+        sample_rate = audio_get_stats().sample_rate;
+    } else {
+        take_audio(gb);
+        audio_init(sample_rate);
+    }
+    if (!audio_file_open(fd, sample_rate, format)) {
+        if (!audio_playback()) {
+            release_audio();
+        }
+        return 0;
+    }
+    return 1;
+}
+
+uint8_t gb_audio_record_stop(gb_instance *gb) {
+    if (gb != audio_instance || !audio_file_recording()) {
+        return 1;
+    }
+    // Samples since the last frame end go out too
+    use(gb);
+    apu_frame_end();
+    uint8_t ok = audio_file_close();
+    if (!audio_playback()) {
+        release_audio();
+    }
+    return ok;
+}
+
+uint32_t gb_audio_read(int16_t *frames, uint32_t count) {
+    return audio_read(frames, count);
+}
+
+gb_audio_info gb_audio_get_info(void) {
+    audio_stats stats = audio_get_stats();
+    audio_file_stats file = audio_file_get_stats();
+    gb_audio_info info = { stats.sample_rate, stats.buffered, stats.rate_ratio,
+        stats.produced, stats.dropped, stats.underruns, file.frames, file.stalls };
+    return info;
+}
+
+uint8_t gb_video_record(gb_instance *gb, int fd, gb_video_format format,
+        gb_record_policy policy) {
+    if (!video_open(fd, format, policy)) {
+        return 0;
+    }
+    video_instance = gb;
+    // The next frame may already have been picked to skip
+    use(gb);
+    ppu_skip_pixels(0);
+    return 1;
+}
+
+uint8_t gb_video_record_stop(gb_instance *gb) {
+    if (gb != video_instance) {
+        return 1;
+    }
+    video_instance = NULL;
+    return video_close();
+}
+
+gb_video_info gb_video_get_info(void) {
+    video_stats stats = video_get_stats();
+    gb_video_info info = { stats.frames.frames, stats.frames.unique, stats.frames.dropped,
+        stats.frames.stalls, stats.bytes };
+    return info;
+}
+
+uint8_t gb_png_save(gb_instance *gb, const char *path) {
+    return frame_dump_save(path, gb_framebuffer(gb));
+}
+
+uint8_t gb_frame_dump(gb_instance *gb, const char *dir, uint32_t every) {
+    if (!frame_dump_open(dir, every)) {
+        return 0;
+    }
+    dump_instance = gb;
+    use(gb);
+    ppu_skip_pixels(0);
+    return 1;
+}
+
+uint8_t gb_frame_dump_stop(gb_instance *gb) {
+    if (gb != dump_instance) {
+        return 1;
+    }
+    dump_instance = NULL;
+    return frame_dump_close();
+}
+
+gb_frame_dump_info gb_frame_dump_get_info(void) {
+    frame_dump_stats stats = frame_dump_get_stats();
+    gb_frame_dump_info info = { stats.frames.frames, stats.frames.unique, stats.frames.stalls,
+        stats.bytes };
+    return info;
+}
+
+uint8_t gb_gif_history(gb_instance *gb, uint32_t frames) {
+    if (gif_instance && gb != gif_instance) {
+        printf("[ERROR] gb_gif_history: another instance is capturing\n");
+        return 0;
+    }
+    gif_instance = NULL;
+    if (!gif_capture_init(frames)) {
+        return 0;
+    }
+    gif_instance = frames ? gb : NULL;
+    use(gb);
+    ppu_skip_pixels(0);
+    return 1;
+}
+
+uint8_t gb_gif_save(gb_instance *gb, const char *path) {
+    if (gb != gif_instance) {
+        printf("[ERROR] gb_gif_save: no history, see gb_gif_history()\n");
+        return 0;
+    }
+    return gif_capture_save(path);
+}
+
+gb_gif_info gb_gif_get_info(void) {
+    gif_capture_stats stats = gif_capture_get_stats();
+    gb_gif_info info = { stats.frames, stats.saving, stats.saves, stats.ok, stats.saved_frames,
+        stats.images, stats.bytes, stats.encode_ns };
+    return info;
+}
+
+uint8_t gb_rewind_enable(gb_instance *gb, uint32_t frames, uint32_t arena_bytes) {
+    use(gb);
+    if (!frames) {
+        rewind_free();
+        return 1;
+    }
+    return rewind_init(frames, arena_bytes);
+}
+
+void gb_rewind_push(gb_instance *gb) {
+    use(gb);
+    rewind_push();
+}
+
+uint8_t gb_rewind_step_back(gb_instance *gb) {
+    use(gb);
+    return rewind_step_back();
+}
+
+gb_rewind_info gb_rewind_get_info(gb_instance *gb) {
+    use(gb);
+    rewind_stats stats = rewind_get_stats();
+    gb_rewind_info info = { stats.frames, stats.keyframes, stats.bytes_used,
+        stats.arena_bytes, stats.state_bytes };
+    return info;
+}
+
+uint8_t gb_movie_record(gb_instance *gb, const char *path, uint32_t keyframe_interval) {
+    use(gb);
+    return gb->rom_loaded && movie_record(path, keyframe_interval);
+}
+
+uint8_t gb_movie_play(gb_instance *gb, const char *path) {
+    use(gb);
+    return gb->rom_loaded && movie_play(path);
+}
+
+uint8_t gb_movie_seek(gb_instance *gb, uint32_t frame) {
+    use(gb);
+    uint32_t keyframe;
+
+    if (!movie_seek_keyframe(frame, &keyframe)) {
+        return 0;
+    }
+    for (; keyframe < frame; keyframe++) {
+        if (!gb_run_frame(gb)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint32_t gb_movie_frame(gb_instance *gb) {
+    use(gb);
+    return movie_current_frame();
+}
+
+uint32_t gb_movie_length(gb_instance *gb) {
+    use(gb);
+    return movie_length();
+}
+
+uint8_t gb_movie_close(gb_instance *gb) {
+    use(gb);
+    return movie_close();
+}
+
+uint8_t gb_branch(gb_instance *gb, uint32_t count, uint32_t result_size,
+        gb_branch_fn fn, void *user, void *results) {
+    use(gb);
+    return gb->rom_loaded && branch_run(gb, count, result_size, fn, user, results);
+}
+
+void gb_serial_capture(gb_instance *gb, FILE *stream) {
+    use(gb);
+    serial_capture(stream);
+}
+
+int gb_serial_stop_on(gb_instance *gb, const char *pattern) {
+    use(gb);
+    return serial_stop_on(pattern);
+}
+
+int gb_serial_matched(gb_instance *gb) {
+    use(gb);
+    return serial_matched();
+}
+
+const uint8_t *gb_serial_output(gb_instance *gb, uint32_t *len) {
+    use(gb);
+    return serial_output(len);
+}
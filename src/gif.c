@@ -0,0 +1,305 @@
+#include "gif.h"
+
+#include <string.h>
+
+#define WIDTH  GB_SCREEN_RES_X
+#define HEIGHT GB_SCREEN_RES_Y
+#define PIXELS (WIDTH * HEIGHT)
+
+// LZW over a 2-bit alphabet: codes 0-3 are the colours, then clear and end
+#define MIN_CODE_SIZE 2
+#define CLEAR_CODE    4
+#define END_CODE      5
+#define FIRST_CODE    6
+#define MAX_CODE_SIZE 12
+#define MAX_CODES     (1 << MAX_CODE_SIZE)
+
+// Shortest delay viewers honour, in centiseconds
+#define MIN_DELAY 2
+
+#define SUB_BLOCK 255
+
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t w;
+    uint32_t h;
+} gif_rect;
+
+struct gif {
+    uint8_t  *data;
+    size_t    size;
+    size_t    capacity;
+    uint8_t   failed;
+    uint64_t  frames;
+    uint32_t  images;
+
+    // What a viewer shows after the images written so far
+    uint8_t   canvas[PIXELS];
+
+    // The latest change, written once the next one shows how long it stays
+    uint8_t   pending[PIXELS];
+    uint8_t   has_pending;
+    uint64_t  pending_start;   // frame it first appeared in
+
+    // Dictionary as a 4-way trie, 0 for no child since codes 0-5 are never
+    // children
+    uint16_t  next[MAX_CODES][4];
+    uint16_t  next_code;
+    uint8_t   code_size;
+    uint32_t  bits;
+    uint32_t  bit_count;
+    uint8_t   block[SUB_BLOCK];
+    uint32_t  block_len;
+};
+
+static void put(gif *g, const void *bytes, size_t len) {
+    if (g->size + len > g->capacity) {
+        size_t capacity = g->capacity * 2;
+        while (capacity < g->size + len) {
+            capacity *= 2;
+        }
+        uint8_t *data = realloc(g->data, capacity);
+        if (!data) {
+            g->failed = 1;
+            return;
+        }
+        g->data = data;
+        g->capacity = capacity;
+    }
+    memcpy(g->data + g->size, bytes, len);
+    g->size += len;
+}
+
+static void put_u8(gif *g, uint8_t value) {
+    put(g, &value, 1);
+}
+
+static void put_u16(gif *g, uint16_t value) {
+    uint8_t bytes[2] = { value & 0xFF, value >> 8 };
+    put(g, bytes, 2);
+}
+
+// Centisecond a frame starts at, rounded down
+static uint64_t centiseconds(uint64_t frame) {
+    return frame * GB_CYCLES_PER_FRAME * 100 / GB_CLOCK_HZ;
+}
+
+// LZW output, least significant bit first, in sub-blocks of up to 255 bytes
+static void flush_block(gif *g) {
+    if (g->block_len) {
+        put_u8(g, g->block_len);
+        put(g, g->block, g->block_len);
+        g->block_len = 0;
+    }
+}
+
+static void emit(gif *g, uint32_t code) {
+    g->bits |= code << g->bit_count;
+    g->bit_count += g->code_size;
+    while (g->bit_count >= 8) {
+        g->block[g->block_len++] = g->bits & 0xFF;
+        g->bits >>= 8;
+        g->bit_count -= 8;
+        if (g->block_len == SUB_BLOCK) {
+            flush_block(g);
+        }
+    }
+}
+
+static void reset_dictionary(gif *g) {
+    memset(g->next, 0, sizeof(g->next));
+    g->next_code = FIRST_CODE;
+    g->code_size = MIN_CODE_SIZE + 1;
+}
+
+// Decoders count every code they read towards the next code size, one
+// ahead of the entries they have, so the size grows once the last code
+// assigned reaches the current limit
+static void emit_data(gif *g, uint32_t code) {
+    emit(g, code);
+    if (g->next_code - 1 >= (1 << g->code_size) && g->code_size < MAX_CODE_SIZE) {
+        g->code_size++;
+    }
+}
+
+static void encode_rect(gif *g, const uint8_t *pixels, gif_rect r) {
+    put_u8(g, MIN_CODE_SIZE);
+    g->bits = 0;
+    g->bit_count = 0;
+    g->block_len = 0;
+    reset_dictionary(g);
+    emit(g, CLEAR_CODE);
+
+    const uint8_t *row = pixels + r.y * WIDTH + r.x;
+    uint32_t prefix = row[0] & 0x03;
+    for (uint32_t y = 0; y < r.h; y++, row += WIDTH) {
+        for (uint32_t x = y ? 0 : 1; x < r.w; x++) {
+            uint8_t pixel = row[x] & 0x03;
+            uint16_t child = g->next[prefix][pixel];
+            if (child) {
+                prefix = child;
+                continue;
+            }
+            g->next[prefix][pixel] = g->next_code++;
+            emit_data(g, prefix);
+            prefix = pixel;
+            if (g->next_code == MAX_CODES) {
+                emit(g, CLEAR_CODE);
+                reset_dictionary(g);
+            }
+        }
+    }
+    // The decoder assigns a code for the last one too
+    g->next_code++;
+    emit_data(g, prefix);
+    emit(g, END_CODE);
+    if (g->bit_count) {
+        g->block[g->block_len++] = g->bits & 0xFF;
+    }
+    flush_block(g);
+    put_u8(g, 0);
+}
+
+// Bounding box of the pixels that differ, w 0 if none do
+static gif_rect changed_rect(const uint8_t *a, const uint8_t *b) {
+    gif_rect r = { 0, 0, 0, 0 };
+    uint32_t top = 0;
+    uint32_t bottom = HEIGHT;
+
+    while (top < HEIGHT && memcmp(a + top * WIDTH, b + top * WIDTH, WIDTH) == 0) {
+        top++;
+    }
+    if (top == HEIGHT) {
+        return r;
+    }
+    while (memcmp(a + (bottom - 1) * WIDTH, b + (bottom - 1) * WIDTH, WIDTH) == 0) {
+        bottom--;
+    }
+
+    uint32_t left = WIDTH;
+    uint32_t right = 0;
+    for (uint32_t y = top; y < bottom; y++) {
+        const uint8_t *ra = a + y * WIDTH;
+        const uint8_t *rb = b + y * WIDTH;
+        for (uint32_t x = 0; x < left; x++) {
+            if (ra[x] != rb[x]) {
+                left = x;
+                break;
+            }
+        }
+        for (uint32_t x = WIDTH; x > right; x--) {
+            if (ra[x - 1] != rb[x - 1]) {
+                right = x;
+                break;
+            }
+        }
+    }
+    r.x = left;
+    r.y = top;
+    r.w = right - left;
+    r.h = bottom - top;
+    return r;
+}
+
+// Write the pending frame, shown until `end_frame`
+static void write_pending(gif *g, uint64_t end_frame) {
+    uint64_t delay = centiseconds(end_frame) - centiseconds(g->pending_start);
+    gif_rect r = g->images ? changed_rect(g->pending, g->canvas)
+                           : (gif_rect) { 0, 0, WIDTH, HEIGHT };
+
+    // Gone back to what is shown, rewrite one pixel to carry the delay
+    if (!r.w) {
+        r.w = 1;
+        r.h = 1;
+    }
+    delay = delay < MIN_DELAY ? MIN_DELAY : delay;
+    delay = delay > 0xFFFF ? 0xFFFF : delay;
+
+    // Graphic control extension, leave the image in place for the next one
+    uint8_t control[] = { 0x21, 0xF9, 0x04, 0x01 << 2 };
+    put(g, control, sizeof(control));
+    put_u16(g, delay);
+    put_u8(g, 0);   // no transparent colour
+    put_u8(g, 0);
+
+    put_u8(g, 0x2C);
+    put_u16(g, r.x);
+    put_u16(g, r.y);
+    put_u16(g, r.w);
+    put_u16(g, r.h);
+    put_u8(g, 0);   // global colour table, not interlaced
+    encode_rect(g, g->pending, r);
+
+    for (uint32_t y = r.y; y < r.y + r.h; y++) {
+        memcpy(g->canvas + y * WIDTH + r.x, g->pending + y * WIDTH + r.x, r.w);
+    }
+    g->images++;
+}
+
+gif *gif_begin(const uint32_t palette[4]) {
+    gif *g = malloc(sizeof(gif));
+    if (!g) {
+        return NULL;
+    }
+    memset(g, 0, sizeof(*g));
+    g->capacity = 64 * 1024;
+    g->data = malloc(g->capacity);
+    if (!g->data) {
+        free(g);
+        return NULL;
+    }
+
+    put(g, "GIF89a", 6);
+    put_u16(g, WIDTH);
+    put_u16(g, HEIGHT);
+    put_u8(g, 0x80 | (1 << 4) | 1);  // 4-entry global table, 2 bits of colour
+    put_u8(g, 0);                    // background colour
+    put_u8(g, 0);                    // square pixels
+    for (int i = 0; i < 4; i++) {
+        uint8_t rgb[3] = { palette[i] >> 16, palette[i] >> 8, palette[i] };
+        put(g, rgb, 3);
+    }
+
+    // Loop forever
+    uint8_t loop[] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E',
+        '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00 };
+    put(g, loop, sizeof(loop));
+    return g;
+}
+
+void gif_add(gif *g, const uint8_t *indices) {
+    uint64_t frame = g->frames++;
+
+    if (!g->has_pending) {
+        memcpy(g->pending, indices, PIXELS);
+        g->pending_start = frame;
+        g->has_pending = 1;
+        return;
+    }
+    if (memcmp(indices, g->pending, PIXELS) == 0) {
+        return;
+    }
+    if (centiseconds(frame) - centiseconds(g->pending_start) >= MIN_DELAY) {
+        write_pending(g, frame);
+        g->pending_start = frame;
+    }
+    memcpy(g->pending, indices, PIXELS);
+}
+
+uint8_t *gif_end(gif *g, gif_stats *stats) {
+    if (g->has_pending) {
+        write_pending(g, g->frames);
+    }
+    put_u8(g, 0x3B);
+
+    uint8_t *data = g->failed ? NULL : g->data;
+    if (g->failed) {
+        free(g->data);
+    }
+    stats->frames = g->frames;
+    stats->images = g->images;
+    stats->size = g->failed ? 0 : g->size;
+    free(g);
+    return data;
+}
@@ -0,0 +1,162 @@
+// pthreads
+#define _POSIX_C_SOURCE 200112L
+
+#include "gif_capture.h"
+#include "gif.h"
+#include "host_io.h"
+#include "host_time.h"
+#include "scale.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define FRAME_SIZE (GB_SCREEN_RES_X * GB_SCREEN_RES_Y)
+
+#define SAVE_PATH_MAX 4096
+
+typedef struct {
+    uint8_t  *frames;       // max_frames of FRAME_SIZE
+    uint32_t  max_frames;
+    uint32_t  first;        // oldest
+    uint32_t  count;
+} gif_history;
+
+static struct {
+    gif_history       history;
+
+    // Saver thread. `saved` and `result` belong to it while `saving` is set.
+    pthread_t         saver;
+    uint8_t           joinable;
+    uint8_t           saving;
+    gif_history       saved;
+    char              path[SAVE_PATH_MAX];
+    gif_capture_stats result;
+
+    gif_capture_stats last;  // result of the last save seen finished
+} capture;
+
+static void *saver_main(void *arg) {
+    gif_history *h = &capture.saved;
+    gif_stats stats = { 0, 0, 0 };
+    uint8_t *data = NULL;
+    (void) arg;
+
+    uint64_t start_ns = host_time_ns();
+    gif *g = gif_begin(scale_grey_palette);
+    if (g) {
+        for (uint32_t i = 0; i < h->count; i++) {
+            gif_add(g, h->frames + ((h->first + i) % h->max_frames) * FRAME_SIZE);
+        }
+        data = gif_end(g, &stats);
+    }
+    capture.result.encode_ns = host_time_ns() - start_ns;
+    if (!data) {
+        printf("[ERROR] gif_capture: malloc fail\n");
+    }
+
+    capture.result.ok = data && host_write_file(capture.path, data, stats.size);
+    capture.result.saved_frames = stats.frames;
+    capture.result.images = stats.images;
+    capture.result.bytes = stats.size;
+    capture.result.saves++;
+    free(data);
+    free(h->frames);
+    h->frames = NULL;
+
+    __atomic_store_n(&capture.saving, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void wait_saver(void) {
+    if (capture.joinable) {
+        pthread_join(capture.saver, NULL);
+        capture.joinable = 0;
+    }
+}
+
+uint8_t gif_capture_init(uint32_t frames) {
+    wait_saver();
+    free(capture.history.frames);
+    memset(&capture.history, 0, sizeof(capture.history));
+    if (!frames) {
+        return 1;
+    }
+
+    capture.history.frames = malloc((size_t) frames * FRAME_SIZE);
+    if (!capture.history.frames) {
+        printf("[ERROR] gif_capture_init: malloc fail\n");
+        return 0;
+    }
+    capture.history.max_frames = frames;
+    return 1;
+}
+
+void gif_capture_detach(void) {
+    capture.joinable = 0;
+    capture.saving = 0;
+    free(capture.history.frames);
+    memset(&capture.history, 0, sizeof(capture.history));
+}
+
+uint8_t gif_capture_enabled(void) {
+    return capture.history.frames != NULL;
+}
+
+void gif_capture_push(const uint8_t *framebuffer) {
+    gif_history *h = &capture.history;
+    uint32_t slot = (h->first + h->count) % h->max_frames;
+
+    memcpy(h->frames + (size_t) slot * FRAME_SIZE, framebuffer, FRAME_SIZE);
+    if (h->count == h->max_frames) {
+        h->first = (h->first + 1) % h->max_frames;
+    } else {
+        h->count++;
+    }
+}
+
+uint8_t gif_capture_save(const char *path) {
+    if (__atomic_load_n(&capture.saving, __ATOMIC_ACQUIRE)) {
+        printf("[WARN] gif_capture_save: still saving the last capture\n");
+        return 0;
+    }
+    wait_saver();
+    if (!capture.history.count || strlen(path) >= sizeof(capture.path)) {
+        printf("[ERROR] gif_capture_save: nothing to save or bad path\n");
+        return 0;
+    }
+
+    // The saver takes the full ring, recording carries on in a fresh one
+    uint8_t *fresh = malloc((size_t) capture.history.max_frames * FRAME_SIZE);
+    if (!fresh) {
+        printf("[ERROR] gif_capture_save: malloc fail\n");
+        return 0;
+    }
+    capture.saved = capture.history;
+    capture.history.frames = fresh;
+    capture.history.first = 0;
+    capture.history.count = 0;
+    strcpy(capture.path, path);
+
+    capture.saving = 1;
+    if (pthread_create(&capture.saver, NULL, saver_main, NULL) != 0) {
+        printf("[ERROR] gif_capture_save: can't start saver thread\n");
+        capture.saving = 0;
+        free(fresh);
+        capture.history = capture.saved;
+        return 0;
+    }
+    capture.joinable = 1;
+    return 1;
+}
+
+gif_capture_stats gif_capture_get_stats(void) {
+    uint8_t saving = __atomic_load_n(&capture.saving, __ATOMIC_ACQUIRE);
+
+    if (!saving) {
+        capture.last = capture.result;
+    }
+    gif_capture_stats stats = capture.last;
+    stats.frames = capture.history.count;
+    stats.saving = saving;
+    return stats;
+}
@@ -0,0 +1,314 @@
+// mkdir, sysconf
+#define _DEFAULT_SOURCE
+
+#include "golden.h"
+#include "host_fork.h"
+#include "host_io.h"
+#include "host_time.h"
+#include "png.h"
+#include "scale.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GOLDEN_NAME_MAX 128
+#define GOLDEN_PATH_MAX 1024
+#define GOLDEN_LINE_MAX (GOLDEN_NAME_MAX + GOLDEN_PATH_MAX * 3 + 64)
+
+#define FRAME_SIZE (GB_FRAMEBUFFER_WIDTH * GB_FRAMEBUFFER_HEIGHT)
+
+// Matching pixels keep three greys, differences are red
+#define DIFF_INDEX 3
+static const uint32_t diff_palette[4] = { 0xFF000000, 0xFF555555, 0xFFAAAAAA, 0xFFFF0000 };
+
+// Fields as written in the manifest
+typedef struct {
+    char     name[GOLDEN_NAME_MAX];
+    char     rom[GOLDEN_PATH_MAX];
+    char     movie[GOLDEN_PATH_MAX];       // "-" for none
+    char     reference[GOLDEN_PATH_MAX];   // empty for none
+    uint32_t frames;
+    uint8_t  has_hash;
+    uint64_t hash;
+} golden_check;
+
+typedef enum {
+    GOLDEN_ERROR,       // also what a child that died leaves behind
+    GOLDEN_PASS,
+    GOLDEN_FAIL,
+} golden_status;
+
+// Written by the child into the shared mapping
+typedef struct {
+    uint8_t  status;
+    uint32_t frames;     // run before stopping
+    uint64_t hash;
+    uint64_t ns;
+} golden_result;
+
+typedef struct {
+    const char         *dir;     // of the manifest
+    const char         *out_dir;
+    uint8_t             bless;
+    const golden_check *checks;
+} golden_env;
+
+// `path` relative to the manifest's directory unless absolute
+static void resolve(const golden_env *env, const char *path, char *out, size_t size) {
+    if (path[0] == '/' || !env->dir[0]) {
+        snprintf(out, size, "%s", path);
+    } else {
+        snprintf(out, size, "%s/%s", env->dir, path);
+    }
+}
+
+static uint8_t save_png(const char *path, const uint8_t *indices, const uint32_t palette[4]) {
+    uint8_t png[PNG_MAX_SIZE(GB_FRAMEBUFFER_WIDTH, GB_FRAMEBUFFER_HEIGHT)];
+    uint32_t size = png_encode(indices, GB_FRAMEBUFFER_WIDTH, GB_FRAMEBUFFER_HEIGHT, palette,
+        png, sizeof(png));
+
+    return size && host_write_file(path, png, size);
+}
+
+static uint8_t load_reference(const char *path, uint8_t *indices) {
+    uint8_t buf[PNG_MAX_SIZE(GB_FRAMEBUFFER_WIDTH, GB_FRAMEBUFFER_HEIGHT)];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        printf("[WARN] golden: can't open reference %s\n", path);
+        return 0;
+    }
+    size_t size = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    if (!png_decode(buf, size, GB_FRAMEBUFFER_WIDTH, GB_FRAMEBUFFER_HEIGHT, indices)) {
+        printf("[WARN] golden: %s is not a frame written by this emulator\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Last frame, and a diff against the reference if there is one
+static void write_images(const golden_env *env, const golden_check *c, const uint8_t *frame) {
+    char path[GOLDEN_PATH_MAX * 2];
+    uint8_t reference[FRAME_SIZE];
+    uint8_t diff[FRAME_SIZE];
+
+    snprintf(path, sizeof(path), "%s/%s.png", env->out_dir, c->name);
+    save_png(path, frame, scale_grey_palette);
+    if (env->bless || !c->reference[0]) {
+        return;
+    }
+
+    resolve(env, c->reference, path, sizeof(path));
+    if (!load_reference(path, reference)) {
+        return;
+    }
+    for (uint32_t i = 0; i < FRAME_SIZE; i++) {
+        uint8_t grey = frame[i] < DIFF_INDEX ? frame[i] : DIFF_INDEX - 1;
+        diff[i] = frame[i] == reference[i] ? grey : DIFF_INDEX;
+    }
+    snprintf(path, sizeof(path), "%s/%s.diff.png", env->out_dir, c->name);
+    save_png(path, diff, diff_palette);
+}
+
+// In the child
+static void run_check(uint32_t index, void *result, void *user) {
+    const golden_env *env = user;
+    const golden_check *c = &env->checks[index];
+    golden_result *r = result;
+    char path[GOLDEN_PATH_MAX * 2];
+    uint64_t start_ns = host_time_ns();
+
+    gb_instance *gb = gb_create();
+    resolve(env, c->rom, path, sizeof(path));
+    if (!gb || !gb_load_rom(gb, path)) {
+        printf("[ERROR] golden: %s: can't load %s\n", c->name, path);
+        return;
+    }
+    resolve(env, c->movie, path, sizeof(path));
+    if (strcmp(c->movie, "-") != 0 && !gb_movie_play(gb, path)) {
+        printf("[ERROR] golden: %s: can't play %s\n", c->name, path);
+        return;
+    }
+
+    while (r->frames < c->frames && gb_run_frame(gb)) {
+        r->frames++;
+    }
+    r->hash = gb_framebuffer_hash(gb);
+    r->ns = host_time_ns() - start_ns;
+    // Blessing takes whatever hash the run ends on
+    uint8_t hash_ok = env->bless || (c->has_hash && r->hash == c->hash);
+    r->status = r->frames == c->frames && hash_ok ? GOLDEN_PASS : GOLDEN_FAIL;
+
+    if (env->bless || r->status == GOLDEN_FAIL) {
+        write_images(env, c, gb_framebuffer(gb));
+    }
+}
+
+static uint8_t parse_check(char *line, golden_check *c) {
+    char *fields[6];
+    uint32_t count = 0;
+    char *comment = strchr(line, '#');
+
+    if (comment) {
+        *comment = '\0';
+    }
+    for (char *f = strtok(line, " \t\r\n"); f && count < 6; f = strtok(NULL, " \t\r\n")) {
+        fields[count++] = f;
+    }
+    if (count < 5 || strlen(fields[0]) >= sizeof(c->name) || strlen(fields[1]) >= sizeof(c->rom)
+            || strlen(fields[3]) >= sizeof(c->movie)
+            || (count == 6 && strlen(fields[5]) >= sizeof(c->reference))) {
+        return 0;
+    }
+
+    memset(c, 0, sizeof(*c));
+    strcpy(c->name, fields[0]);
+    strcpy(c->rom, fields[1]);
+    c->frames = strtoul(fields[2], NULL, 10);
+    strcpy(c->movie, fields[3]);
+    c->has_hash = strcmp(fields[4], "-") != 0;
+    c->hash = strtoull(fields[4], NULL, 16);
+    if (count == 6) {
+        strcpy(c->reference, fields[5]);
+    }
+    return 1;
+}
+
+// NULL if the manifest can't be read, `count` 0 for an empty one
+static golden_check *read_manifest(const char *path, uint32_t *count) {
+    char line[GOLDEN_LINE_MAX];
+    golden_check *checks = NULL;
+    uint32_t capacity = 0;
+    uint32_t line_number = 0;
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("[ERROR] golden: can't open %s\n", path);
+        return NULL;
+    }
+    *count = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_number++;
+        if (strspn(line, " \t\r\n") == strlen(line) || line[strspn(line, " \t")] == '#') {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            golden_check *grown = realloc(checks, capacity * sizeof(golden_check));
+            if (!grown) {
+                printf("[ERROR] golden: malloc fail\n");
+                goto fail;
+            }
+            checks = grown;
+        }
+        if (!parse_check(line, &checks[*count])) {
+            printf("[ERROR] golden: %s:%u: expected name rom frames movie hash [reference]\n",
+                path, line_number);
+            goto fail;
+        }
+        (*count)++;
+    }
+    fclose(f);
+    return checks ? checks : malloc(sizeof(golden_check));
+
+fail:
+    fclose(f);
+    free(checks);
+    return NULL;
+}
+
+static void report(const golden_check *checks, const golden_result *results, uint32_t count,
+        uint8_t bless) {
+    for (uint32_t i = 0; i < count; i++) {
+        const golden_check *c = &checks[i];
+        const golden_result *r = &results[i];
+
+        if (bless && r->status == GOLDEN_ERROR) {
+            printf("# ERROR %s: didn't run to completion\n", c->name);
+            continue;
+        }
+        if (bless) {
+            printf("%s %s %u %s %016llx%s%s\n", c->name, c->rom, c->frames, c->movie,
+                (unsigned long long) r->hash, c->reference[0] ? " " : "", c->reference);
+            continue;
+        }
+        switch (r->status) {
+            case GOLDEN_PASS:
+                printf("PASS  %s (%u frames, %.1f ms)\n", c->name, r->frames, r->ns / 1e6);
+                break;
+            case GOLDEN_FAIL:
+                if (r->frames != c->frames) {
+                    printf("FAIL  %s: stopped after %u of %u frames\n", c->name, r->frames,
+                        c->frames);
+                } else if (!c->has_hash) {
+                    printf("FAIL  %s: no expected hash, got %016llx\n", c->name,
+                        (unsigned long long) r->hash);
+                } else {
+                    printf("FAIL  %s: hash %016llx, expected %016llx\n", c->name,
+                        (unsigned long long) r->hash, (unsigned long long) c->hash);
+                }
+                break;
+            default:
+                printf("ERROR %s: didn't run to completion\n", c->name);
+                break;
+        }
+    }
+}
+
+uint8_t golden_run(const char *manifest, const char *out_dir, uint32_t jobs, uint8_t bless,
+        golden_summary *summary) {
+    char dir[GOLDEN_PATH_MAX];
+    uint32_t count;
+
+    memset(summary, 0, sizeof(*summary));
+    golden_check *checks = read_manifest(manifest, &count);
+    if (!checks) {
+        return 0;
+    }
+    if (mkdir(out_dir, 0755) != 0 && errno != EEXIST) {
+        printf("[ERROR] golden: can't create %s\n", out_dir);
+        free(checks);
+        return 0;
+    }
+
+    snprintf(dir, sizeof(dir), "%s", manifest);
+    char *slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+    } else {
+        dir[0] = '\0';
+    }
+    golden_env env = { dir, out_dir, bless, checks };
+
+    // Zeroed results read as GOLDEN_ERROR, which is what a check that
+    // didn't exit cleanly is left with
+    golden_result *results = malloc((count ? count : 1) * sizeof(golden_result));
+    if (!results) {
+        printf("[ERROR] golden: malloc fail\n");
+        free(checks);
+        return 0;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    summary->jobs = jobs ? jobs : cpus > 0 ? cpus : 1;
+    uint64_t start_ns = host_time_ns();
+
+    host_fork_run(count, summary->jobs, sizeof(golden_result), run_check, &env, results);
+    summary->ns = host_time_ns() - start_ns;
+
+    report(checks, results, count, bless);
+    for (uint32_t i = 0; i < count; i++) {
+        summary->checks++;
+        summary->frames += results[i].frames;
+        summary->passed += results[i].status == GOLDEN_PASS;
+        summary->failed += results[i].status == GOLDEN_FAIL;
+        summary->errors += results[i].status == GOLDEN_ERROR;
+    }
+
+    free(results);
+    free(checks);
+    return 1;
+}
@@ -0,0 +1,65 @@
+#include "hash.h"
+
+// xxHash64-style rounds. Four independent lanes consume 32-byte stripes, so
+// the multiplies of neighbouring words overlap instead of forming one chain,
+// and the loop is a candidate for vectorisation.
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+#define LANES  4
+#define STRIPE (LANES * 8)
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Compilers turn this into a single load on little-endian hosts
+static uint64_t read_u64(const uint8_t *p) {
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16
+        | (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40
+        | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static uint64_t mix(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    uint64_t hash;
+
+    if (len >= STRIPE) {
+        uint64_t lane[LANES] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+        for (; end - p >= STRIPE; p += STRIPE) {
+            for (int l = 0; l < LANES; l++) {
+                lane[l] = mix(lane[l], read_u64(p + l * 8));
+            }
+        }
+        hash = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) + rotl(lane[3], 18);
+        for (int l = 0; l < LANES; l++) {
+            hash = (hash ^ mix(0, lane[l])) * PRIME1 + PRIME4;
+        }
+    } else {
+        hash = seed + PRIME5;
+    }
+    hash += len;
+
+    for (; end - p >= 8; p += 8) {
+        hash = rotl(hash ^ mix(0, read_u64(p)), 27) * PRIME1 + PRIME4;
+    }
+    for (; p < end; p++) {
+        hash = rotl(hash ^ (*p * PRIME5), 11) * PRIME1;
+    }
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,97 @@
+// fork, waitpid, MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include "host_fork.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct {
+    pid_t    pid;
+    uint32_t index;
+} fork_child;
+
+// Wait for `child`, zeroing its result and returning 0 if it failed
+static uint8_t reap(const fork_child *child, uint8_t *area, uint32_t result_size) {
+    int status;
+
+    if (waitpid(child->pid, &status, 0) == child->pid
+            && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        return 1;
+    }
+    memset(area + (size_t) child->index * result_size, 0, result_size);
+    return 0;
+}
+
+uint8_t host_fork_run(uint32_t count, uint32_t jobs, uint32_t result_size,
+        host_fork_fn fn, void *user, void *results) {
+    size_t area_size = (size_t) count * result_size;
+    uint8_t *area = NULL;
+
+    if (area_size) {
+        area = mmap(NULL, area_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (area == MAP_FAILED) {
+            printf("[ERROR] host_fork_run: mmap fail\n");
+            return 0;
+        }
+    }
+
+    if (!jobs) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? cpus : 1;
+    }
+    fork_child *running = malloc(jobs * sizeof(fork_child));  // oldest first, as a ring
+    uint32_t oldest = 0;
+    uint32_t n_running = 0;
+    uint8_t ok = 1;
+
+    if (!running) {
+        printf("[ERROR] host_fork_run: malloc fail\n");
+        if (area) {
+            munmap(area, area_size);
+        }
+        return 0;
+    }
+
+    // Buffered output would otherwise be flushed once by every child
+    fflush(NULL);
+
+    for (uint32_t i = 0; i < count; i++) {
+        // Jobs run about as long as each other, so the oldest is the one to
+        // wait for
+        if (n_running == jobs) {
+            ok &= reap(&running[oldest], area, result_size);
+            oldest = (oldest + 1) % jobs;
+            n_running--;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            fn(i, area + (size_t) i * result_size, user);
+            fflush(NULL);
+            _exit(0);
+        }
+        if (pid < 0) {
+            printf("[ERROR] host_fork_run: fork fail\n");
+            ok = 0;
+            break;
+        }
+        running[(oldest + n_running) % jobs] = (fork_child) { pid, i };
+        n_running++;
+    }
+    for (; n_running; n_running--) {
+        ok &= reap(&running[oldest], area, result_size);
+        oldest = (oldest + 1) % jobs;
+    }
+    free(running);
+
+    if (area) {
+        memcpy(results, area, area_size);
+        munmap(area, area_size);
+    }
+    return ok;
+}
@@ -0,0 +1,40 @@
+// write, ssize_t, open
+#define _POSIX_C_SOURCE 200112L
+
+#include "host_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+uint8_t host_write(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+uint8_t host_write_file(const char *path, const void *buf, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("[ERROR] can't open %s\n", path);
+        return 0;
+    }
+    uint8_t ok = host_write(fd, buf, len);
+    ok &= close(fd) == 0;
+    if (!ok) {
+        printf("[ERROR] write to %s failed\n", path);
+    }
+    return ok;
+}
@@ -0,0 +1,47 @@
+// clock_gettime, nanosleep
+#define _POSIX_C_SOURCE 199309L
+
+#include "host_time.h"
+
+#include <time.h>
+
+// Bounds on the spin margin left after sleeping
+#define SPIN_MIN_NS 100000
+#define SPIN_MAX_NS 4000000
+
+static uint64_t spin_ns = SPIN_MIN_NS;
+
+uint64_t host_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void host_time_sleep_until(uint64_t deadline_ns) {
+    uint64_t now = host_time_ns();
+
+    if (deadline_ns > now + spin_ns) {
+        uint64_t wait = deadline_ns - now - spin_ns;
+        struct timespec ts = {
+            .tv_sec = wait / 1000000000,
+            .tv_nsec = wait % 1000000000,
+        };
+        nanosleep(&ts, NULL);
+
+        // Widen the margin straight away on a late wakeup, narrow it slowly
+        uint64_t woke = host_time_ns();
+        uint64_t over = woke - now > wait ? woke - now - wait : 0;
+        over += over / 2;
+        if (over > spin_ns) {
+            spin_ns = over < SPIN_MAX_NS ? over : SPIN_MAX_NS;
+        } else {
+            spin_ns -= (spin_ns - over) / 16;
+            spin_ns = spin_ns > SPIN_MIN_NS ? spin_ns : SPIN_MIN_NS;
+        }
+        now = woke;
+    }
+
+    while (now < deadline_ns) {
+        now = host_time_ns();
+    }
+}
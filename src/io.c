@@ -0,0 +1,107 @@
+#include "io.h"
+#include "machine.h"
+
+// Backing store for registers without a handler
+#define registers (machine->io_registers)
+
+// Handlers are the same for every machine, registered again by each reset
+
+static io_read_handler  read_handlers[IO_REG_COUNT];
+static io_write_handler write_handlers[IO_REG_COUNT];
+
+// Bits with no function that always read back as 1. Registers that do not exist
+// on the DMG read as 0xFF.
+static const uint8_t unused_bits[IO_REG_COUNT] = {
+    [0x00] = 0xC0,  // P1
+    [0x02] = 0x7E,  // SC
+    [0x03] = 0xFF,
+    [0x07] = 0xF8,  // TAC
+    [0x08] = 0xFF, [0x09] = 0xFF, [0x0A] = 0xFF, [0x0B] = 0xFF,
+    [0x0C] = 0xFF, [0x0D] = 0xFF, [0x0E] = 0xFF,
+    [0x0F] = 0xE0,  // IF
+    [0x10] = 0x80,  // NR10
+    [0x15] = 0xFF,
+    [0x1A] = 0x7F,  // NR30
+    [0x1C] = 0x9F,  // NR32
+    [0x1F] = 0xFF,
+    [0x20] = 0xC0,  // NR41
+    [0x23] = 0x3F,  // NR44
+    [0x26] = 0x70,  // NR52
+    [0x27] = 0xFF, [0x28] = 0xFF, [0x29] = 0xFF, [0x2A] = 0xFF,
+    [0x2B] = 0xFF, [0x2C] = 0xFF, [0x2D] = 0xFF, [0x2E] = 0xFF,
+    [0x2F] = 0xFF,
+    [0x41] = 0x80,  // STAT
+    [0x4C ... 0x7F] = 0xFF,
+};
+
+// Bits that can be written but read back as 1
+static const uint8_t write_only_bits[IO_REG_COUNT] = {
+    [0x11] = 0x3F,  // NR11 length
+    [0x13] = 0xFF,  // NR13
+    [0x14] = 0xBF,  // NR14 trigger, frequency
+    [0x16] = 0x3F,  // NR21 length
+    [0x18] = 0xFF,  // NR23
+    [0x19] = 0xBF,  // NR24
+    [0x1B] = 0xFF,  // NR31
+    [0x1D] = 0xFF,  // NR33
+    [0x1E] = 0xBF,  // NR34
+    [0x20] = 0x3F,  // NR41 length
+    [0x23] = 0x80,  // NR44 trigger
+};
+
+// Bits owned by the hardware that writes cannot change
+static const uint8_t read_only_bits[IO_REG_COUNT] = {
+    [0x00] = 0x0F,  // P1 button lines
+    [0x26] = 0x0F,  // NR52 channel status
+    [0x41] = 0x07,  // STAT mode and coincidence
+    [0x44] = 0xFF,  // LY
+};
+
+// unused_bits | write_only_bits, applied to every read
+static uint8_t read_or_mask[IO_REG_COUNT];
+
+void io_init(void) {
+    for (int i = 0; i < IO_REG_COUNT; i++) {
+        registers[i] = 0x00;
+        read_handlers[i] = NULL;
+        write_handlers[i] = NULL;
+        read_or_mask[i] = unused_bits[i] | write_only_bits[i];
+    }
+}
+
+void io_register(uint16_t addr, io_read_handler read, io_write_handler write) {
+    read_handlers[IO_INDEX(addr)] = read;
+    write_handlers[IO_INDEX(addr)] = write;
+}
+
+uint8_t io_read(uint16_t addr) {
+    uint8_t i = IO_INDEX(addr);
+    uint8_t value;
+
+    if (read_handlers[i]) {
+        value = read_handlers[i](addr);
+    } else {
+        value = registers[i];
+    }
+    return value | read_or_mask[i];
+}
+
+void io_write(uint16_t addr, uint8_t value) {
+    uint8_t i = IO_INDEX(addr);
+
+    // Handlers see the raw value and apply their own side effects
+    if (write_handlers[i]) {
+        write_handlers[i](addr, value);
+        return;
+    }
+    registers[i] = (registers[i] & read_only_bits[i]) | (value & ~read_only_bits[i]);
+}
+
+// Only the backing bytes, registers with handlers are saved by their owners
+void io_save(state_buffer *s) {
+    state_put_bytes(s, registers, sizeof(registers));
+}
+
+void io_load(state_buffer *s) {
+    state_get_bytes(s, registers, sizeof(registers));
+}
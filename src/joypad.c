@@ -0,0 +1,155 @@
+#include "joypad.h"
+#include "cpu.h"
+#include "io.h"
+#include "scheduler.h"
+#include "host_time.h"
+#include "machine.h"
+#include "movie.h"
+
+// P1 select lines, active low
+#define SELECT_DIRECTIONS 0x10
+#define SELECT_BUTTONS    0x20
+
+#define ctx   (machine->joypad)
+#define queue (machine->joypad_queue)
+
+static uint8_t joypad_read(uint16_t addr);
+static void joypad_write(uint16_t addr, uint8_t value);
+static void joypad_on_poll(void);
+
+// P10-P13 as the game sees them, 0 meaning pressed
+static uint8_t lines(void) {
+    uint8_t pressed = 0;
+
+    if (!(ctx.select & SELECT_DIRECTIONS)) {
+        pressed |= ctx.buttons & 0x0F;
+    }
+    if (!(ctx.select & SELECT_BUTTONS)) {
+        pressed |= ctx.buttons >> 4;
+    }
+    return ~pressed & 0x0F;
+}
+
+// Run a change to the button or select state, raising the joypad interrupt if
+// any input line went from high to low.
+static void update(uint8_t buttons, uint8_t select) {
+    uint8_t before = lines();
+
+    ctx.buttons = buttons;
+    ctx.select  = select;
+    if (before & ~lines()) {
+        cpu_request_interrupt(INT_JOYPAD);
+    }
+}
+
+void joypad_init(void) {
+    __atomic_store_n(&queue.head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&queue.tail, 0, __ATOMIC_RELAXED);
+
+    ctx.buttons = 0;
+    ctx.select = SELECT_DIRECTIONS | SELECT_BUTTONS;
+    ctx.unseen_ns = 0;
+    ctx.latency.count = 0;
+    ctx.latency.total_ns = 0;
+    ctx.latency.max_ns = 0;
+
+    io_register(JOYPAD_ADDR, joypad_read, joypad_write);
+    scheduler_register(SCHED_JOYPAD_POLL, joypad_on_poll);
+    scheduler_schedule(SCHED_JOYPAD_POLL, scheduler_now() + JOYPAD_POLL_CYCLES);
+}
+
+uint8_t joypad_push(uint8_t buttons) {
+    uint32_t head = __atomic_load_n(&queue.head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == JOYPAD_QUEUE_SIZE) {
+        return 0;
+    }
+
+    joypad_event *e = &queue.events[head & (JOYPAD_QUEUE_SIZE - 1)];
+    e->host_ns = host_time_ns();
+    e->buttons = buttons;
+    __atomic_store_n(&queue.head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void joypad_set_buttons(uint8_t buttons) {
+    update(buttons, ctx.select);
+}
+
+joypad_latency joypad_latency_stats(void) {
+    return ctx.latency;
+}
+
+uint8_t joypad_buttons(void) {
+    return ctx.buttons;
+}
+
+void joypad_drain(uint8_t apply) {
+    uint32_t tail = __atomic_load_n(&queue.tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE);
+
+    for (; apply && tail != head; tail++) {
+        joypad_event *e = &queue.events[tail & (JOYPAD_QUEUE_SIZE - 1)];
+        update(e->buttons, ctx.select);
+        if (!ctx.unseen_ns) {
+            ctx.unseen_ns = e->host_ns;
+        }
+    }
+    __atomic_store_n(&queue.tail, head, __ATOMIC_RELEASE);
+}
+
+uint8_t joypad_drain_final(void) {
+    uint32_t tail = __atomic_load_n(&queue.tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE);
+    uint8_t buttons = ctx.buttons;
+
+    if (tail != head) {
+        buttons = queue.events[(head - 1) & (JOYPAD_QUEUE_SIZE - 1)].buttons;
+        if (!ctx.unseen_ns) {
+            ctx.unseen_ns = queue.events[tail & (JOYPAD_QUEUE_SIZE - 1)].host_ns;
+        }
+    }
+    __atomic_store_n(&queue.tail, head, __ATOMIC_RELEASE);
+    return buttons;
+}
+
+// Apply everything the host queued since the last poll. A movie takes input
+// only at frame boundaries, through movie_frame(), so replays land on the
+// same cycle; the queue waits for it.
+static void joypad_on_poll(void) {
+    if (movie_get_mode() == MOVIE_OFF) {
+        joypad_drain(1);
+    }
+    scheduler_schedule(SCHED_JOYPAD_POLL, scheduler_now() + JOYPAD_POLL_CYCLES);
+}
+
+static uint8_t joypad_read(uint16_t addr) {
+    (void) addr;
+
+    if (ctx.unseen_ns) {
+        uint64_t latency = host_time_ns() - ctx.unseen_ns;
+        ctx.latency.count++;
+        ctx.latency.total_ns += latency;
+        if (latency > ctx.latency.max_ns) {
+            ctx.latency.max_ns = latency;
+        }
+        ctx.unseen_ns = 0;
+    }
+    return ctx.select | lines();
+}
+
+static void joypad_write(uint16_t addr, uint8_t value) {
+    (void) addr;
+    update(ctx.buttons, value & (SELECT_DIRECTIONS | SELECT_BUTTONS));
+}
+
+void joypad_save(state_buffer *s) {
+    state_put_u8(s, ctx.buttons);
+    state_put_u8(s, ctx.select);
+}
+
+void joypad_load(state_buffer *s) {
+    ctx.buttons = state_get_u8(s);
+    ctx.select = state_get_u8(s);
+}
@@ -0,0 +1,308 @@
+#include "movie.h"
+#include "cartridge.h"
+#include "hash.h"
+#include "joypad.h"
+#include "state.h"
+
+#include <string.h>
+
+typedef struct {
+    uint32_t frame;
+    uint32_t offset;
+} movie_keyframe;
+
+static struct {
+    movie_mode      mode;
+    FILE           *file;
+    uint32_t        frame;       // next frame to record or play
+    uint32_t        length;      // frames in the movie, or recorded so far
+    uint32_t        interval;
+    uint8_t        *inputs;
+    uint32_t        inputs_cap;
+    movie_keyframe *keyframes;
+    uint32_t        keyframe_count;
+    uint32_t        keyframe_cap;
+    uint8_t        *state;       // state_size() scratch
+    uint32_t        state_bytes;
+    uint64_t        hash;        // frame 0 state
+} ctx;
+
+// Grow `*array` of `size` byte elements to hold at least `needed`.
+static uint8_t reserve(void **array, uint32_t *cap, uint32_t needed, uint32_t size) {
+    if (needed <= *cap) {
+        return 1;
+    }
+
+    uint32_t grown = *cap ? *cap * 2 : 4096;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    void *p = realloc(*array, (size_t) grown * size);
+    if (!p) {
+        printf("[ERROR] movie: realloc fail\n");
+        return 0;
+    }
+    *array = p;
+    *cap = grown;
+    return 1;
+}
+
+static void reset(void) {
+    if (ctx.file) {
+        fclose(ctx.file);
+    }
+    free(ctx.inputs);
+    free(ctx.keyframes);
+    free(ctx.state);
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+static void put_header(uint8_t *buf, uint32_t inputs_offset, uint32_t index_offset) {
+    state_buffer s = { buf, 0 };
+
+    state_put_u32(&s, MOVIE_MAGIC);
+    state_put_u16(&s, MOVIE_VERSION);
+    state_put_u16(&s, cartridge_checksum());
+    state_put_u32(&s, ctx.length);
+    state_put_u32(&s, ctx.interval);
+    state_put_u64(&s, ctx.hash);
+    state_put_u32(&s, inputs_offset);
+    state_put_u32(&s, index_offset);
+    state_put_u32(&s, ctx.keyframe_count);
+    state_put_u32(&s, ctx.state_bytes);
+}
+
+static uint8_t write_keyframe(void) {
+    if (!reserve((void **) &ctx.keyframes, &ctx.keyframe_cap, ctx.keyframe_count + 1,
+            sizeof(movie_keyframe))) {
+        return 0;
+    }
+
+    state_save(ctx.state);
+    if (ctx.frame == 0) {
+        ctx.hash = hash_bytes(ctx.state, ctx.state_bytes, 0);
+    }
+
+    movie_keyframe *k = &ctx.keyframes[ctx.keyframe_count];
+    k->frame = ctx.frame;
+    k->offset = ftell(ctx.file);
+    if (fwrite(ctx.state, 1, ctx.state_bytes, ctx.file) != ctx.state_bytes) {
+        printf("[ERROR] movie: failed to write keyframe\n");
+        return 0;
+    }
+    ctx.keyframe_count++;
+    return 1;
+}
+
+uint8_t movie_record(const char *path, uint32_t keyframe_interval) {
+    reset();
+
+    ctx.file = fopen(path, "wb");
+    if (!ctx.file) {
+        printf("[ERROR] movie_record: can't open %s\n", path);
+        return 0;
+    }
+    ctx.interval = keyframe_interval ? keyframe_interval : MOVIE_DEFAULT_KEYFRAME_INTERVAL;
+    ctx.state_bytes = state_size();
+    ctx.state = malloc(ctx.state_bytes);
+    if (!ctx.state) {
+        printf("[ERROR] movie_record: malloc fail\n");
+        reset();
+        return 0;
+    }
+
+    // The header is filled in once the recording is finished
+    uint8_t header[MOVIE_HEADER_SIZE] = { 0 };
+    if (fwrite(header, 1, sizeof(header), ctx.file) != sizeof(header) || !write_keyframe()) {
+        printf("[ERROR] movie_record: failed to write %s\n", path);
+        reset();
+        return 0;
+    }
+
+    ctx.mode = MOVIE_RECORDING;
+    return 1;
+}
+
+static uint8_t read_at(uint32_t offset, void *dest, uint32_t len) {
+    return fseek(ctx.file, offset, SEEK_SET) == 0 && fread(dest, 1, len, ctx.file) == len;
+}
+
+static uint8_t load_keyframe(uint32_t n) {
+    return read_at(ctx.keyframes[n].offset, ctx.state, ctx.state_bytes)
+        && state_load(ctx.state, ctx.state_bytes);
+}
+
+uint8_t movie_play(const char *path) {
+    uint8_t header[MOVIE_HEADER_SIZE];
+
+    reset();
+    ctx.file = fopen(path, "rb");
+    if (!ctx.file || !read_at(0, header, sizeof(header))) {
+        printf("[ERROR] movie_play: can't read %s\n", path);
+        reset();
+        return 0;
+    }
+
+    state_buffer s = { header, 0 };
+    uint32_t magic    = state_get_u32(&s);
+    uint16_t version  = state_get_u16(&s);
+    uint16_t checksum = state_get_u16(&s);
+    ctx.length        = state_get_u32(&s);
+    ctx.interval      = state_get_u32(&s);
+    ctx.hash          = state_get_u64(&s);
+    uint32_t inputs_offset = state_get_u32(&s);
+    uint32_t index_offset  = state_get_u32(&s);
+    ctx.keyframe_count     = state_get_u32(&s);
+    ctx.state_bytes        = state_get_u32(&s);
+
+    if (magic != MOVIE_MAGIC || version != MOVIE_VERSION || !ctx.keyframe_count) {
+        printf("[ERROR] movie_play: %s is not a movie\n", path);
+        reset();
+        return 0;
+    }
+    if (checksum != cartridge_checksum() || ctx.state_bytes != state_size()) {
+        printf("[ERROR] movie_play: %s was recorded with another ROM\n", path);
+        reset();
+        return 0;
+    }
+
+    uint8_t index[MOVIE_INDEX_ENTRY_SIZE];
+    ctx.inputs = malloc(ctx.length ? ctx.length : 1);
+    ctx.keyframes = malloc(ctx.keyframe_count * sizeof(movie_keyframe));
+    ctx.state = malloc(ctx.state_bytes);
+    if (!ctx.inputs || !ctx.keyframes || !ctx.state) {
+        printf("[ERROR] movie_play: malloc fail\n");
+        reset();
+        return 0;
+    }
+    if (!read_at(inputs_offset, ctx.inputs, ctx.length)
+            || fseek(ctx.file, index_offset, SEEK_SET) != 0) {
+        printf("[ERROR] movie_play: %s is truncated\n", path);
+        reset();
+        return 0;
+    }
+    for (uint32_t n = 0; n < ctx.keyframe_count; n++) {
+        if (fread(index, 1, sizeof(index), ctx.file) != sizeof(index)) {
+            printf("[ERROR] movie_play: %s is truncated\n", path);
+            reset();
+            return 0;
+        }
+        s = (state_buffer) { index, 0 };
+        ctx.keyframes[n].frame  = state_get_u32(&s);
+        ctx.keyframes[n].offset = state_get_u32(&s);
+    }
+
+    if (ctx.keyframes[0].frame != 0 || !load_keyframe(0)
+            || hash_bytes(ctx.state, ctx.state_bytes, 0) != ctx.hash) {
+        printf("[ERROR] movie_play: initial state of %s does not match\n", path);
+        reset();
+        return 0;
+    }
+
+    ctx.mode = MOVIE_PLAYING;
+    return 1;
+}
+
+uint8_t movie_frame(void) {
+    switch (ctx.mode) {
+        case MOVIE_RECORDING:
+            if (ctx.frame && ctx.frame % ctx.interval == 0 && !write_keyframe()) {
+                return 0;
+            }
+            if (!reserve((void **) &ctx.inputs, &ctx.inputs_cap, ctx.frame + 1, 1)) {
+                return 0;
+            }
+            // Host input queued since the last frame lands on this frame
+            // boundary as its final mask, the one input replay applies, so
+            // a press and release in between can't raise an interrupt that
+            // replay wouldn't
+            joypad_set_buttons(joypad_drain_final());
+            ctx.inputs[ctx.frame++] = joypad_buttons();
+            ctx.length = ctx.frame;
+            return 1;
+        case MOVIE_PLAYING:
+            if (ctx.frame == ctx.length) {
+                return 0;
+            }
+            joypad_drain(0);
+            joypad_set_buttons(ctx.inputs[ctx.frame++]);
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+uint8_t movie_seek_keyframe(uint32_t frame, uint32_t *keyframe) {
+    if (ctx.mode != MOVIE_PLAYING || frame > ctx.length) {
+        return 0;
+    }
+
+    // Keyframes are in frame order
+    uint32_t lo = 0;
+    uint32_t hi = ctx.keyframe_count;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (ctx.keyframes[mid].frame <= frame) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (!load_keyframe(lo)) {
+        printf("[ERROR] movie_seek_keyframe: failed to restore keyframe\n");
+        return 0;
+    }
+    ctx.frame = ctx.keyframes[lo].frame;
+    *keyframe = ctx.frame;
+    return 1;
+}
+
+void movie_detach(void) {
+    // Closing could still move the offset the parent relies on, so the
+    // FILE is left open for the child's exit to drop
+    ctx.file = NULL;
+    reset();
+}
+
+movie_mode movie_get_mode(void) {
+    return ctx.mode;
+}
+
+uint32_t movie_current_frame(void) {
+    return ctx.frame;
+}
+
+uint32_t movie_length(void) {
+    return ctx.length;
+}
+
+uint8_t movie_close(void) {
+    uint8_t ok = 1;
+
+    if (ctx.mode == MOVIE_RECORDING) {
+        uint8_t header[MOVIE_HEADER_SIZE];
+        uint8_t index[MOVIE_INDEX_ENTRY_SIZE];
+        uint32_t inputs_offset = ftell(ctx.file);
+        uint32_t index_offset = inputs_offset + ctx.length;
+
+        ok = fwrite(ctx.inputs, 1, ctx.length, ctx.file) == ctx.length;
+        for (uint32_t n = 0; ok && n < ctx.keyframe_count; n++) {
+            state_buffer s = { index, 0 };
+            state_put_u32(&s, ctx.keyframes[n].frame);
+            state_put_u32(&s, ctx.keyframes[n].offset);
+            ok = fwrite(index, 1, sizeof(index), ctx.file) == sizeof(index);
+        }
+        put_header(header, inputs_offset, index_offset);
+        ok = ok && fseek(ctx.file, 0, SEEK_SET) == 0
+            && fwrite(header, 1, sizeof(header), ctx.file) == sizeof(header);
+        ok = fclose(ctx.file) == 0 && ok;
+        ctx.file = NULL;
+        if (!ok) {
+            printf("[ERROR] movie_close: failed to write movie\n");
+        }
+    }
+
+    reset();
+    return ok;
+}
@@ -0,0 +1,81 @@
+#include "pacer.h"
+#include "gb.h"
+#include "host_time.h"
+
+#include <string.h>
+
+// Host time per frame at 1x, 59.73 Hz
+#define REAL_FRAME_NS ((uint64_t) GB_CYCLES_PER_FRAME * 1000000000 / GB_CLOCK_HZ)
+
+#define DEFAULT_REFRESH_HZ 60
+
+void pacer_init(pacer *p, uint32_t speed, uint32_t refresh_hz) {
+    memset(p, 0, sizeof(*p));
+    p->speed = speed;
+    p->frame_ns = speed == PACER_UNLIMITED ? 0 : REAL_FRAME_NS / speed;
+    p->present_ns = 1000000000 / (refresh_hz ? refresh_hz : DEFAULT_REFRESH_HZ);
+    p->drawing = 1;
+}
+
+// Until the first full period has passed the partial one is reported
+static void measure(pacer *p, uint64_t now) {
+    uint64_t span = now - p->measure_start_ns;
+
+    p->measure_frames++;
+    if (span >= PACER_MEASURE_NS || (!p->measured && span)) {
+        p->achieved = (double) p->measure_frames * REAL_FRAME_NS / span;
+    }
+    if (span >= PACER_MEASURE_NS) {
+        p->measure_start_ns = now;
+        p->measure_frames = 0;
+        p->measured = 1;
+    }
+}
+
+uint8_t pacer_frame(pacer *p) {
+    uint64_t now = host_time_ns();
+    uint8_t drew = p->drawing;
+
+    if (!p->deadline_ns) {
+        p->deadline_ns = now;
+        p->next_present_ns = now;
+        p->measure_start_ns = now;
+        p->last_ns = now;
+    }
+
+    // Deadlines advance by whole frames so rounding never drifts. After a
+    // long stall start over from now rather than rushing to catch up.
+    if (p->speed != PACER_UNLIMITED) {
+        p->deadline_ns += p->frame_ns;
+        if (now > p->deadline_ns) {
+            p->late++;
+            if (now - p->deadline_ns > p->frame_ns * PACER_MAX_FRAMES_BEHIND) {
+                p->deadline_ns = now;
+            }
+        } else {
+            host_time_sleep_until(p->deadline_ns);
+            now = host_time_ns();
+        }
+    }
+    measure(p, now);
+
+    // At 1x every frame is shown. Faster, draw the next frame only if it
+    // ends once a display refresh has passed, judging unlimited frames by
+    // how long the last one took.
+    uint64_t next_end = p->speed == PACER_UNLIMITED
+        ? now + (now - p->last_ns) : p->deadline_ns + p->frame_ns;
+    p->last_ns = now;
+
+    if (p->speed == 1) {
+        p->drawing = 1;
+    } else if (next_end < p->next_present_ns) {
+        p->drawing = 0;
+    } else {
+        p->drawing = 1;
+        p->next_present_ns += p->present_ns;
+        if (p->next_present_ns <= next_end) {
+            p->next_present_ns = next_end + p->present_ns;
+        }
+    }
+    return drew;
+}
@@ -0,0 +1,262 @@
+// pthread_once
+#define _POSIX_C_SOURCE 200112L
+
+#include "png.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// CRC-32 (reflected 0xEDB88320), four bytes per step through four tables
+// ("slicing by 4") so the lookups of a step don't wait on each other. Built
+// on first use, from whichever thread encodes first.
+static uint32_t crc_table[4][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+        }
+        crc_table[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int t = 1; t < 4; t++) {
+            uint32_t c = crc_table[t - 1][n];
+            crc_table[t][n] = crc_table[0][c & 0xFF] ^ (c >> 8);
+        }
+    }
+}
+
+static uint32_t crc32(const uint8_t *p, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (; len >= 4; len -= 4, p += 4) {
+        crc ^= (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+            | (uint32_t) p[3] << 24;
+        crc = crc_table[3][crc & 0xFF] ^ crc_table[2][(crc >> 8) & 0xFF]
+            ^ crc_table[1][(crc >> 16) & 0xFF] ^ crc_table[0][crc >> 24];
+    }
+    for (; len; len--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Largest run before the sums have to be reduced mod 65521
+#define ADLER_NMAX 5552
+
+static uint32_t adler32(uint32_t adler, const uint8_t *p, uint32_t len) {
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (len) {
+        uint32_t n = len < ADLER_NMAX ? len : ADLER_NMAX;
+        len -= n;
+        while (n--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+    return p + 4;
+}
+
+// Chunk length and type, data follows
+static uint8_t *chunk_start(uint8_t *p, uint32_t len, const char *type) {
+    p = put_u32(p, len);
+    memcpy(p, type, 4);
+    return p + 4;
+}
+
+// CRC over the type and data, `start` is what chunk_start() returned
+static uint8_t *chunk_end(uint8_t *start, uint8_t *end) {
+    return put_u32(end, crc32(start - 4, end - start + 4));
+}
+
+// Four indices into one byte, first pixel in the high bits. The multiply
+// moves each masked byte to its place in the top byte; the partial products
+// that land lower never overlap, so nothing carries into it.
+static uint8_t pack4(const uint8_t *p) {
+    uint32_t v = (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+        | (uint32_t) p[3] << 24;
+    return ((v & 0x03030303) * 0x40100401) >> 24;
+}
+
+uint32_t png_encode(const uint8_t *indices, uint32_t width, uint32_t height,
+        const uint32_t palette[4], uint8_t *out, uint32_t capacity) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint32_t row_size = PNG_ROW_SIZE(width);
+    uint32_t raw_size = row_size * height;
+    uint32_t blocks = (raw_size + PNG_STORED_BLOCK - 1) / PNG_STORED_BLOCK;
+    uint32_t zlib_size = 2 + blocks * 5 + raw_size + 4;
+
+    if (!width || !height || capacity < PNG_MAX_SIZE(width, height)) {
+        return 0;
+    }
+    pthread_once(&crc_once, crc_init);
+
+    uint8_t *p = out;
+    memcpy(p, signature, sizeof(signature));
+    p += sizeof(signature);
+
+    uint8_t *data = chunk_start(p, 13, "IHDR");
+    p = put_u32(data, width);
+    p = put_u32(p, height);
+    *p++ = 2;   // bit depth
+    *p++ = 3;   // indexed colour
+    *p++ = 0;   // deflate
+    *p++ = 0;   // adaptive filtering, each row uses filter 0 (none)
+    *p++ = 0;   // not interlaced
+    p = chunk_end(data, p);
+
+    data = chunk_start(p, 12, "PLTE");
+    p = data;
+    for (int i = 0; i < 4; i++) {
+        *p++ = palette[i] >> 16;
+        *p++ = palette[i] >> 8;
+        *p++ = palette[i];
+    }
+    p = chunk_end(data, p);
+
+    data = chunk_start(p, zlib_size, "IDAT");
+    p = data;
+    *p++ = 0x78;    // deflate, 32 KiB window
+    *p++ = 0x01;    // fastest, header check bits
+
+    // Rows are packed straight into the blocks, a block boundary can fall
+    // anywhere in a row
+    uint32_t adler = 1;
+    uint32_t left = 0;
+    uint32_t remaining = raw_size;
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *src = indices + y * width;
+        uint8_t row[PNG_ROW_SIZE(width)];
+        uint8_t *r = row;
+
+        *r++ = 0;
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4) {
+            *r++ = pack4(src + x);
+        }
+        if (x < width) {
+            uint8_t byte = 0;
+            for (uint32_t i = 0; x + i < width; i++) {
+                byte |= (src[x + i] & 0x03) << (6 - i * 2);
+            }
+            *r++ = byte;
+        }
+        adler = adler32(adler, row, row_size);
+
+        for (uint32_t done = 0; done < row_size;) {
+            if (!left) {
+                left = remaining < PNG_STORED_BLOCK ? remaining : PNG_STORED_BLOCK;
+                remaining -= left;
+                *p++ = remaining ? 0 : 1;   // BFINAL, BTYPE 00 (stored)
+                *p++ = left & 0xFF;
+                *p++ = left >> 8;
+                *p++ = ~left & 0xFF;
+                *p++ = (~left >> 8) & 0xFF;
+            }
+            uint32_t n = row_size - done < left ? row_size - done : left;
+            memcpy(p, row + done, n);
+            p += n;
+            done += n;
+            left -= n;
+        }
+    }
+    p = put_u32(p, adler);
+    p = chunk_end(data, p);
+
+    data = chunk_start(p, 0, "IEND");
+    p = chunk_end(data, data);
+    return p - out;
+}
+
+uint8_t png_decode(const uint8_t *data, uint32_t size, uint32_t width, uint32_t height,
+        uint8_t *indices) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static const uint8_t header[5] = { 2, 3, 0, 0, 0 };
+    uint32_t row_size = PNG_ROW_SIZE(width);
+    uint32_t y = 0;
+    uint32_t x = 0;          // byte within the row, 0 is the filter byte
+    uint32_t left = 0;       // of the current stored block
+    uint8_t last_block = 0;
+    uint8_t zlib_header = 2;
+    uint8_t block_header[5];
+    uint32_t header_bytes = 0;
+    uint8_t seen_ihdr = 0;
+
+    if (size < sizeof(signature) || memcmp(data, signature, sizeof(signature)) != 0) {
+        return 0;
+    }
+    for (uint32_t pos = sizeof(signature); pos + 12 <= size;) {
+        uint32_t len = get_u32(data + pos);
+        const uint8_t *type = data + pos + 4;
+        const uint8_t *p = data + pos + 8;
+        if (len > size - pos - 12) {
+            return 0;
+        }
+        pos += len + 12;
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (len != 13 || get_u32(p) != width || get_u32(p + 4) != height
+                    || memcmp(p + 8, header, sizeof(header)) != 0) {
+                return 0;
+            }
+            seen_ihdr = 1;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        } else if (memcmp(type, "IDAT", 4) == 0 && seen_ihdr) {
+            // The zlib stream may be split across IDAT chunks at any byte
+            for (const uint8_t *end = p + len; p < end;) {
+                if (zlib_header) {
+                    zlib_header--;
+                    p++;
+                } else if (!left && y == height) {
+                    break;
+                } else if (!left) {
+                    block_header[header_bytes++] = *p++;
+                    if (header_bytes < 5) {
+                        continue;
+                    }
+                    header_bytes = 0;
+                    if (last_block || (block_header[0] & 0x06) != 0) {
+                        return 0;
+                    }
+                    last_block = block_header[0] & 0x01;
+                    left = block_header[1] | block_header[2] << 8;
+                } else {
+                    if (!x && *p != 0) {
+                        return 0;
+                    } else if (x) {
+                        uint8_t *out = indices + y * width + (x - 1) * 4;
+                        for (uint32_t i = 0; i < 4 && (x - 1) * 4 + i < width; i++) {
+                            out[i] = (*p >> (6 - i * 2)) & 0x03;
+                        }
+                    }
+                    p++;
+                    left--;
+                    if (++x == row_size) {
+                        x = 0;
+                        y++;
+                    }
+                }
+            }
+        }
+    }
+    return y == height;
+}
@@ -1,6 +1,12 @@
 #include "ppu.h"
 #include "ppu_fetcher.h"
 #include "bus.h"
+#include "cpu.h"
+#include "io.h"
+#include "gb.h"
+#include "machine.h"
+
+#include <string.h>
 
 #define LCD_CTRL_ADDR 0xFF40
 #define LCD_STAT_ADDR 0xFF41
@@ -11,35 +17,47 @@
 #define LCD_WY_ADDR   0xFF4A
 #define LCD_WX_ADDR   0xFF4B
 
-static ppu_context ctx;
-
-static ppu_fetcher fetcher;
+#define ctx     (machine->ppu)
+#define fetcher (machine->fetcher)
 
-uint8_t ppu_view[GB_SCREEN_RES_X * GB_SCREEN_RES_Y * 3];
-uint8_t ppu_view_updated;
+uint8_t ppu_reg_read(uint16_t addr);
+void ppu_reg_write(uint16_t addr, uint8_t value);
 
-void read_reg_to_ctx(void);
-void write_reg_from_ctx(void);
+// STAT mode bits for each ppu_state
+static const uint8_t stat_mode[4] = {
+    [OAM_SCAN]  = 2,
+    [DRAW_LINE] = 3,
+    [H_BLANK]   = 0,
+    [V_BLANK]   = 1,
+};
 
 void ppu_init(void) {
-    ctx.state = OAM_SCAN;
+    // The boot ROM hands over in VBlank, LY 145 and STAT mode 1 below
+    ctx.state = V_BLANK;
     ctx.cycles = 0;
     ctx.n_line_pixels_drawn = 0;
-    ctx.bg_idx = 0;
+    ctx.front = 0;
+    memset(machine->framebuffer, 0, sizeof(machine->framebuffer));
 
-    bus_write(LCD_CTRL_ADDR, 0x91);
-    bus_write(LCD_STAT_ADDR, 0x81);
-    bus_write(LCD_SCY_ADDR,  0x00);
-    bus_write(LCD_SCX_ADDR,  0x00);
-    bus_write(LCD_LY_ADDR,   0x91);
-    bus_write(LCD_LYC_ADDR,  0x00);
+    for (uint16_t addr = LCD_CTRL_ADDR; addr <= LCD_LYC_ADDR; addr++) {
+        io_register(addr, ppu_reg_read, ppu_reg_write);
+    }
+    io_register(LCD_WY_ADDR, ppu_reg_read, ppu_reg_write);
+    io_register(LCD_WX_ADDR, ppu_reg_read, ppu_reg_write);
+
+    ppu_reg_write(LCD_CTRL_ADDR, 0x91);
+    ctx.STAT = 0x81;
+    ctx.SCY  = 0x00;
+    ctx.SCX  = 0x00;
+    ctx.LY   = 0x91;
+    ctx.LYC  = 0x00;
+    ctx.WY   = 0x00;
+    ctx.WX   = 0x00;
 
     ppu_feetcher_init(&fetcher);
 }
 
 void ppu_step(void) {
-    read_reg_to_ctx();
-
     if (!ctx.ppu_enable) {
         return;
     }
@@ -70,14 +88,13 @@ void ppu_step(void) {
                 break;
             }
 
-            // 85 = 255/3
-            uint8_t pixel = queue_pop(&fetcher.queue) * 85;
+            uint8_t pixel = queue_pop(&fetcher.queue);
 
-            ctx.bg_idx = (ctx.bg_idx + 1) % (PPU_BG_SIZE * PPU_BG_SIZE);
-
-            ctx.bg[ctx.bg_idx][0] = pixel;
-            ctx.bg[ctx.bg_idx][1] = pixel;
-            ctx.bg[ctx.bg_idx][2] = pixel;
+            // The fetcher has already applied the scroll, so pixels land at
+            // their screen position
+            if (!ctx.skip_pixels) {
+                ppu_back[ctx.LY * GB_SCREEN_RES_X + ctx.n_line_pixels_drawn] = pixel;
+            }
 
             ctx.n_line_pixels_drawn++;
             if (ctx.n_line_pixels_drawn == GB_SCREEN_RES_X) {
@@ -90,10 +107,15 @@ void ppu_step(void) {
                 ctx.cycles = 0;
                 ctx.LY++;
                 if (ctx.LY == 144) {
-                    // Frame completed, raise flag for SDL to draw
+                    // Frame completed
                     ctx.state = V_BLANK;
-                    ppu_update_view();
-                    ppu_view_updated = 1;
+                    if (!ctx.skip_pixels) {
+                        ppu_update_view();
+                    }
+                    cpu_request_interrupt(INT_VBLANK);
+                    if (emu_until & GB_UNTIL_FRAME) {
+                        emu_stop(GB_STOP_FRAME);
+                    }
                 } else {
                     ctx.state = OAM_SCAN;
                 }
@@ -106,118 +128,105 @@ void ppu_step(void) {
                 ctx.LY++;
                 if (ctx.LY == 153) {
                     ctx.LY = 0;
-                    ctx.bg_idx = 0;  // stops the sliding around in BG
                     ctx.state = OAM_SCAN;
                 }
             }
             break;
     }
+}
 
-    write_reg_from_ctx();
+void ppu_skip_pixels(uint8_t skip) {
+    ctx.skip_pixels = skip;
 }
 
 void ppu_update_view(void) {
-    uint32_t i;
-    uint32_t bg_i;
-    uint8_t screen_x;
-    uint8_t screen_y;
-
-    for (int y = 0; y < GB_SCREEN_RES_Y; y++) {
-        for (int x = 0; x < GB_SCREEN_RES_X; x++) {
-            screen_x = (x + ctx.SCX) % PPU_BG_SIZE;
-            screen_y = (y + ctx.SCY) % PPU_BG_SIZE;
-            bg_i = screen_y * GB_SCREEN_RES_X + screen_x;
-            i = y * GB_SCREEN_RES_X + x;
-            ppu_view[i * 3]     = ctx.bg[bg_i][0];
-            ppu_view[i * 3 + 1] = ctx.bg[bg_i][1];
-            ppu_view[i * 3 + 2] = ctx.bg[bg_i][2];
-
-            // // Tile grid lines
-            // if (x % 8 == 0 || y % 8 == 0) {
-            //     ppu_view[i * 3]     = 255;
-            //     ppu_view[i * 3 + 1] = 255;
-            //     ppu_view[i * 3 + 2] = 255;
-            // }
-        }
-    }
+    // Release, so a thread that sees the new index also sees its pixels
+    __atomic_store_n(&ctx.front, ctx.front ^ 1, __ATOMIC_RELEASE);
+}
 
-    // Print BG to stdout
-    // uint8_t chars[4] = {' ', '/', '%', '#'};
-    // for (int x = 0; x < PPU_BG_SIZE; x++) {
-    //     printf("-");
-    // }
-    // printf("\n");
-    // for (int y = 0; y < PPU_BG_SIZE; y++) {
-    //     printf("|");
-    //     for (int x = 0; x < ctx.SCX; x++) {
-    //         if (x == ctx.SCX || y == ctx.SCY || x - GB_SCREEN_RES_X == ctx.SCX || y - GB_SCREEN_RES_Y == ctx.SCY) {
-    //             printf("v");
-    //         } else {
-    //             printf(" ");
-    //         }
-    //     }
-    //     for (int x = 0; x < GB_SCREEN_RES_X; x++) {
-    //         if (x == ctx.SCX || y == ctx.SCY || x - GB_SCREEN_RES_X == ctx.SCX || y - GB_SCREEN_RES_Y == ctx.SCY) {
-    //             printf("v");
-    //         } else {
-    //             // printf(" ");
-    //             i = y * GB_SCREEN_RES_X + x;
-    //             printf("%c", chars[ctx.bg[i][0] / 85]);
-    //         }
-    //     }
-    //     for (int x = ctx.SCX + GB_SCREEN_RES_X; x < PPU_BG_SIZE - 1; x++) {
-    //         if (x == ctx.SCX || y == ctx.SCY || x - GB_SCREEN_RES_X == ctx.SCX || y - GB_SCREEN_RES_Y == ctx.SCY) {
-    //             printf("v");
-    //         } else {
-    //             printf(" ");
-    //         }
-    //     }
-    //     printf("|\n");
-    // }
-    // for (int x = 0; x < PPU_BG_SIZE; x++) {
-    //     printf("-");
-    // }
-    // printf("\n\n");
+uint8_t ppu_reg_read(uint16_t addr) {
+    switch (addr) {
+        case LCD_CTRL_ADDR:
+            return ctx.bg_window_enable
+                | (ctx.obj_enable      << 1)
+                | (ctx.obj_size        << 2)
+                | (ctx.bg_tile         << 3)
+                | (ctx.bg_window_tile  << 4)
+                | (ctx.window_enable   << 5)
+                | (ctx.window_tile_map << 6)
+                | (ctx.ppu_enable      << 7);
+        case LCD_STAT_ADDR:
+            // Mode and coincidence are derived on read rather than kept in sync
+            return (ctx.STAT & 0x78)
+                | ((ctx.LY == ctx.LYC) << 2)
+                | stat_mode[ctx.state];
+        case LCD_SCY_ADDR: return ctx.SCY;
+        case LCD_SCX_ADDR: return ctx.SCX;
+        case LCD_LY_ADDR:  return ctx.LY;
+        case LCD_LYC_ADDR: return ctx.LYC;
+        case LCD_WY_ADDR:  return ctx.WY;
+        case LCD_WX_ADDR:  return ctx.WX;
+        default:
+            printf("[WARN] ppu_reg_read bad address %04X\n", addr);
+            return 0xFF;
+    }
+}
 
+void ppu_reg_write(uint16_t addr, uint8_t value) {
+    switch (addr) {
+        case LCD_CTRL_ADDR:
+            ctx.bg_window_enable = value & 0x01;
+            ctx.obj_enable       = (value >> 1) & 0x01;
+            ctx.obj_size         = (value >> 2) & 0x01;
+            ctx.bg_tile          = (value >> 3) & 0x01;
+            ctx.bg_window_tile   = (value >> 4) & 0x01;
+            ctx.window_enable    = (value >> 5) & 0x01;
+            ctx.window_tile_map  = (value >> 6) & 0x01;
+            ctx.ppu_enable       = (value >> 7) & 0x01;
+            break;
+        case LCD_STAT_ADDR:
+            // Only the interrupt source selects are writable
+            ctx.STAT = (ctx.STAT & 0x07) | (value & 0x78);
+            break;
+        case LCD_SCY_ADDR: ctx.SCY = value; break;
+        case LCD_SCX_ADDR: ctx.SCX = value; break;
+        case LCD_LY_ADDR:  break;  // read only
+        case LCD_LYC_ADDR: ctx.LYC = value; break;
+        case LCD_WY_ADDR:  ctx.WY  = value; break;
+        case LCD_WX_ADDR:  ctx.WX  = value; break;
+        default:
+            printf("[WARN] ppu_reg_write bad address %04X\n", addr);
+            break;
+    }
 }
 
-void read_reg_to_ctx(void) {
-    uint8_t LCDC = bus_read(LCD_CTRL_ADDR);
-
-    ctx.bg_window_enable = LCDC & 0x01;
-    ctx.obj_enable       = (LCDC >> 1) & 0x01;
-    ctx.obj_size         = (LCDC >> 2) & 0x01;
-    ctx.bg_tile          = (LCDC >> 3) & 0x01;
-    ctx.bg_window_tile   = (LCDC >> 4) & 0x01;
-    ctx.window_enable    = (LCDC >> 5) & 0x01;
-    ctx.window_tile_map  = (LCDC >> 6) & 0x01;
-    ctx.ppu_enable       = (LCDC >> 7) & 0x01;
-
-    ctx.STAT = bus_read(LCD_STAT_ADDR);
-    ctx.SCY  = bus_read(LCD_SCY_ADDR);
-    ctx.SCX  = bus_read(LCD_SCX_ADDR);
-    ctx.LY   = bus_read(LCD_LY_ADDR);
-    ctx.LYC  = bus_read(LCD_LYC_ADDR);
-    ctx.WY   = bus_read(LCD_WY_ADDR);
-    ctx.WX   = bus_read(LCD_WX_ADDR);
+// The view and back framebuffers are paged memory, saved by the state module
+void ppu_save(state_buffer *s) {
+    state_put_u8(s, ppu_reg_read(LCD_CTRL_ADDR));
+    state_put_u8(s, ctx.STAT);
+    state_put_u8(s, ctx.SCY);
+    state_put_u8(s, ctx.SCX);
+    state_put_u8(s, ctx.LY);
+    state_put_u8(s, ctx.LYC);
+    state_put_u8(s, ctx.WX);
+    state_put_u8(s, ctx.WY);
+    state_put_u8(s, ctx.state);
+    state_put_u16(s, ctx.cycles);
+    state_put_u8(s, ctx.n_line_pixels_drawn);
+    ppu_fetcher_save(&fetcher, s);
 }
 
-void write_reg_from_ctx(void) {
-    uint8_t LCDC = ctx.bg_window_enable
-        | (ctx.obj_enable      << 1)
-        | (ctx.obj_size        << 2)
-        | (ctx.bg_tile         << 3)
-        | (ctx.bg_window_tile  << 4)
-        | (ctx.window_enable   << 5)
-        | (ctx.window_tile_map << 6)
-        | (ctx.ppu_enable      << 7);
-    
-    bus_write(LCD_CTRL_ADDR, LCDC);
-    bus_write(LCD_STAT_ADDR, ctx.STAT);
-    bus_write(LCD_SCY_ADDR,  ctx.SCY);
-    bus_write(LCD_SCX_ADDR,  ctx.SCX);
-    bus_write(LCD_LY_ADDR,   ctx.LY);
-    bus_write(LCD_LYC_ADDR,  ctx.LYC);
-    bus_write(LCD_WY_ADDR,   ctx.WY);
-    bus_write(LCD_WX_ADDR,   ctx.WX);
+void ppu_load(state_buffer *s) {
+    ppu_reg_write(LCD_CTRL_ADDR, state_get_u8(s));
+    ctx.STAT = state_get_u8(s);
+    ctx.SCY = state_get_u8(s);
+    ctx.SCX = state_get_u8(s);
+    ctx.LY = state_get_u8(s);
+    ctx.LYC = state_get_u8(s);
+    ctx.WX = state_get_u8(s);
+    ctx.WY = state_get_u8(s);
+    ctx.state = state_get_u8(s);
+    ctx.cycles = state_get_u16(s);
+    ctx.n_line_pixels_drawn = state_get_u8(s);
+    ppu_fetcher_load(&fetcher, s);
 }
@@ -2,6 +2,8 @@
 #include "ppu.h"
 #include "bus.h"
 
+#include <string.h>
+
 #define TILE_MAP_SIZE 16
 #define TILE_MAP_WIDTH 32
 #define TILE_SIDE_LENGTH 8
@@ -40,15 +42,9 @@ uint8_t queue_pop(queue *q) {
 }
 
 void ppu_feetcher_init(ppu_fetcher *f) {
+    // Everything is saved in states, so nothing may carry over a reset
+    memset(f, 0, sizeof(*f));
     f->cycles = 1;
-    f->row_data[0] = 0;
-    f->row_data[1] = 0;
-    f->row_data[2] = 0;
-    f->row_data[3] = 0;
-    f->row_data[4] = 0;
-    f->row_data[5] = 0;
-    f->row_data[6] = 0;
-    f->row_data[7] = 0;
 }
 
 // Prepare the PPU Fetcher to begin at a new scanline.
@@ -134,4 +130,34 @@ void ppu_fetcher_step(ppu_fetcher *f, uint8_t signed_addr_mode) {
             break;
 
     }
+}
+
+void ppu_fetcher_save(ppu_fetcher *f, state_buffer *s) {
+    state_put_bytes(s, f->queue.buffer, FETCHER_QUEUE_SIZE);
+    state_put_u8(s, f->queue.read);
+    state_put_u8(s, f->queue.write);
+    state_put_u8(s, f->queue.count);
+    state_put_u8(s, f->cycles);
+    state_put_u8(s, f->state);
+    state_put_bytes(s, f->row_data, sizeof(f->row_data));
+    state_put_u16(s, f->tile_map_line_addr);
+    state_put_u8(s, f->tile_map_index_in_line);
+    state_put_u8(s, f->tile_id);
+    state_put_u16(s, f->tile_addr);
+    state_put_u8(s, f->tile_current_line);
+}
+
+void ppu_fetcher_load(ppu_fetcher *f, state_buffer *s) {
+    state_get_bytes(s, f->queue.buffer, FETCHER_QUEUE_SIZE);
+    f->queue.read = state_get_u8(s);
+    f->queue.write = state_get_u8(s);
+    f->queue.count = state_get_u8(s);
+    f->cycles = state_get_u8(s);
+    f->state = state_get_u8(s);
+    state_get_bytes(s, f->row_data, sizeof(f->row_data));
+    f->tile_map_line_addr = state_get_u16(s);
+    f->tile_map_index_in_line = state_get_u8(s);
+    f->tile_id = state_get_u8(s);
+    f->tile_addr = state_get_u16(s);
+    f->tile_current_line = state_get_u8(s);
 }
\ No newline at end of file
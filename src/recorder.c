@@ -0,0 +1,143 @@
+// pthreads, semaphores, posix_memalign
+#define _POSIX_C_SOURCE 200112L
+
+#include "recorder.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t repeats;   // of the previous frame, before this one
+    uint8_t  end;       // no frame, the writer stops after the repeats
+    uint8_t  pixels[RECORDER_FRAME_SIZE] __attribute__((aligned(64)));
+} recorder_slot;
+
+// The indices follow the single producer, single consumer pattern of the
+// joypad queue. The semaphores only put the side that has to wait to sleep.
+struct recorder {
+    recorder_slot    slots[RECORDER_SLOTS];
+    recorder_sink    sink;
+    gb_record_policy policy;
+    pthread_t        writer;
+    sem_t            filled;
+    sem_t            free;
+
+    // Producer
+    uint32_t         head __attribute__((aligned(64)));
+    const uint8_t   *last;      // pixels of the last frame queued
+    uint64_t         pending;   // repeats not yet queued
+    recorder_stats   stats;
+
+    // Consumer
+    uint32_t         tail __attribute__((aligned(64)));
+    uint8_t          failed;
+};
+
+static void *writer_main(void *arg) {
+    recorder *r = arg;
+    uint64_t index = 0;
+
+    for (;;) {
+        while (sem_wait(&r->filled) != 0) {
+        }
+        recorder_slot *slot = &r->slots[r->tail & (RECORDER_SLOTS - 1)];
+
+        for (uint64_t i = 0; i < slot->repeats && !r->failed; i++) {
+            r->failed = !r->sink.frame(r->sink.user, NULL, index++);
+        }
+        if (slot->end) {
+            break;
+        }
+        if (!r->failed) {
+            r->failed = !r->sink.frame(r->sink.user, slot->pixels, index++);
+        }
+        __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+        sem_post(&r->free);
+    }
+    return NULL;
+}
+
+recorder *recorder_start(recorder_sink sink, gb_record_policy policy) {
+    void *p;
+
+    if (posix_memalign(&p, 64, sizeof(recorder)) != 0) {
+        printf("[ERROR] recorder_start: malloc fail\n");
+        return NULL;
+    }
+    recorder *r = p;
+    memset(r, 0, sizeof(*r));
+    r->sink = sink;
+    r->policy = policy;
+    sem_init(&r->filled, 0, 0);
+    sem_init(&r->free, 0, RECORDER_SLOTS);
+
+    if (pthread_create(&r->writer, NULL, writer_main, r) != 0) {
+        printf("[ERROR] recorder_start: can't start writer thread\n");
+        sem_destroy(&r->filled);
+        sem_destroy(&r->free);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// A free slot, or NULL if the ring is full and frames may be dropped
+static recorder_slot *claim(recorder *r, gb_record_policy policy) {
+    if (sem_trywait(&r->free) != 0) {
+        if (policy == GB_RECORD_DROP) {
+            return NULL;
+        }
+        r->stats.stalls++;
+        while (sem_wait(&r->free) != 0) {
+        }
+    }
+    recorder_slot *slot = &r->slots[r->head & (RECORDER_SLOTS - 1)];
+    slot->repeats = r->pending;
+    slot->end = 0;
+    r->pending = 0;
+    return slot;
+}
+
+static void publish(recorder *r) {
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+    sem_post(&r->filled);
+}
+
+void recorder_push(recorder *r, const uint8_t *frame) {
+    r->stats.frames++;
+
+    // The last queued slot is never the next one claimed, so it is safe to
+    // compare against while the writer reads it
+    if (r->last && memcmp(frame, r->last, RECORDER_FRAME_SIZE) == 0) {
+        r->pending++;
+        return;
+    }
+    recorder_slot *slot = claim(r, r->policy);
+    if (!slot) {
+        r->stats.dropped++;
+        r->pending++;
+        return;
+    }
+    memcpy(slot->pixels, frame, RECORDER_FRAME_SIZE);
+    r->last = slot->pixels;
+    r->stats.unique++;
+    publish(r);
+}
+
+uint8_t recorder_stop(recorder *r) {
+    recorder_slot *slot = claim(r, GB_RECORD_BLOCK);
+    slot->end = 1;
+    publish(r);
+    pthread_join(r->writer, NULL);
+
+    uint8_t ok = !r->failed;
+    sem_destroy(&r->filled);
+    sem_destroy(&r->free);
+    free(r);
+    return ok;
+}
+
+recorder_stats recorder_get_stats(const recorder *r) {
+    return r->stats;
+}
@@ -0,0 +1,270 @@
+#include "rewind.h"
+#include "state.h"
+
+#include <string.h>
+
+// Each frame is stored as its save state XORed with the previous frame's,
+// which is mostly zeros, then run-length coded. XOR is its own inverse, so
+// the same delta that moved forward moves back: stepping back is one decode
+// into the newest state and a state load. Keyframes hold a whole coded state
+// every REWIND_KEYFRAME_INTERVAL frames, so history survives a broken chain.
+//
+// Coding: a control byte below 0x80 is followed by that many plus one literal
+// bytes. From 0x80 up it and the next byte give a run of ((c & 0x7F) << 8 |
+// next) + 1 zero bytes.
+
+#define LITERAL_MAX  0x80
+#define ZERO_RUN_MAX 0x8000
+// Zero runs shorter than this stay inside literals, a run costs two bytes
+#define ZERO_RUN_MIN 3
+
+typedef struct {
+    uint32_t offset;     // into the arena
+    uint32_t delta_len;
+    uint32_t key_len;    // 0 for frames without a keyframe, follows the delta
+} rewind_entry;
+
+static struct {
+    uint8_t      *arena;
+    uint32_t      arena_bytes;
+    uint32_t      write;      // next free arena offset
+    rewind_entry *entries;    // ring of max_frames
+    uint32_t      max_frames;
+    uint32_t      first;      // oldest entry
+    uint32_t      count;
+    uint64_t      pushed;     // frames pushed since init, picks keyframes
+    uint8_t      *current;    // decoded newest state
+    uint8_t      *next;       // scratch for the incoming state
+    uint8_t      *coded;      // scratch for coding, worst case size
+    uint32_t      state_bytes;
+} ctx;
+
+static uint32_t coded_bound(uint32_t len) {
+    return len + len / LITERAL_MAX + 1;
+}
+
+static uint8_t xor_at(const uint8_t *a, const uint8_t *b, uint32_t i) {
+    return b ? a[i] ^ b[i] : a[i];
+}
+
+// Code `a`, or `a` XOR `b` when `b` is given, into `out`. Returns the length.
+static uint32_t encode(const uint8_t *a, const uint8_t *b, uint32_t len, uint8_t *out) {
+    uint32_t i = 0;
+    uint32_t o = 0;
+
+    while (i < len) {
+        // Zero run, compared a word at a time where possible
+        uint32_t start = i;
+        while (i + 8 <= len && i - start + 8 <= ZERO_RUN_MAX) {
+            uint64_t x, y = 0;
+            memcpy(&x, a + i, 8);
+            if (b) {
+                memcpy(&y, b + i, 8);
+            }
+            if (x != y) {
+                break;
+            }
+            i += 8;
+        }
+        while (i < len && i - start < ZERO_RUN_MAX && !xor_at(a, b, i)) {
+            i++;
+        }
+        if (i - start >= ZERO_RUN_MIN || i == len) {
+            if (i > start) {
+                uint32_t run = i - start - 1;
+                out[o++] = 0x80 | (run >> 8);
+                out[o++] = run & 0xFF;
+            }
+            continue;
+        }
+
+        // Literal run, ending at a worthwhile zero run or the length limit
+        i = start;
+        uint32_t ctrl = o++;
+        uint32_t n = 0;
+        while (i < len && n < LITERAL_MAX) {
+            if (i + ZERO_RUN_MIN <= len && !xor_at(a, b, i)
+                    && !xor_at(a, b, i + 1) && !xor_at(a, b, i + 2)) {
+                break;
+            }
+            out[o++] = xor_at(a, b, i);
+            i++;
+            n++;
+        }
+        out[ctrl] = n - 1;
+    }
+    return o;
+}
+
+// Decode into `dest`, XORing with its contents or overwriting them.
+static void decode(const uint8_t *in, uint32_t in_len, uint8_t *dest, uint8_t xor) {
+    uint32_t i = 0;
+    uint32_t d = 0;
+
+    while (i < in_len) {
+        uint8_t ctrl = in[i++];
+        if (ctrl & 0x80) {
+            uint32_t run = (((ctrl & 0x7F) << 8) | in[i++]) + 1;
+            if (!xor) {
+                memset(dest + d, 0, run);
+            }
+            d += run;
+        } else if (xor) {
+            for (uint32_t n = 0; n <= ctrl; n++) {
+                dest[d++] ^= in[i++];
+            }
+        } else {
+            memcpy(dest + d, in + i, ctrl + 1);
+            d += ctrl + 1;
+            i += ctrl + 1;
+        }
+    }
+}
+
+uint8_t rewind_init(uint32_t max_frames, uint32_t arena_bytes) {
+    rewind_free();
+
+    ctx.state_bytes = state_size();
+    uint32_t minimum = coded_bound(ctx.state_bytes) * 4;
+    if (!arena_bytes) {
+        uint64_t wanted = (uint64_t) max_frames * REWIND_DEFAULT_FRAME_BYTES + minimum;
+        arena_bytes = wanted > UINT32_MAX ? UINT32_MAX : wanted;
+    }
+    // The arena has to hold at least the worst case delta and keyframe twice
+    if (arena_bytes < minimum || !max_frames) {
+        printf("[ERROR] rewind_init: arena too small\n");
+        return 0;
+    }
+
+    ctx.arena       = malloc(arena_bytes);
+    ctx.entries     = malloc(max_frames * sizeof(rewind_entry));
+    ctx.current     = malloc(ctx.state_bytes);
+    ctx.next        = malloc(ctx.state_bytes);
+    ctx.coded       = malloc(coded_bound(ctx.state_bytes) * 2);
+    if (!ctx.arena || !ctx.entries || !ctx.current || !ctx.next || !ctx.coded) {
+        printf("[ERROR] rewind_init: malloc fail\n");
+        rewind_free();
+        return 0;
+    }
+
+    ctx.arena_bytes = arena_bytes;
+    ctx.max_frames  = max_frames;
+    ctx.write  = 0;
+    ctx.first  = 0;
+    ctx.count  = 0;
+    ctx.pushed = 0;
+    return 1;
+}
+
+void rewind_free(void) {
+    free(ctx.arena);
+    free(ctx.entries);
+    free(ctx.current);
+    free(ctx.next);
+    free(ctx.coded);
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+void rewind_reset(void) {
+    if (rewind_enabled()) {
+        // The state size may have changed with the cartridge
+        rewind_init(ctx.max_frames, ctx.arena_bytes);
+    }
+}
+
+uint8_t rewind_enabled(void) {
+    return ctx.arena != NULL;
+}
+
+static rewind_entry *entry(uint32_t n) {
+    return &ctx.entries[(ctx.first + n) % ctx.max_frames];
+}
+
+static void drop_oldest(void) {
+    ctx.first = (ctx.first + 1) % ctx.max_frames;
+    ctx.count--;
+}
+
+// Reserve `len` contiguous arena bytes after the newest entry, evicting the
+// oldest entries that overlap.
+static uint32_t reserve(uint32_t len) {
+    if (ctx.write + len > ctx.arena_bytes) {
+        // Entries between the write position and the end are evicted below
+        while (ctx.count && entry(0)->offset >= ctx.write) {
+            drop_oldest();
+        }
+        ctx.write = 0;
+    }
+    while (ctx.count) {
+        rewind_entry *oldest = entry(0);
+        if (oldest->offset >= ctx.write + len || oldest->offset < ctx.write) {
+            break;
+        }
+        drop_oldest();
+    }
+
+    uint32_t offset = ctx.write;
+    ctx.write += len;
+    return offset;
+}
+
+void rewind_push(void) {
+    if (!rewind_enabled()) {
+        return;
+    }
+
+    state_save(ctx.next);
+
+    uint32_t delta_len = ctx.count ? encode(ctx.next, ctx.current, ctx.state_bytes, ctx.coded) : 0;
+    uint32_t key_len = 0;
+    if (!ctx.count || ctx.pushed % REWIND_KEYFRAME_INTERVAL == 0) {
+        key_len = encode(ctx.next, NULL, ctx.state_bytes, ctx.coded + delta_len);
+    }
+
+    if (ctx.count == ctx.max_frames) {
+        drop_oldest();
+    }
+    rewind_entry e = { reserve(delta_len + key_len), delta_len, key_len };
+    memcpy(ctx.arena + e.offset, ctx.coded, delta_len + key_len);
+    *entry(ctx.count) = e;
+    ctx.count++;
+    ctx.pushed++;
+
+    uint8_t *swap = ctx.current;
+    ctx.current = ctx.next;
+    ctx.next = swap;
+}
+
+uint8_t rewind_step_back(void) {
+    if (ctx.count < 2) {
+        return 0;
+    }
+
+    rewind_entry *newest = entry(ctx.count - 1);
+    rewind_entry *previous = entry(ctx.count - 2);
+
+    if (previous->key_len) {
+        decode(ctx.arena + previous->offset + previous->delta_len, previous->key_len,
+            ctx.current, 0);
+    } else {
+        decode(ctx.arena + newest->offset, newest->delta_len, ctx.current, 1);
+    }
+
+    // The newest entry is freed, the next push reuses its arena space
+    ctx.write = newest->offset;
+    ctx.count--;
+    ctx.pushed--;
+    return state_load(ctx.current, ctx.state_bytes);
+}
+
+rewind_stats rewind_get_stats(void) {
+    rewind_stats stats = { 0, 0, 0, ctx.arena_bytes, ctx.state_bytes };
+
+    for (uint32_t n = 0; n < ctx.count; n++) {
+        rewind_entry *e = entry(n);
+        stats.bytes_used += e->delta_len + e->key_len;
+        stats.keyframes += e->key_len != 0;
+    }
+    stats.frames = ctx.count ? ctx.count - 1 : 0;
+    return stats;
+}
@@ -0,0 +1,488 @@
+#include "scale.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCALE_X86
+#endif
+
+#define W GB_SCREEN_RES_X
+#define H GB_SCREEN_RES_Y
+
+// Source copy with a one pixel border repeating the edges, so every kernel
+// can read its neighbours without bounds checks
+#define PAD_W (W + 2)
+#define PAD_H (H + 2)
+
+const uint32_t scale_grey_palette[4] = { 0xFF000000, 0xFF555555, 0xFFAAAAAA, 0xFFFFFFFF };
+
+typedef struct {
+    // Colour indices to ARGB
+    void (*lookup)(const uint8_t *idx, uint32_t *out, uint32_t n, const uint32_t *palette);
+    // Repeat each index twice
+    void (*expand2)(const uint8_t *in, uint8_t *out, uint32_t n);
+    // Scale2x of one row, `mid` points into a padded row
+    void (*epx)(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out0, uint8_t *out1, uint32_t n);
+    void (*scale3x)(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out0, uint8_t *out1, uint8_t *out2, uint32_t n);
+    // 3:1 mix towards `edge`, equal inputs pass through unchanged
+    void (*blend)(const uint32_t *edge, const uint32_t *base, uint32_t *out, uint32_t n);
+} scale_kernels;
+
+// Scalar kernels, also finishing the tails of the vector ones
+
+static void lookup_scalar(const uint8_t *idx, uint32_t *out, uint32_t n,
+        const uint32_t *palette) {
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = palette[idx[i] & 3];
+    }
+}
+
+static void expand2_scalar(const uint8_t *in, uint8_t *out, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        out[i * 2] = in[i];
+        out[i * 2 + 1] = in[i];
+    }
+}
+
+// With A above, B right, C left and D below P, as in the Scale2x description
+static void epx_scalar(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out0, uint8_t *out1, uint32_t n) {
+    for (uint32_t x = 0; x < n; x++) {
+        const uint8_t *m = mid + x;
+        uint8_t a = up[x], b = m[1], c = m[-1], d = down[x], p = m[0];
+        out0[x * 2]     = c == a && c != d && a != b ? a : p;
+        out0[x * 2 + 1] = a == b && a != c && b != d ? b : p;
+        out1[x * 2]     = d == c && d != b && c != a ? c : p;
+        out1[x * 2 + 1] = b == d && b != a && d != c ? d : p;
+    }
+}
+
+// Neighbours named A-I row by row with E the source pixel, as in the Scale3x
+// description
+static void scale3x_scalar(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out0, uint8_t *out1, uint8_t *out2, uint32_t n) {
+    for (uint32_t x = 0; x < n; x++) {
+        const uint8_t *u = up + x, *m = mid + x, *w = down + x;
+        uint8_t a = u[-1], b = u[0], c = u[1];
+        uint8_t d = m[-1], e = m[0], f = m[1];
+        uint8_t g = w[-1], h = w[0], i = w[1];
+        uint8_t db = d == b && b != f && d != h;
+        uint8_t bf = b == f && b != d && f != h;
+        uint8_t dh = d == h && d != b && h != f;
+        uint8_t hf = h == f && d != h && b != f;
+
+        out0[x * 3]     = db ? d : e;
+        out0[x * 3 + 1] = (db && e != c) || (bf && e != a) ? b : e;
+        out0[x * 3 + 2] = bf ? f : e;
+        out1[x * 3]     = (db && e != g) || (dh && e != a) ? d : e;
+        out1[x * 3 + 1] = e;
+        out1[x * 3 + 2] = (bf && e != i) || (hf && e != c) ? f : e;
+        out2[x * 3]     = dh ? d : e;
+        out2[x * 3 + 1] = (dh && e != i) || (hf && e != g) ? h : e;
+        out2[x * 3 + 2] = hf ? f : e;
+    }
+}
+
+static uint32_t avg_channels(uint32_t a, uint32_t b) {
+    // Rounds up per byte like pavgb
+    return (a | b) - (((a ^ b) >> 1) & 0x7F7F7F7F);
+}
+
+static void blend_scalar(const uint32_t *edge, const uint32_t *base, uint32_t *out,
+        uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = avg_channels(edge[i], avg_channels(base[i], edge[i]));
+    }
+}
+
+#ifdef SCALE_X86
+
+// SSE2, 16 indices or 4 colours per step
+
+static __m128i select128(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Four 32-bit indices to colours, a compare per palette entry
+static __m128i lookup4_sse2(__m128i idx, const __m128i *pal) {
+    __m128i c = _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_setzero_si128()), pal[0]);
+    c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(1)), pal[1]));
+    c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(2)), pal[2]));
+    return _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(3)), pal[3]));
+}
+
+static void lookup_sse2(const uint8_t *idx, uint32_t *out, uint32_t n,
+        const uint32_t *palette) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i pal[4];
+    uint32_t i = 0;
+
+    for (int k = 0; k < 4; k++) {
+        pal[k] = _mm_set1_epi32(palette[k]);
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *) (idx + i)),
+            _mm_set1_epi8(3));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((__m128i *) (out + i),
+            lookup4_sse2(_mm_unpacklo_epi16(lo, zero), pal));
+        _mm_storeu_si128((__m128i *) (out + i + 4),
+            lookup4_sse2(_mm_unpackhi_epi16(lo, zero), pal));
+        _mm_storeu_si128((__m128i *) (out + i + 8),
+            lookup4_sse2(_mm_unpacklo_epi16(hi, zero), pal));
+        _mm_storeu_si128((__m128i *) (out + i + 12),
+            lookup4_sse2(_mm_unpackhi_epi16(hi, zero), pal));
+    }
+    lookup_scalar(idx + i, out + i, n - i, palette);
+}
+
+static void expand2_sse2(const uint8_t *in, uint8_t *out, uint32_t n) {
+    uint32_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        _mm_storeu_si128((__m128i *) (out + i * 2), _mm_unpacklo_epi8(v, v));
+        _mm_storeu_si128((__m128i *) (out + i * 2 + 16), _mm_unpackhi_epi8(v, v));
+    }
+    expand2_scalar(in + i, out + i * 2, n - i);
+}
+
+static void epx_sse2(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out0, uint8_t *out1, uint32_t n) {
+    uint32_t x = 0;
+
+    for (; x + 16 <= n; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (up + x));
+        __m128i b = _mm_loadu_si128((const __m128i *) (mid + x + 1));
+        __m128i c = _mm_loadu_si128((const __m128i *) (mid + x - 1));
+        __m128i d = _mm_loadu_si128((const __m128i *) (down + x));
+        __m128i p = _mm_loadu_si128((const __m128i *) (mid + x));
+        __m128i ca = _mm_cmpeq_epi8(c, a);
+        __m128i cd = _mm_cmpeq_epi8(c, d);
+        __m128i ab = _mm_cmpeq_epi8(a, b);
+        __m128i bd = _mm_cmpeq_epi8(b, d);
+
+        __m128i e0 = select128(_mm_andnot_si128(_mm_or_si128(cd, ab), ca), a, p);
+        __m128i e1 = select128(_mm_andnot_si128(_mm_or_si128(ca, bd), ab), b, p);
+        __m128i e2 = select128(_mm_andnot_si128(_mm_or_si128(bd, ca), cd), c, p);
+        __m128i e3 = select128(_mm_andnot_si128(_mm_or_si128(ab, cd), bd), d, p);
+
+        _mm_storeu_si128((__m128i *) (out0 + x * 2), _mm_unpacklo_epi8(e0, e1));
+        _mm_storeu_si128((__m128i *) (out0 + x * 2 + 16), _mm_unpackhi_epi8(e0, e1));
+        _mm_storeu_si128((__m128i *) (out1 + x * 2), _mm_unpacklo_epi8(e2, e3));
+        _mm_storeu_si128((__m128i *) (out1 + x * 2 + 16), _mm_unpackhi_epi8(e2, e3));
+    }
+    epx_scalar(up + x, mid + x, down + x, out0 + x * 2, out1 + x * 2, n - x);
+}
+
+// Rules in parallel into nine planes, then interleaved by threes, which SSE2
+// has no byte shuffle for
+static void scale3x_sse2(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out0, uint8_t *out1, uint8_t *out2, uint32_t n) {
+    uint8_t planes[9][16] __attribute__((aligned(16)));
+    uint8_t *rows[3] = { out0, out1, out2 };
+    uint32_t x = 0;
+
+    for (; x + 16 <= n; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (up + x - 1));
+        __m128i b = _mm_loadu_si128((const __m128i *) (up + x));
+        __m128i c = _mm_loadu_si128((const __m128i *) (up + x + 1));
+        __m128i d = _mm_loadu_si128((const __m128i *) (mid + x - 1));
+        __m128i e = _mm_loadu_si128((const __m128i *) (mid + x));
+        __m128i f = _mm_loadu_si128((const __m128i *) (mid + x + 1));
+        __m128i g = _mm_loadu_si128((const __m128i *) (down + x - 1));
+        __m128i h = _mm_loadu_si128((const __m128i *) (down + x));
+        __m128i i = _mm_loadu_si128((const __m128i *) (down + x + 1));
+
+        __m128i eq_db = _mm_cmpeq_epi8(d, b);
+        __m128i eq_bf = _mm_cmpeq_epi8(b, f);
+        __m128i eq_dh = _mm_cmpeq_epi8(d, h);
+        __m128i eq_hf = _mm_cmpeq_epi8(h, f);
+        __m128i db = _mm_andnot_si128(_mm_or_si128(eq_bf, eq_dh), eq_db);
+        __m128i bf = _mm_andnot_si128(_mm_or_si128(eq_db, eq_hf), eq_bf);
+        __m128i dh = _mm_andnot_si128(_mm_or_si128(eq_db, eq_hf), eq_dh);
+        __m128i hf = _mm_andnot_si128(_mm_or_si128(eq_dh, eq_bf), eq_hf);
+        __m128i eq_ea = _mm_cmpeq_epi8(e, a);
+        __m128i eq_ec = _mm_cmpeq_epi8(e, c);
+        __m128i eq_eg = _mm_cmpeq_epi8(e, g);
+        __m128i eq_ei = _mm_cmpeq_epi8(e, i);
+
+        __m128i p[9];
+        p[0] = select128(db, d, e);
+        p[1] = select128(_mm_or_si128(_mm_andnot_si128(eq_ec, db), _mm_andnot_si128(eq_ea, bf)), b, e);
+        p[2] = select128(bf, f, e);
+        p[3] = select128(_mm_or_si128(_mm_andnot_si128(eq_eg, db), _mm_andnot_si128(eq_ea, dh)), d, e);
+        p[4] = e;
+        p[5] = select128(_mm_or_si128(_mm_andnot_si128(eq_ei, bf), _mm_andnot_si128(eq_ec, hf)), f, e);
+        p[6] = select128(dh, d, e);
+        p[7] = select128(_mm_or_si128(_mm_andnot_si128(eq_ei, dh), _mm_andnot_si128(eq_eg, hf)), h, e);
+        p[8] = select128(hf, f, e);
+        for (int k = 0; k < 9; k++) {
+            _mm_store_si128((__m128i *) planes[k], p[k]);
+        }
+
+        for (int r = 0; r < 3; r++) {
+            uint8_t *row = rows[r] + x * 3;
+            for (int k = 0; k < 16; k++) {
+                row[k * 3]     = planes[r * 3][k];
+                row[k * 3 + 1] = planes[r * 3 + 1][k];
+                row[k * 3 + 2] = planes[r * 3 + 2][k];
+            }
+        }
+    }
+    scale3x_scalar(up + x, mid + x, down + x, out0 + x * 3, out1 + x * 3, out2 + x * 3, n - x);
+}
+
+static void blend_sse2(const uint32_t *edge, const uint32_t *base, uint32_t *out,
+        uint32_t n) {
+    uint32_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i e = _mm_loadu_si128((const __m128i *) (edge + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (base + i));
+        _mm_storeu_si128((__m128i *) (out + i), _mm_avg_epu8(e, _mm_avg_epu8(b, e)));
+    }
+    blend_scalar(edge + i, base + i, out + i, n - i);
+}
+
+// AVX2, compiled for that target only and picked at run time
+
+__attribute__((target("avx2")))
+static void lookup_avx2(const uint8_t *idx, uint32_t *out, uint32_t n,
+        const uint32_t *palette) {
+    const __m256i pal = _mm256_setr_epi32(palette[0], palette[1], palette[2], palette[3],
+        palette[0], palette[1], palette[2], palette[3]);
+    const __m256i mask = _mm256_set1_epi32(3);
+    uint32_t i = 0;
+
+    // One permute per 8 pixels does the whole lookup
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (idx + i)));
+        _mm256_storeu_si256((__m256i *) (out + i),
+            _mm256_permutevar8x32_epi32(pal, _mm256_and_si256(v, mask)));
+    }
+    lookup_scalar(idx + i, out + i, n - i, palette);
+}
+
+__attribute__((target("avx2")))
+static __m256i select256(__m256i mask, __m256i a, __m256i b) {
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+// Unpacks work within 128-bit lanes, so the halves are put back in order
+// before storing
+__attribute__((target("avx2")))
+static void store_interleaved(uint8_t *out, __m256i a, __m256i b) {
+    __m256i lo = _mm256_unpacklo_epi8(a, b);
+    __m256i hi = _mm256_unpackhi_epi8(a, b);
+    _mm256_storeu_si256((__m256i *) out, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+__attribute__((target("avx2")))
+static void expand2_avx2(const uint8_t *in, uint8_t *out, uint32_t n) {
+    uint32_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (in + i));
+        store_interleaved(out + i * 2, v, v);
+    }
+    expand2_sse2(in + i, out + i * 2, n - i);
+}
+
+__attribute__((target("avx2")))
+static void epx_avx2(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out0, uint8_t *out1, uint32_t n) {
+    uint32_t x = 0;
+
+    for (; x + 32 <= n; x += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (up + x));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (mid + x + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (mid + x - 1));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (down + x));
+        __m256i p = _mm256_loadu_si256((const __m256i *) (mid + x));
+        __m256i ca = _mm256_cmpeq_epi8(c, a);
+        __m256i cd = _mm256_cmpeq_epi8(c, d);
+        __m256i ab = _mm256_cmpeq_epi8(a, b);
+        __m256i bd = _mm256_cmpeq_epi8(b, d);
+
+        __m256i e0 = select256(_mm256_andnot_si256(_mm256_or_si256(cd, ab), ca), a, p);
+        __m256i e1 = select256(_mm256_andnot_si256(_mm256_or_si256(ca, bd), ab), b, p);
+        __m256i e2 = select256(_mm256_andnot_si256(_mm256_or_si256(bd, ca), cd), c, p);
+        __m256i e3 = select256(_mm256_andnot_si256(_mm256_or_si256(ab, cd), bd), d, p);
+
+        store_interleaved(out0 + x * 2, e0, e1);
+        store_interleaved(out1 + x * 2, e2, e3);
+    }
+    epx_sse2(up + x, mid + x, down + x, out0 + x * 2, out1 + x * 2, n - x);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(const uint32_t *edge, const uint32_t *base, uint32_t *out,
+        uint32_t n) {
+    uint32_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i e = _mm256_loadu_si256((const __m256i *) (edge + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (base + i));
+        _mm256_storeu_si256((__m256i *) (out + i),
+            _mm256_avg_epu8(e, _mm256_avg_epu8(b, e)));
+    }
+    blend_scalar(edge + i, base + i, out + i, n - i);
+}
+
+#endif
+
+static const scale_kernels kernel_sets[SCALE_ISA_COUNT] = {
+    [SCALE_ISA_SCALAR] = { lookup_scalar, expand2_scalar, epx_scalar, scale3x_scalar,
+        blend_scalar },
+#ifdef SCALE_X86
+    [SCALE_ISA_SSE2] = { lookup_sse2, expand2_sse2, epx_sse2, scale3x_sse2, blend_sse2 },
+    // Scale3x gains nothing from wider compares while the interleave is scalar
+    [SCALE_ISA_AVX2] = { lookup_avx2, expand2_avx2, epx_avx2, scale3x_sse2, blend_avx2 },
+#endif
+};
+
+static const scale_kernels *kernels;
+
+scale_isa scale_best_isa(void) {
+#ifdef SCALE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SCALE_ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SCALE_ISA_SSE2;
+    }
+#endif
+    return SCALE_ISA_SCALAR;
+}
+
+uint8_t scale_use_isa(scale_isa isa) {
+    if (isa >= SCALE_ISA_COUNT || isa > scale_best_isa()) {
+        return 0;
+    }
+    __atomic_store_n(&kernels, &kernel_sets[isa], __ATOMIC_RELAXED);
+    return 1;
+}
+
+const char *scale_isa_name(scale_isa isa) {
+    static const char *names[SCALE_ISA_COUNT] = { "scalar", "sse2", "avx2" };
+    return isa < SCALE_ISA_COUNT ? names[isa] : "?";
+}
+
+uint32_t scale_factor(gb_scale_filter filter, uint32_t factor) {
+    switch (filter) {
+        case GB_SCALE_NEAREST:
+            return factor >= 1 && factor <= SCALE_MAX_FACTOR ? factor : 0;
+        case GB_SCALE_EPX:
+        case GB_SCALE_HQ2X:
+            return 2;
+        case GB_SCALE_3X:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static void pad(const uint8_t *src, uint8_t *padded) {
+    for (int y = 0; y < H; y++) {
+        uint8_t *row = padded + (y + 1) * PAD_W;
+        memcpy(row + 1, src + y * W, W);
+        row[0] = row[1];
+        row[W + 1] = row[W];
+    }
+    memcpy(padded, padded + PAD_W, PAD_W);
+    memcpy(padded + (H + 1) * PAD_W, padded + H * PAD_W, PAD_W);
+}
+
+static uint32_t *dst_row(uint32_t *dst, uint32_t pitch, uint32_t y) {
+    return (uint32_t *) ((uint8_t *) dst + (size_t) y * pitch);
+}
+
+static void nearest(const scale_kernels *k, uint32_t factor, const uint8_t *src,
+        const uint32_t *palette, uint32_t *dst, uint32_t pitch) {
+    uint8_t wide[W * SCALE_MAX_FACTOR];
+    uint8_t half[W * 2];
+
+    for (uint32_t y = 0; y < H; y++) {
+        const uint8_t *row = src + y * W;
+        uint32_t *out = dst_row(dst, pitch, y * factor);
+
+        if (factor == 1) {
+            k->lookup(row, out, W, palette);
+            continue;
+        } else if (factor == 2) {
+            k->expand2(row, wide, W);
+        } else if (factor == 4) {
+            k->expand2(row, half, W);
+            k->expand2(half, wide, W * 2);
+        } else {
+            for (uint32_t x = 0; x < W; x++) {
+                memset(wide + x * factor, row[x], factor);
+            }
+        }
+        k->lookup(wide, out, W * factor, palette);
+        for (uint32_t r = 1; r < factor; r++) {
+            memcpy(dst_row(dst, pitch, y * factor + r), out, W * factor * sizeof(uint32_t));
+        }
+    }
+}
+
+void scale_frame(gb_scale_filter filter, uint32_t factor, const uint8_t *src,
+    const uint32_t palette[4], uint32_t *dst, uint32_t pitch) {
+    const scale_kernels *k = __atomic_load_n(&kernels, __ATOMIC_RELAXED);
+    uint8_t padded[PAD_W * PAD_H];
+    uint8_t idx[3][W * 3];
+    uint32_t edge[W * 2];
+    uint32_t base[W * 2];
+
+    if (!k) {
+        scale_use_isa(scale_best_isa());
+        k = __atomic_load_n(&kernels, __ATOMIC_RELAXED);
+    }
+    if (!scale_factor(filter, factor)) {
+        return;
+    }
+    if (filter == GB_SCALE_NEAREST) {
+        nearest(k, factor, src, palette, dst, pitch);
+        return;
+    }
+
+    pad(src, padded);
+    for (uint32_t y = 0; y < H; y++) {
+        const uint8_t *up = padded + y * PAD_W + 1;
+        const uint8_t *mid = up + PAD_W;
+        const uint8_t *down = mid + PAD_W;
+
+        switch (filter) {
+            case GB_SCALE_EPX:
+                k->epx(up, mid, down, idx[0], idx[1], W);
+                k->lookup(idx[0], dst_row(dst, pitch, y * 2), W * 2, palette);
+                k->lookup(idx[1], dst_row(dst, pitch, y * 2 + 1), W * 2, palette);
+                break;
+            case GB_SCALE_3X:
+                k->scale3x(up, mid, down, idx[0], idx[1], idx[2], W);
+                for (uint32_t r = 0; r < 3; r++) {
+                    k->lookup(idx[r], dst_row(dst, pitch, y * 3 + r), W * 3, palette);
+                }
+                break;
+            case GB_SCALE_HQ2X:
+                // Where EPX moved an edge in, blend instead of replacing
+                k->epx(up, mid, down, idx[0], idx[1], W);
+                k->expand2(mid, idx[2], W);
+                k->lookup(idx[2], base, W * 2, palette);
+                for (uint32_t r = 0; r < 2; r++) {
+                    k->lookup(idx[r], edge, W * 2, palette);
+                    k->blend(edge, base, dst_row(dst, pitch, y * 2 + r), W * 2);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
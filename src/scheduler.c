@@ -0,0 +1,77 @@
+#include "scheduler.h"
+#include "machine.h"
+
+#define ctx (machine->scheduler)
+
+static sched_handler handlers[SCHED_EVENT_COUNT];
+
+static void update_next(void);
+
+void scheduler_init(void) {
+    ctx.now = 0;
+    for (int i = 0; i < SCHED_EVENT_COUNT; i++) {
+        ctx.deadline[i] = SCHED_NEVER;
+    }
+    ctx.next = SCHED_NEVER;
+}
+
+void scheduler_register(sched_event event, sched_handler handler) {
+    handlers[event] = handler;
+}
+
+void scheduler_schedule(sched_event event, uint64_t at) {
+    ctx.deadline[event] = at;
+    if (at < ctx.next) {
+        ctx.next = at;
+    }
+}
+
+void scheduler_cancel(sched_event event) {
+    ctx.deadline[event] = SCHED_NEVER;
+    update_next();
+}
+
+// Advance time by one T-cycle and fire any events that have become due.
+void scheduler_step(void) {
+    ctx.now++;
+    if (ctx.now < ctx.next) {
+        return;
+    }
+
+    for (int i = 0; i < SCHED_EVENT_COUNT; i++) {
+        if (ctx.deadline[i] <= ctx.now) {
+            // Clear first so the handler is free to reschedule itself
+            ctx.deadline[i] = SCHED_NEVER;
+            handlers[i]();
+        }
+    }
+    update_next();
+}
+
+uint64_t scheduler_now(void) {
+    return ctx.now;
+}
+
+static void update_next(void) {
+    ctx.next = SCHED_NEVER;
+    for (int i = 0; i < SCHED_EVENT_COUNT; i++) {
+        if (ctx.deadline[i] < ctx.next) {
+            ctx.next = ctx.deadline[i];
+        }
+    }
+}
+
+void scheduler_save(state_buffer *s) {
+    state_put_u64(s, ctx.now);
+    for (int i = 0; i < SCHED_EVENT_COUNT; i++) {
+        state_put_u64(s, ctx.deadline[i]);
+    }
+}
+
+void scheduler_load(state_buffer *s) {
+    ctx.now = state_get_u64(s);
+    for (int i = 0; i < SCHED_EVENT_COUNT; i++) {
+        ctx.deadline[i] = state_get_u64(s);
+    }
+    update_next();
+}
@@ -0,0 +1,115 @@
+#include "serial.h"
+#include "cpu.h"
+#include "io.h"
+#include "scheduler.h"
+#include "gb.h"
+#include "machine.h"
+
+#include <string.h>
+
+#define ctx (machine->serial)
+
+static FILE *capture_stream;
+static const char *patterns[SERIAL_MAX_PATTERNS];
+static uint32_t pattern_lengths[SERIAL_MAX_PATTERNS];
+static int pattern_count;
+
+static uint8_t serial_read(uint16_t addr);
+static void serial_write(uint16_t addr, uint8_t value);
+static void serial_on_complete(void);
+
+void serial_init(void) {
+    ctx.sb = 0x00;
+    ctx.sc = 0x00;
+    ctx.out_len = 0;
+    ctx.matched = SERIAL_NO_MATCH;
+
+    io_register(SERIAL_SB_ADDR, serial_read, serial_write);
+    io_register(SERIAL_SC_ADDR, serial_read, serial_write);
+    scheduler_register(SCHED_SERIAL, serial_on_complete);
+}
+
+void serial_capture(FILE *stream) {
+    capture_stream = stream;
+}
+
+int serial_stop_on(const char *pattern) {
+    if (pattern_count == SERIAL_MAX_PATTERNS) {
+        return SERIAL_NO_MATCH;
+    }
+    patterns[pattern_count] = pattern;
+    pattern_lengths[pattern_count] = strlen(pattern);
+    return pattern_count++;
+}
+
+int serial_matched(void) {
+    return ctx.matched;
+}
+
+const uint8_t *serial_output(uint32_t *len) {
+    *len = ctx.out_len;
+    return ctx.out;
+}
+
+static void record(uint8_t byte) {
+    if (capture_stream) {
+        fputc(byte, capture_stream);
+        fflush(capture_stream);
+    }
+
+    if (ctx.out_len == SERIAL_CAPTURE_SIZE) {
+        // Keep the newer half, patterns only ever look at the tail
+        memmove(ctx.out, ctx.out + SERIAL_CAPTURE_SIZE / 2, SERIAL_CAPTURE_SIZE / 2);
+        ctx.out_len = SERIAL_CAPTURE_SIZE / 2;
+    }
+    ctx.out[ctx.out_len++] = byte;
+
+    for (int i = 0; i < pattern_count; i++) {
+        uint32_t n = pattern_lengths[i];
+        if (n && ctx.out_len >= n
+                && memcmp(ctx.out + ctx.out_len - n, patterns[i], n) == 0) {
+            ctx.matched = i;
+            emu_stop(GB_STOP_SERIAL);
+            break;
+        }
+    }
+}
+
+static uint8_t serial_read(uint16_t addr) {
+    return addr == SERIAL_SB_ADDR ? ctx.sb : ctx.sc;
+}
+
+static void serial_write(uint16_t addr, uint8_t value) {
+    if (addr == SERIAL_SB_ADDR) {
+        ctx.sb = value;
+        return;
+    }
+
+    ctx.sc = value & 0x81;
+    // Only the internal clock is driven, with no link partner an externally
+    // clocked transfer never completes
+    if ((ctx.sc & 0x81) == 0x81) {
+        scheduler_schedule(SCHED_SERIAL, scheduler_now() + 8 * SERIAL_CYCLES_PER_BIT);
+    } else {
+        scheduler_cancel(SCHED_SERIAL);
+    }
+}
+
+static void serial_on_complete(void) {
+    record(ctx.sb);
+
+    // Nothing is connected, so the incoming bits are all 1
+    ctx.sb = 0xFF;
+    ctx.sc &= 0x7F;
+    cpu_request_interrupt(INT_SERIAL);
+}
+
+void serial_save(state_buffer *s) {
+    state_put_u8(s, ctx.sb);
+    state_put_u8(s, ctx.sc);
+}
+
+void serial_load(state_buffer *s) {
+    ctx.sb = state_get_u8(s);
+    ctx.sc = state_get_u8(s);
+}
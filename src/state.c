@@ -0,0 +1,374 @@
+#include "state.h"
+#include "apu.h"
+#include "bus.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "hash.h"
+#include "dma.h"
+#include "io.h"
+#include "joypad.h"
+#include "machine.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "serial.h"
+#include "timer.h"
+
+#include <string.h>
+
+// A writer with a NULL buffer only counts, which is how state_size() measures
+// the layout without keeping a second description of it.
+void state_put_u8(state_buffer *s, uint8_t value) {
+    if (s->buf) {
+        s->buf[s->pos] = value;
+    }
+    s->pos++;
+}
+
+void state_put_u16(state_buffer *s, uint16_t value) {
+    state_put_u8(s, value & 0xFF);
+    state_put_u8(s, value >> 8);
+}
+
+void state_put_u32(state_buffer *s, uint32_t value) {
+    state_put_u16(s, value & 0xFFFF);
+    state_put_u16(s, value >> 16);
+}
+
+void state_put_u64(state_buffer *s, uint64_t value) {
+    state_put_u32(s, value & 0xFFFFFFFF);
+    state_put_u32(s, value >> 32);
+}
+
+void state_put_bytes(state_buffer *s, const void *src, uint32_t len) {
+    if (s->buf) {
+        memcpy(s->buf + s->pos, src, len);
+    }
+    s->pos += len;
+}
+
+uint8_t state_get_u8(state_buffer *s) {
+    return s->buf[s->pos++];
+}
+
+uint16_t state_get_u16(state_buffer *s) {
+    uint16_t low = s->buf[s->pos++];
+    return low | (s->buf[s->pos++] << 8);
+}
+
+uint32_t state_get_u32(state_buffer *s) {
+    uint32_t low = state_get_u16(s);
+    return low | ((uint32_t) state_get_u16(s) << 16);
+}
+
+uint64_t state_get_u64(state_buffer *s) {
+    uint64_t low = state_get_u32(s);
+    return low | ((uint64_t) state_get_u32(s) << 32);
+}
+
+void state_get_bytes(state_buffer *s, void *dest, uint32_t len) {
+    memcpy(dest, s->buf + s->pos, len);
+    s->pos += len;
+}
+
+typedef struct {
+    uint32_t first_page;
+    uint8_t *mem;
+    uint32_t size;
+} paged_region;
+
+// The regions stored as pages, in state order. Returns how many there are.
+static uint32_t paged_regions(paged_region *r) {
+    r[0] = (paged_region) { STATE_PAGE_VRAM, bus_direct_ptr(BUS_VRAM_ADDR), 0x2000 };
+    r[1] = (paged_region) { STATE_PAGE_WRAM, bus_direct_ptr(BUS_WRAM_ADDR), 0x2000 };
+    r[2] = (paged_region) { STATE_PAGE_PPU_VIEW, ppu_view, sizeof(ppu_view) };
+    r[3] = (paged_region) { STATE_PAGE_PPU_BACK, ppu_back, sizeof(ppu_back) };
+    r[4] = (paged_region) { STATE_PAGE_CART_RAM, cartridge_ram_ptr(), cartridge_ram_size() };
+    return r[4].size ? 5 : 4;
+}
+
+static uint32_t page_count(void) {
+    return STATE_PAGE_CART_RAM + cartridge_ram_size() / STATE_PAGE_SIZE;
+}
+
+static uint8_t *page_ptr(uint32_t page) {
+    paged_region r[5];
+    uint32_t i = paged_regions(r) - 1;
+
+    while (i > 0 && page < r[i].first_page) {
+        i--;
+    }
+    return r[i].mem + (page - r[i].first_page) * STATE_PAGE_SIZE;
+}
+
+static void clear_dirty(void) {
+    memset(state_dirty, 0, sizeof(state_dirty));
+}
+
+// Every page of the tracked regions, VRAM, WRAM and cartridge RAM
+static void mark_all_dirty(void) {
+    paged_region r[5];
+    uint32_t n = paged_regions(r);
+
+    if (!state_dirty_tracking) {
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (r[i].first_page == STATE_PAGE_PPU_VIEW || r[i].first_page == STATE_PAGE_PPU_BACK) {
+            continue;
+        }
+        for (uint32_t page = 0; page < r[i].size / STATE_PAGE_SIZE; page++) {
+            STATE_MARK_DIRTY(r[i].first_page + page);
+        }
+    }
+}
+
+static void save_sections(state_buffer *s) {
+    scheduler_save(s);
+    cpu_save(s);
+    bus_save(s);
+    io_save(s);
+    timer_save(s);
+    dma_save(s);
+    joypad_save(s);
+    serial_save(s);
+    ppu_save(s);
+    cartridge_save(s);
+    apu_save(s);
+}
+
+static uint32_t sections_size(void) {
+    state_buffer s = { NULL, 0 };
+    save_sections(&s);
+    return s.pos;
+}
+
+static void load_sections(state_buffer *s) {
+    scheduler_load(s);
+    cpu_load(s);
+    bus_load(s);
+    io_load(s);
+    timer_load(s);
+    dma_load(s);
+    joypad_load(s);
+    serial_load(s);
+    ppu_load(s);
+    cartridge_load(s);
+    apu_load(s);
+}
+
+static void put_header(state_buffer *s, uint32_t magic, uint32_t size, uint32_t extra) {
+    state_put_u32(s, magic);
+    state_put_u16(s, STATE_VERSION);
+    state_put_u16(s, cartridge_checksum());
+    state_put_u32(s, size);
+    state_put_u32(s, extra);
+}
+
+static uint8_t check_header(state_buffer *s, uint32_t magic, uint32_t size) {
+    if (size < STATE_HEADER_SIZE
+            || state_get_u32(s) != magic
+            || state_get_u16(s) != STATE_VERSION) {
+        printf("[ERROR] state_load: not a save state of this version\n");
+        return 0;
+    }
+    if (state_get_u16(s) != cartridge_checksum()) {
+        printf("[ERROR] state_load: state belongs to a different ROM\n");
+        return 0;
+    }
+    if (state_get_u32(s) != size) {
+        printf("[ERROR] state_load: size mismatch\n");
+        return 0;
+    }
+    return 1;
+}
+
+uint32_t state_size(void) {
+    return STATE_HEADER_SIZE + page_count() * STATE_PAGE_SIZE + sections_size();
+}
+
+void state_save(uint8_t *buf) {
+    state_buffer s = { buf, 0 };
+    paged_region r[5];
+    uint32_t n = paged_regions(r);
+
+    put_header(&s, STATE_MAGIC, state_size(), cartridge_ram_size());
+    for (uint32_t i = 0; i < n; i++) {
+        state_put_bytes(&s, r[i].mem, r[i].size);
+    }
+    save_sections(&s);
+}
+
+uint8_t state_load(const uint8_t *buf, uint32_t size) {
+    // Only read from, the cast lets the reader share state_buffer
+    state_buffer s = { (uint8_t *) buf, 0 };
+    paged_region r[5];
+    uint32_t n = paged_regions(r);
+
+    if (!check_header(&s, STATE_MAGIC, size)) {
+        return 0;
+    }
+    if (size != state_size() || state_get_u32(&s) != cartridge_ram_size()) {
+        printf("[ERROR] state_load: size mismatch\n");
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        state_get_bytes(&s, r[i].mem, r[i].size);
+    }
+    load_sections(&s);
+    mark_all_dirty();
+    return 1;
+}
+
+void state_set_base(void) {
+    clear_dirty();
+}
+
+uint64_t state_hash(void) {
+    static uint8_t *sections;
+    static uint32_t sections_cap;
+    paged_region r[5];
+    uint32_t n = paged_regions(r);
+    uint64_t hash = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        // Output only, the game can't read them back and skipped frames
+        // leave them stale
+        if (r[i].first_page != STATE_PAGE_PPU_VIEW && r[i].first_page != STATE_PAGE_PPU_BACK) {
+            hash = hash_bytes(r[i].mem, r[i].size, hash);
+        }
+    }
+
+    uint32_t size = sections_size();
+    if (size > sections_cap) {
+        uint8_t *grown = realloc(sections, size);
+        if (!grown) {
+            printf("[ERROR] state_hash: realloc fail\n");
+            return 0;
+        }
+        sections = grown;
+        sections_cap = size;
+    }
+    state_buffer s = { sections, 0 };
+    save_sections(&s);
+    return hash_bytes(sections, size, hash);
+}
+
+void state_set_dirty_tracking(uint8_t enable) {
+    state_dirty_tracking = enable;
+    clear_dirty();
+}
+
+uint8_t state_restore(const uint8_t *base, uint32_t size) {
+    if (!state_dirty_tracking) {
+        return state_load(base, size);
+    }
+
+    state_buffer s = { (uint8_t *) base, 0 };
+    if (!check_header(&s, STATE_MAGIC, size) || size != state_size()) {
+        return 0;
+    }
+
+    for (uint32_t w = 0; w < STATE_DIRTY_WORDS; w++) {
+        for (uint64_t bits = state_dirty[w]; bits; bits &= bits - 1) {
+            uint32_t page = w * 64 + __builtin_ctzll(bits);
+            memcpy(page_ptr(page), base + STATE_HEADER_SIZE + page * STATE_PAGE_SIZE,
+                STATE_PAGE_SIZE);
+        }
+    }
+
+    s.pos = STATE_HEADER_SIZE + page_count() * STATE_PAGE_SIZE;
+    load_sections(&s);
+    clear_dirty();
+    return 1;
+}
+
+// Size of a delta holding the pages set in `dirty`
+static uint32_t delta_bytes(const uint64_t *dirty) {
+    uint32_t pages = 0;
+    for (uint32_t w = 0; w < STATE_DIRTY_WORDS; w++) {
+        pages += __builtin_popcountll(dirty[w]);
+    }
+    return STATE_HEADER_SIZE + STATE_DIRTY_WORDS * 8 + sections_size()
+        + pages * STATE_PAGE_SIZE;
+}
+
+uint32_t state_delta_size(void) {
+    return delta_bytes(state_dirty);
+}
+
+uint32_t state_save_delta(uint8_t *buf, uint32_t size) {
+    uint32_t needed = state_delta_size();
+    if (!state_dirty_tracking || size < needed) {
+        return 0;
+    }
+
+    state_buffer s = { buf, 0 };
+    put_header(&s, STATE_DELTA_MAGIC, needed, 0);
+    for (uint32_t w = 0; w < STATE_DIRTY_WORDS; w++) {
+        state_put_u64(&s, state_dirty[w]);
+    }
+    save_sections(&s);
+
+    for (uint32_t w = 0; w < STATE_DIRTY_WORDS; w++) {
+        for (uint64_t bits = state_dirty[w]; bits; bits &= bits - 1) {
+            uint32_t page = w * 64 + __builtin_ctzll(bits);
+            state_put_bytes(&s, page_ptr(page), STATE_PAGE_SIZE);
+        }
+    }
+    return needed;
+}
+
+uint8_t state_load_delta(const uint8_t *base, uint32_t base_size,
+        const uint8_t *delta, uint32_t delta_size) {
+    state_buffer b = { (uint8_t *) base, 0 };
+    state_buffer d = { (uint8_t *) delta, 0 };
+    uint64_t delta_dirty[STATE_DIRTY_WORDS];
+
+    if (!state_dirty_tracking
+            || !check_header(&b, STATE_MAGIC, base_size) || base_size != state_size()
+            || !check_header(&d, STATE_DELTA_MAGIC, delta_size)) {
+        return 0;
+    }
+    if (delta_size < STATE_HEADER_SIZE + STATE_DIRTY_WORDS * 8) {
+        printf("[ERROR] state_load_delta: truncated delta\n");
+        return 0;
+    }
+    d.pos = STATE_HEADER_SIZE;
+    for (uint32_t w = 0; w < STATE_DIRTY_WORDS; w++) {
+        delta_dirty[w] = state_get_u64(&d);
+    }
+
+    // The bitmap decides how many pages are read, so it has to agree with
+    // the size and name only pages this cartridge has
+    uint8_t stray = 0;
+    for (uint32_t page = page_count(); page < STATE_DIRTY_WORDS * 64; page++) {
+        stray |= (delta_dirty[page >> 6] >> (page & 63)) & 1;
+    }
+    if (stray || delta_size != delta_bytes(delta_dirty)) {
+        printf("[ERROR] state_load_delta: page bitmap doesn't match the delta\n");
+        return 0;
+    }
+    state_buffer sections = d;
+    const uint8_t *delta_page = delta + d.pos + sections_size();
+
+    // Pages in the delta come from it, pages only we have touched since the
+    // base come from the base, everything else already matches
+    for (uint32_t w = 0; w < STATE_DIRTY_WORDS; w++) {
+        for (uint64_t bits = state_dirty[w] | delta_dirty[w]; bits; bits &= bits - 1) {
+            uint32_t bit = __builtin_ctzll(bits);
+            uint32_t page = w * 64 + bit;
+            if (delta_dirty[w] & ((uint64_t) 1 << bit)) {
+                memcpy(page_ptr(page), delta_page, STATE_PAGE_SIZE);
+                delta_page += STATE_PAGE_SIZE;
+            } else {
+                memcpy(page_ptr(page), base + STATE_HEADER_SIZE + page * STATE_PAGE_SIZE,
+                    STATE_PAGE_SIZE);
+            }
+        }
+    }
+
+    load_sections(&sections);
+    memcpy(state_dirty, delta_dirty, sizeof(state_dirty));
+    return 1;
+}
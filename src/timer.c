@@ -0,0 +1,190 @@
+#include "timer.h"
+#include "apu.h"
+#include "scheduler.h"
+#include "cpu.h"
+#include "io.h"
+#include "machine.h"
+
+// TIMA reloads from TMA one M-cycle after it overflows
+#define TIMER_RELOAD_DELAY 4
+
+#define ctx (machine->timer)
+
+// Bit of the internal counter whose falling edge clocks TIMA, indexed by TAC:0-1
+static const uint8_t tac_counter_bit[4] = { 9, 3, 5, 7 };
+
+static void timer_on_overflow(void);
+static void timer_on_reload(void);
+
+// Nothing in here ticks. DIV and TIMA are derived from the scheduler clock when
+// they are read, and the only event queued is the next TIMA overflow.
+
+static uint16_t counter(void) {
+    return (scheduler_now() - ctx.div_base) & 0xFFFF;
+}
+
+static uint8_t enabled(void) {
+    return (ctx.tac >> 2) & 0x01;
+}
+
+// The AND of the selected counter bit and the enable bit, TIMA increments
+// whenever this signal goes from 1 to 0.
+static uint8_t timer_signal(void) {
+    return enabled() && ((counter() >> tac_counter_bit[ctx.tac & 0x03]) & 0x01);
+}
+
+// Bring TIMA up to date by counting falling edges since the last sync.
+static void timer_sync(void) {
+    uint64_t now = scheduler_now();
+
+    if (enabled() && !ctx.reloading) {
+        uint8_t  shift = tac_counter_bit[ctx.tac & 0x03] + 1;
+        uint64_t from  = ctx.tima_sync - ctx.div_base;
+        uint64_t to    = now - ctx.div_base;
+        // Never reaches an overflow, that is an event that fires first
+        ctx.tima += (to >> shift) - (from >> shift);
+    }
+    ctx.tima_sync = now;
+}
+
+// Queue the falling edge that will take TIMA from 0xFF to 0x00.
+static void schedule_overflow(void) {
+    if (!enabled() || ctx.reloading) {
+        scheduler_cancel(SCHED_TIMER_OVERFLOW);
+        return;
+    }
+
+    uint8_t  shift = tac_counter_bit[ctx.tac & 0x03] + 1;
+    uint64_t since_base = scheduler_now() - ctx.div_base;
+    uint64_t edges = 0x100 - ctx.tima;
+    uint64_t first_edge = ((since_base >> shift) + 1) << shift;
+
+    scheduler_schedule(SCHED_TIMER_OVERFLOW,
+        ctx.div_base + first_edge + ((edges - 1) << shift));
+}
+
+// A glitch edge from a DIV or TAC write, which may itself overflow TIMA.
+static void increment(void) {
+    if (ctx.reloading) {
+        return;
+    }
+    if (ctx.tima == 0xFF) {
+        timer_on_overflow();
+    } else {
+        ctx.tima++;
+    }
+}
+
+uint16_t timer_counter(void) {
+    return counter();
+}
+
+void timer_init(void) {
+    ctx.div_base  = scheduler_now() - TIMER_POST_BOOT_COUNTER;
+    ctx.tima_sync = scheduler_now();
+    ctx.tima = 0x00;
+    ctx.tma  = 0x00;
+    ctx.tac  = 0xF8;
+    ctx.reloading = 0;
+
+    scheduler_register(SCHED_TIMER_OVERFLOW, timer_on_overflow);
+    scheduler_register(SCHED_TIMER_RELOAD, timer_on_reload);
+    for (uint16_t addr = TIMER_DIV_ADDR; addr <= TIMER_TAC_ADDR; addr++) {
+        io_register(addr, timer_read, timer_write);
+    }
+    schedule_overflow();
+}
+
+uint8_t timer_read(uint16_t addr) {
+    switch (addr) {
+        case TIMER_DIV_ADDR:
+            return counter() >> 8;
+        case TIMER_TIMA_ADDR:
+            timer_sync();
+            return ctx.tima;
+        case TIMER_TMA_ADDR:
+            return ctx.tma;
+        case TIMER_TAC_ADDR:
+            return ctx.tac | 0xF8;
+        default:
+            printf("[WARN] timer_read bad address %04X\n", addr);
+            return 0xFF;
+    }
+}
+
+void timer_write(uint16_t addr, uint8_t value) {
+    uint8_t signal_before;
+
+    timer_sync();
+
+    switch (addr) {
+        case TIMER_DIV_ADDR:
+            // Any write resets the whole counter, which can drop the selected bit
+            signal_before = timer_signal();
+            apu_div_write();
+            ctx.div_base = scheduler_now();
+            ctx.tima_sync = ctx.div_base;
+            if (signal_before) {
+                increment();
+            }
+            break;
+        case TIMER_TIMA_ADDR:
+            // Writing during the reload delay cancels the reload and interrupt
+            if (ctx.reloading) {
+                ctx.reloading = 0;
+                scheduler_cancel(SCHED_TIMER_RELOAD);
+            }
+            ctx.tima = value;
+            break;
+        case TIMER_TMA_ADDR:
+            ctx.tma = value;
+            break;
+        case TIMER_TAC_ADDR:
+            // Disabling the timer or switching frequency can drop the signal
+            signal_before = timer_signal();
+            ctx.tac = value | 0xF8;
+            if (signal_before && !timer_signal()) {
+                increment();
+            }
+            break;
+        default:
+            printf("[WARN] timer_write bad address %04X\n", addr);
+            return;
+    }
+
+    schedule_overflow();
+}
+
+static void timer_on_overflow(void) {
+    ctx.tima = 0x00;
+    ctx.tima_sync = scheduler_now();
+    ctx.reloading = 1;
+    scheduler_cancel(SCHED_TIMER_OVERFLOW);
+    scheduler_schedule(SCHED_TIMER_RELOAD, scheduler_now() + TIMER_RELOAD_DELAY);
+}
+
+static void timer_on_reload(void) {
+    ctx.tima = ctx.tma;
+    ctx.tima_sync = scheduler_now();
+    ctx.reloading = 0;
+    cpu_request_interrupt(INT_TIMER);
+    schedule_overflow();
+}
+
+void timer_save(state_buffer *s) {
+    state_put_u64(s, ctx.div_base);
+    state_put_u64(s, ctx.tima_sync);
+    state_put_u8(s, ctx.tima);
+    state_put_u8(s, ctx.tma);
+    state_put_u8(s, ctx.tac);
+    state_put_u8(s, ctx.reloading);
+}
+
+void timer_load(state_buffer *s) {
+    ctx.div_base = state_get_u64(s);
+    ctx.tima_sync = state_get_u64(s);
+    ctx.tima = state_get_u8(s);
+    ctx.tma = state_get_u8(s);
+    ctx.tac = state_get_u8(s);
+    ctx.reloading = state_get_u8(s);
+}
@@ -0,0 +1,133 @@
+#include "video.h"
+#include "host_io.h"
+#include "scale.h"
+
+#include <string.h>
+
+#define Y4M_HEADER "YUV4MPEG2 W160 H144 F4194304:70224 Ip A1:1 C444\n"
+#define Y4M_FRAME  "FRAME\n"
+
+#define PIXELS RECORDER_FRAME_SIZE
+
+// Largest encoded frame, Y4M's marker and three planes
+#define FRAME_BUFFER_SIZE (sizeof(Y4M_FRAME) - 1 + PIXELS * 3)
+
+static struct {
+    recorder       *recorder;
+    int             fd;
+    gb_video_format format;
+    uint8_t         colours[4][3];   // RGB or YUV bytes of each colour index
+    uint8_t         encoded[FRAME_BUFFER_SIZE];
+    size_t          encoded_size;
+    uint64_t        bytes;
+    recorder_stats  last_stats;      // kept once the recorder is gone
+} video;
+
+// BT.601 limited range, what Y4M readers assume
+static void to_yuv(uint32_t argb, uint8_t *yuv) {
+    int r = (argb >> 16) & 0xFF;
+    int g = (argb >> 8) & 0xFF;
+    int b = argb & 0xFF;
+
+    yuv[0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    yuv[1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    yuv[2] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static void encode(const uint8_t *indices) {
+    uint8_t *out = video.encoded;
+
+    if (video.format == GB_VIDEO_Y4M) {
+        memcpy(out, Y4M_FRAME, sizeof(Y4M_FRAME) - 1);
+        out += sizeof(Y4M_FRAME) - 1;
+        for (int plane = 0; plane < 3; plane++) {
+            for (uint32_t i = 0; i < PIXELS; i++) {
+                *out++ = video.colours[indices[i] & 0x03][plane];
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < PIXELS; i++) {
+            memcpy(out, video.colours[indices[i] & 0x03], 3);
+            out += 3;
+        }
+    }
+    video.encoded_size = out - video.encoded;
+}
+
+// Writer thread
+static uint8_t write_frame(void *user, const uint8_t *indices, uint64_t index) {
+    (void) user;
+    (void) index;
+
+    if (indices) {
+        encode(indices);
+    }
+    __atomic_store_n(&video.bytes, video.bytes + video.encoded_size, __ATOMIC_RELAXED);
+    return host_write(video.fd, video.encoded, video.encoded_size);
+}
+
+uint8_t video_open(int fd, gb_video_format format, gb_record_policy policy) {
+    if (video.recorder) {
+        printf("[ERROR] video_open: already recording\n");
+        return 0;
+    }
+    video.fd = fd;
+    video.format = format;
+    video.bytes = 0;
+    memset(&video.last_stats, 0, sizeof(video.last_stats));
+    for (int i = 0; i < 4; i++) {
+        uint32_t argb = scale_grey_palette[i];
+        if (format == GB_VIDEO_Y4M) {
+            to_yuv(argb, video.colours[i]);
+        } else {
+            video.colours[i][0] = argb >> 16;
+            video.colours[i][1] = argb >> 8;
+            video.colours[i][2] = argb;
+        }
+    }
+
+    if (format == GB_VIDEO_Y4M) {
+        if (!host_write(fd, Y4M_HEADER, sizeof(Y4M_HEADER) - 1)) {
+            printf("[ERROR] video_open: write fail\n");
+            return 0;
+        }
+        video.bytes = sizeof(Y4M_HEADER) - 1;
+    }
+
+    recorder_sink sink = { write_frame, NULL };
+    video.recorder = recorder_start(sink, policy);
+    return video.recorder != NULL;
+}
+
+uint8_t video_recording(void) {
+    return video.recorder != NULL;
+}
+
+void video_push(const uint8_t *framebuffer) {
+    recorder_push(video.recorder, framebuffer);
+}
+
+uint8_t video_close(void) {
+    if (!video.recorder) {
+        return 1;
+    }
+    video.last_stats = recorder_get_stats(video.recorder);
+    uint8_t ok = recorder_stop(video.recorder);
+    video.recorder = NULL;
+    if (!ok) {
+        printf("[ERROR] video_close: write fail\n");
+    }
+    return ok;
+}
+
+void video_detach(void) {
+    video.recorder = NULL;
+}
+
+video_stats video_get_stats(void) {
+    video_stats stats = {
+        video.recorder ? recorder_get_stats(video.recorder) : video.last_stats,
+        __atomic_load_n(&video.bytes, __ATOMIC_RELAXED),
+    };
+    return stats;
+}
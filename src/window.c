@@ -1,19 +1,66 @@
 #include "window.h"
-#include "ppu.h"
+#include "joypad.h"
+#include "host_time.h"
 #include <SDL2/SDL.h>
 
+// Window size in Game Boy pixels, SDL stretches the texture to fit
 #define SCALE 4
 
+#define TITLE "Gameboy Emulator"
+
+// Assumed when SDL can't tell
+#define DEFAULT_REFRESH_HZ 60
+
+// Frames per audio callback, about 11 ms at 48 kHz, well under the quarter
+// of the ring that rate control leaves either side of half full
+#define AUDIO_CALLBACK_FRAMES 512
+
 static SDL_Window   *window;
 static SDL_Renderer *renderer;
 static SDL_Texture  *texture;
+static SDL_AudioDeviceID audio_device;
+
+static gb_scale_filter filter;
+static uint32_t        filter_factor;
+
+static window_upload_stats upload;
+
+// Held buttons, pushed to the joypad queue whenever it changes
+static uint8_t buttons;
+
+static uint8_t quit;
+static uint8_t rewinding;   // R held
+static uint32_t speed_presses;  // Tab presses not yet taken
+static uint8_t gif_requested;   // G pressed
+
+static uint8_t key_to_button(SDL_Keycode key) {
+    switch (key) {
+        case SDLK_RIGHT:     return JOYPAD_RIGHT;
+        case SDLK_LEFT:      return JOYPAD_LEFT;
+        case SDLK_UP:        return JOYPAD_UP;
+        case SDLK_DOWN:      return JOYPAD_DOWN;
+        case SDLK_x:         return JOYPAD_A;
+        case SDLK_z:         return JOYPAD_B;
+        case SDLK_BACKSPACE: return JOYPAD_SELECT;
+        case SDLK_RETURN:    return JOYPAD_START;
+        default:             return 0;
+    }
+}
+
+uint8_t window_init(gb_scale_filter scale_filter, uint32_t factor) {
+    uint32_t texture_scale = gb_scale_factor(scale_filter, factor);
+    if (!texture_scale) {
+        printf("[ERROR] window_init: bad scale factor %u\n", factor);
+        return 0;
+    }
+    filter = scale_filter;
+    filter_factor = factor;
 
-uint8_t window_init(void) {
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         printf("[ERROR] Failed to initialise SDL2 video: %s\n", SDL_GetError());
         return 0;
     }
-    window = SDL_CreateWindow("Gameboy Emulator", SDL_WINDOWPOS_CENTERED,
+    window = SDL_CreateWindow(TITLE, SDL_WINDOWPOS_CENTERED,
         SDL_WINDOWPOS_CENTERED, GB_SCREEN_RES_X * SCALE, GB_SCREEN_RES_Y * SCALE,
         SDL_WINDOW_SHOWN);
     if (!window) {
@@ -28,8 +75,10 @@ uint8_t window_init(void) {
         return 0;
     }
 
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24,
-        SDL_TEXTUREACCESS_STATIC, GB_SCREEN_RES_X, GB_SCREEN_RES_Y);
+    // Streaming, so frames are scaled straight into the texture's memory
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, GB_SCREEN_RES_X * texture_scale,
+        GB_SCREEN_RES_Y * texture_scale);
     if (!texture) {
         printf("[ERROR] Failed to create SDL2 texture: %s\n", SDL_GetError());
         window_exit();
@@ -39,23 +88,143 @@ uint8_t window_init(void) {
     return 1;
 }
 
-void window_step(void) {
+// Runs on SDL's audio thread
+static void audio_callback(void *user, Uint8 *stream, int len) {
+    (void) user;
+    gb_audio_read((int16_t *) stream, len / (2 * sizeof(int16_t)));
+}
+
+uint32_t window_audio_open(uint32_t sample_rate) {
+    SDL_AudioSpec want = { 0 };
+    SDL_AudioSpec have;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        printf("[WARN] Failed to initialise SDL2 audio: %s\n", SDL_GetError());
+        return 0;
+    }
+    want.freq = sample_rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = AUDIO_CALLBACK_FRAMES;
+    want.callback = audio_callback;
+
+    // Starts paused, the core must be producing before the callback runs
+    audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!audio_device) {
+        printf("[WARN] Failed to open SDL2 audio device: %s\n", SDL_GetError());
+        return 0;
+    }
+    return have.freq;
+}
+
+void window_audio_start(void) {
+    if (audio_device) {
+        SDL_PauseAudioDevice(audio_device, 0);
+    }
+}
+
+uint8_t window_step(void) {
     SDL_Event event;
 
-    SDL_PollEvent(&event);
-    if (event.type == SDL_QUIT) {
-        emu_run = 0;    
+    while (SDL_PollEvent(&event)) {
+        uint8_t held = buttons;
+
+        switch (event.type) {
+            case SDL_QUIT:
+                quit = 1;
+                break;
+            case SDL_KEYDOWN:
+                if (event.key.keysym.sym == SDLK_r) {
+                    rewinding = 1;
+                } else if (event.key.keysym.sym == SDLK_TAB && !event.key.repeat) {
+                    speed_presses++;
+                } else if (event.key.keysym.sym == SDLK_g && !event.key.repeat) {
+                    gif_requested = 1;
+                }
+                held |= key_to_button(event.key.keysym.sym);
+                break;
+            case SDL_KEYUP:
+                if (event.key.keysym.sym == SDLK_r) {
+                    rewinding = 0;
+                }
+                held &= ~key_to_button(event.key.keysym.sym);
+                break;
+        }
+
+        if (held != buttons && joypad_push(held)) {
+            buttons = held;
+        }
+    }
+    return !quit;
+}
+
+uint8_t window_rewinding(void) {
+    return rewinding;
+}
+
+uint32_t window_speed_presses(void) {
+    uint32_t presses = speed_presses;
+    speed_presses = 0;
+    return presses;
+}
+
+uint8_t window_gif_requested(void) {
+    uint8_t requested = gif_requested;
+    gif_requested = 0;
+    return requested;
+}
+
+uint32_t window_refresh_hz(void) {
+    SDL_DisplayMode mode;
+
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) != 0
+            || mode.refresh_rate <= 0) {
+        return DEFAULT_REFRESH_HZ;
+    }
+    return mode.refresh_rate;
+}
+
+void window_show_speed(uint32_t speed, double achieved) {
+    char title[64];
+
+    if (speed) {
+        snprintf(title, sizeof(title), TITLE " - %ux (%.2fx)", speed, achieved);
+    } else {
+        snprintf(title, sizeof(title), TITLE " - unlimited (%.2fx)", achieved);
     }
+    SDL_SetWindowTitle(window, title);
 }
 
-void window_draw(void) {
-    SDL_UpdateTexture(texture, NULL, ppu_view, GB_SCREEN_RES_X * 3);
+void window_draw(const uint8_t *framebuffer) {
+    uint64_t start_ns = host_time_ns();
+    void *pixels;
+    int pitch;
+
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0) {
+        printf("[WARN] window_draw: SDL_LockTexture failed: %s\n", SDL_GetError());
+        return;
+    }
+    gb_scale(framebuffer, filter, filter_factor, NULL, pixels, pitch);
+    SDL_UnlockTexture(texture);
+
+    uint64_t elapsed = host_time_ns() - start_ns;
+    upload.frames++;
+    upload.total_ns += elapsed;
+    upload.max_ns = elapsed > upload.max_ns ? elapsed : upload.max_ns;
+
     SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
     SDL_RenderClear(renderer);
 }
 
+window_upload_stats window_get_upload_stats(void) {
+    return upload;
+}
+
 void window_exit(void) {
+    if (audio_device) {
+        SDL_CloseAudioDevice(audio_device);
+    }
     if (texture) {
         SDL_DestroyTexture(texture);
     }